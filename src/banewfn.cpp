@@ -5,15 +5,42 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <memory>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <csignal>
 #include <cstdlib>
+#include <ctime>
 #include <cstring>
 #include <unistd.h>
 #include <sys/stat.h>
 #include "config.h"
+#include "confstore.h"
+#include "console.h"
+#include "cpuset.h"
+#include "cube.h"
+#include "cubepack.h"
+#include "extract.h"
+#include "fchk.h"
+#include "history.h"
 #include "input.h"
+#include "plan.h"
+#include "process.h"
+#include "resultcache.h"
+#include "scratch.h"
+#include "scheduler.h"
+#include "server.h"
+#include "session.h"
+#include "trace.h"
 #include "ui.h"
 #include "utils.h"
+#include "watch.h"
+#include "wfncache.h"
+#include "workqueue.h"
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -30,14 +57,41 @@ std::vector<std::string> split(const std::string& str, char delimiter) {
     return Utils::split(str, delimiter);
 }
 
+// Set by SIGINT/SIGTERM while --watch runs: stop taking new files, let running ones finish
+static volatile std::sig_atomic_t watchStopRequested = 0;
+
+static void requestWatchStop(int) {
+    watchStopRequested = 1;
+}
+
 class MultiwfnScriptGenerator {
 private:
     ConfigManager configManager;
+    WfnCache wfnCache;
+    ResultCache resultCache;
+    std::map<std::string, std::vector<ExtractRule>> extractRules;  // Compiled [extract] rules per module
+    ResultTable resultTable;  // Batch table of extracted values (--table)
+    ScratchArea scratch;  // Per-run scratch directories (banewfn.rc: scratch=)
+    TimingHistory history;  // Timings of finished runs (banewfn.rc: history=)
+    MultiwfnSession* session = nullptr;  // Warm Multiwfn of a serve job, at its main menu
+    std::string sessionWfn;  // Absolute path of the wavefunction it has loaded
+    std::mutex terminalMutex;  // Interactive (wait) blocks take the terminal one at a time
     
 public:
     // Load banewfn.rc configuration file
     bool loadBaneWfnConfig(const std::string& configFile) {
-        return configManager.loadBaneWfnConfig(configFile);
+        if (!configManager.loadBaneWfnConfig(configFile)) {
+            return false;
+        }
+        wfnCache.setDirectory(configManager.getConfig().wfnCacheDir);
+        resultCache.setDirectory(configManager.getConfig().resultCacheDir);
+        resultCache.setMaxBytes(static_cast<uint64_t>(configManager.getConfig().resultCacheMaxMB) << 20);
+        scratch.setDirectory(configManager.getConfig().scratchDir);
+        history.setFile(configManager.getConfig().historyFile);
+        if (!configManager.getConfig().scratchOutput.empty()) {
+            scratch.setNameTemplate(configManager.getConfig().scratchOutput);
+        }
+        return true;
     }
     
     // Load module-specific conf file
@@ -45,41 +99,109 @@ public:
         return configManager.loadModuleConfig(moduleName);
     }
     
-    // Generate command sequence
-    std::vector<std::string> generateCommands(const std::string& moduleName,
-                                             const std::string& sectionName,
-                                             const std::map<std::string, std::string>& params) {
+    // Forget module confs changed on disk since they were loaded (banewfn serve)
+    std::vector<std::string> dropChangedModules() {
+        return configManager.dropChangedModules();
+    }
+    
+    // Run the module blocks on a wavefunction in a warm session instead of new Multiwfn runs
+    void useSession(MultiwfnSession* warm, const std::string& wfnFile) {
+        session = warm;
+        sessionWfn = wfnFile;
+    }
+    
+    // Whether a module block can run in the warm session: a plain file-mode block on the
+    // session's wavefunction whose conf leads back to the main menu with [return]
+    bool canUseSession(const ModuleTask& task, const std::string& wfnFile, const ExecutionOptions& options) const {
+        return session && !options.dryrun && !options.screen && task.workDir.empty() &&
+               configManager.getModuleConfig(task.moduleName).hasReturn && Utils::absolutePath(wfnFile) == sessionWfn;
+    }
+    
+    // Files declared in the -output- blocks of the sections a task runs ([main] and its %process steps)
+    std::vector<std::string> generateOutputs(const ModuleTask& task) const {
         std::vector<std::string> result;
+        if (!configManager.hasModuleConfig(task.moduleName)) {
+            return result;
+        }
+        const ModuleConfig& modConfig = configManager.getModuleConfig(task.moduleName);
         
+        auto addSection = [&](const std::string& sectionName, const std::map<std::string, std::string>& params) {
+            auto it = modConfig.sections.find(sectionName);
+            if (it == modConfig.sections.end()) {
+                return;
+            }
+            for (const auto& tmpl : it->second.outputTemplates) {
+                std::string name;
+                tmpl.render(params, name);
+                result.push_back(std::move(name));
+            }
+        };
+        addSection("main", task.params);
+        for (const auto& step : task.postProcessSteps) {
+            addSection(step.first, step.second);
+        }
+        return result;
+    }
+    
+    // Variables of the scratch_output template for a task's outputs
+    static std::map<std::string, std::string> outputVars(const ModuleTask& task, const std::string& wfnFile) {
+        return {{"input", getBaseName(wfnFile)}, {"module", task.moduleName}, {"stem", taskFileStem(task, wfnFile)}};
+    }
+    
+    // Name under which a declared output of a task ends up (renamed when promoted from scratch)
+    std::string finalOutputName(const ModuleTask& task, const std::string& wfnFile, const std::string& output,
+                                const ExecutionOptions& options) const {
+        if (!scratch.isEnabled() || !options.scratch) {
+            return output;
+        }
+        return scratch.finalName(output, outputVars(task, wfnFile));
+    }
+    
+    // Replace the cube files declared as outputs of the tasks by packed cubes (--pack)
+    void packTaskOutputs(const std::vector<const ModuleTask*>& group, const std::string& wfnFile,
+                         int cores, const ExecutionOptions& options) {
+        if (!options.packCubes || options.dryrun) {
+            return;
+        }
+        for (const ModuleTask* task : group) {
+            for (const auto& declared : generateOutputs(*task)) {
+                std::string output = inWorkDir(*group[0], finalOutputName(*group[0], wfnFile, declared, options));
+                size_t dot = output.find_last_of('.');
+                std::string ext = dot == std::string::npos ? "" : output.substr(dot);
+                if ((ext != ".cub" && ext != ".cube") || !Utils::fileExists(output)) {
+                    continue;
+                }
+                std::string packed = output.substr(0, dot) + ".bcub";
+                std::string error;
+                if (packCube(output, packed, options.packError, cores, error)) {
+                    remove(output.c_str());
+                    std::cout << "Packed " << output << " -> " << packed << std::endl;
+                } else {
+                    std::cerr << "Warning: Keeping text cube " << output << ": " << error << std::endl;
+                }
+            }
+        }
+    }
+    
+    // Append the commands of one section of a module, rendered with the given parameters
+    void appendSectionCommands(const std::string& moduleName, const std::string& sectionName,
+                               const std::map<std::string, std::string>& params, std::string& out) const {
         if (!configManager.hasModuleConfig(moduleName)) {
             std::cerr << "Warning: Module config [" << moduleName << "] not loaded" << std::endl;
-            return result;
+            return;
         }
         
         const ModuleConfig& modConfig = configManager.getModuleConfig(moduleName);
-        
-        if (modConfig.sections.find(sectionName) == modConfig.sections.end()) {
+        auto it = modConfig.sections.find(sectionName);
+        if (it == modConfig.sections.end()) {
             std::cerr << "Warning: Section [" << sectionName << "] not found in module " << moduleName << std::endl;
-            return result;
+            return;
         }
         
-        const Section& section = modConfig.sections.at(sectionName);
-        
-        // Merge default values and provided parameters
-        // Only override defaults if provided value is non-empty, to mimic ${var:-default}
-        std::map<std::string, std::string> finalParams = section.defaults;
-        for (const auto& param : params) {
-            if (!param.second.empty()) {
-                finalParams[param.first] = param.second;
-            }
+        for (const auto& tmpl : it->second.commandTemplates) {
+            tmpl.render(params, out);
+            out += '\n';
         }
-        
-        // Generate commands
-        for (const auto& cmd : section.commands) {
-            result.push_back(replacePlaceholders(cmd, finalParams));
-        }
-        
-        return result;
     }
     
     // Parse inp file, return all module tasks
@@ -97,82 +219,227 @@ public:
         return InputParser::parseInpFileWithWfnAndCores(inpFile);
     }
     
-    // Generate command script for a single module
-    std::string generateModuleScript(const ModuleTask& task, bool includeQuit) {
-        std::stringstream output;
-        
+    // Parameter values naming an existing file, made absolute so that a Multiwfn running in
+    // another directory still finds them (logfile=, fragdef=, ...). A file in the block's
+    // directory (linked there from the blocks it runs after) wins over one in the current directory.
+    static std::map<std::string, std::string> withAbsoluteInputs(const std::map<std::string, std::string>& params,
+                                                                 const ModuleTask& task, bool inScratch) {
+        std::map<std::string, std::string> result = params;
+        for (auto& param : result) {
+            std::string& value = param.second;
+            if (value.empty() || Utils::isAbsolutePath(value)) {
+                continue;
+            }
+            if (!task.workDir.empty() && Utils::fileExists(inWorkDir(task, value))) {
+                if (inScratch) {
+                    value = Utils::absolutePath(inWorkDir(task, value));
+                }
+            } else if (Utils::fileExists(value)) {
+                value = Utils::absolutePath(value);
+            }
+        }
+        return result;
+    }
+    
+    // Whether Multiwfn runs in the scratch area instead of the task's directory
+    bool usesScratch(const ExecutionOptions& options) const {
+        return scratch.isEnabled() && options.scratch && !options.dryrun;
+    }
+    
+    // Generate command script for a single module. When Multiwfn runs in a scratch or block
+    // directory, input files named by parameters are passed by absolute path.
+    std::string generateModuleScript(const ModuleTask& task, bool includeQuit, bool inScratch = false) {
         if (!configManager.hasModuleConfig(task.moduleName)) {
             std::cerr << "Error: Module config not loaded for " << task.moduleName << std::endl;
             return "";
         }
         
         const ModuleConfig& modConfig = configManager.getModuleConfig(task.moduleName);
+        std::string output;
+        
+        bool elsewhere = inScratch || !task.workDir.empty();
         
         // Generate main module commands (pre-processing)
-        auto commands = generateCommands(task.moduleName, "main", task.params);
-        for (const auto& cmd : commands) {
-            output << cmd << "\n";
-        }
+        appendSectionCommands(task.moduleName, "main",
+                              elsewhere ? withAbsoluteInputs(task.params, task, inScratch) : task.params, output);
         
         // Generate post-processing commands
         for (const auto& step : task.postProcessSteps) {
-            auto stepCommands = generateCommands(task.moduleName, step.first, step.second);
-            for (const auto& cmd : stepCommands) {
-                output << cmd << "\n";
-            }
+            appendSectionCommands(task.moduleName, step.first,
+                                  elsewhere ? withAbsoluteInputs(step.second, task, inScratch) : step.second, output);
         }
         
         // Add quit commands only if requested
         if (includeQuit) {
             for (const auto& quitCmd : modConfig.quitCommands) {
-                output << quitCmd << "\n";
+                output += quitCmd;
+                output += '\n';
             }
         }
         
-        return output.str();
+        return output;
     }
     
-    // Execute single module Multiwfn task (file-based mode)
-    bool executeModuleTaskFile(const ModuleTask& task, const std::string& wfnFile, 
-                               int cores, const ExecutionOptions& options) {
-        std::cout << "\n>>> Processing module: " << task.moduleName << std::endl;
-        
-        // Generate command script with quit commands
-        std::string commands = generateModuleScript(task, true);
-        if (commands.empty()) {
-            return false;
+    // Path of a file written by a task, as seen from the current directory
+    static std::string inWorkDir(const ModuleTask& task, const std::string& path) {
+        if (task.workDir.empty() || Utils::isAbsolutePath(path)) {
+            return path;
         }
-        
-        // Create command file
-        std::string wfnBaseName = getBaseName(wfnFile);
-        std::string cmdFileName = task.moduleName + "_" + wfnBaseName;
+        return task.workDir + "/" + path;
+    }
+    
+    // Output file stem of a task: <module>_<wfn>[_<blockIndex>]
+    static std::string taskFileStem(const ModuleTask& task, const std::string& wfnFile) {
+        std::string stem = task.moduleName + "_" + getBaseName(wfnFile);
         if (task.blockIndex > 0) {
-            cmdFileName += "_" + std::to_string(task.blockIndex);
+            stem += "_" + std::to_string(task.blockIndex);
         }
-        cmdFileName += ".txt";
-        
-        std::ofstream cmdFile(cmdFileName);
-        if (!cmdFile.is_open()) {
-            std::cerr << "Error: Cannot create command file: " << cmdFileName << std::endl;
-            return false;
+        return stem;
+    }
+    
+    // Command line of a Multiwfn run on a wavefunction. Runs in another working directory
+    // need absolute paths for the wavefunction (and for a Multiwfn given by a relative path).
+    std::vector<std::string> multiwfnArgs(const std::string& wfnFile, int cores, bool absolute = false) {
+        std::string exec = configManager.getConfig().multiwfnExec;
+        std::string wfn = wfnCache.resolve(wfnFile);
+        if (absolute) {
+            wfn = Utils::absolutePath(wfn);
+            if (exec.find_first_of("/\\") != std::string::npos) {
+                exec = Utils::absolutePath(exec);
+            }
         }
-        cmdFile << commands;
-        cmdFile.close();
-        
-        // In dryrun mode, only generate the file
+        std::vector<std::string> args = {exec, wfn};
+        if (cores > 0) {
+            args.push_back("-np");
+            args.push_back(std::to_string(cores));
+        }
+        return args;
+    }
+    
+    // Indices of a batch's files, longest predicted first. Predictions come from cost models
+    // fitted on the timing history (summed over the blocks of the input); files are ranked by
+    // their .fchk header size (nbasis^2 * natoms) where the history has nothing to say.
+    // Equal costs keep the batch order.
+    std::vector<size_t> costOrder(const std::vector<std::string>& wfnFiles, const std::vector<ModuleTask>& blocks,
+                                  int jobs) {
+        CostModel model;
+        std::vector<HistoryRecord> records;
+        if (history.isEnabled() && history.load(records)) {
+            model.fit(records);
+        }
+        std::vector<double> predicted(wfnFiles.size(), 0);
+        std::vector<double> size(wfnFiles.size(), 0);
+        size_t predictedFiles = 0;
+        for (size_t i = 0; i < wfnFiles.size(); i++) {
+            FchkHeader header;
+            if (FchkFile::isFchkFile(wfnFiles[i]) && header.scan(wfnFiles[i])) {
+                size[i] = header.cost();
+            }
+            bool any = false;
+            for (const auto& task : blocks) {
+                double seconds = 0;
+                if (!task.moduleName.empty() && !model.empty() &&
+                    model.predict(task.moduleName, stepList(task), header.nbasis, header.natoms, seconds)) {
+                    predicted[i] += seconds;
+                    any = true;
+                }
+            }
+            if (any) {
+                predictedFiles++;
+            }
+        }
+        std::vector<size_t> order(wfnFiles.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return predicted[a] != predicted[b] ? predicted[a] > predicted[b] : size[a] > size[b];
+        });
+        
+        if (predictedFiles > 0) {
+            // Makespan of the ordered batch when each file goes to the first free worker
+            std::vector<double> busy(std::max(1, jobs), 0);
+            for (size_t idx : order) {
+                *std::min_element(busy.begin(), busy.end()) += predicted[idx];
+            }
+            std::cout << "Estimated batch time from timing history: "
+                      << static_cast<long long>(*std::max_element(busy.begin(), busy.end()) + 0.5) << " s ("
+                      << predictedFiles << "/" << wfnFiles.size() << " files predicted)" << std::endl;
+        }
+        return order;
+    }
+    
+    // OpenMP threads of a Multiwfn run, matched to its -np
+    std::vector<std::string> multiwfnEnv(int cores) const {
+        if (cores <= 0) {
+            return {};
+        }
+        return {"OMP_NUM_THREADS=" + std::to_string(cores)};
+    }
+    
+    // Fit a core budget to the CPUs this process may use (affinity mask, cgroup quota). An
+    // unspecified budget is left to Multiwfn's own setting for a single job; concurrent jobs
+    // share the usable CPUs.
+    int fitCoreBudget(int cores, bool concurrent, const CpuSet& cpuSet) const {
+        int usable = cpuSet.usableCount();
+        if (cores > usable) {
+            std::cout << "Note: Only " << usable << " of " << cores << " requested cores are usable: "
+                      << cpuSet.describe() << std::endl;
+            return usable;
+        }
+        if (cores <= 0 && concurrent) {
+            return usable;
+        }
+        return cores;
+    }
+    
+    // Run Multiwfn with a generated stdin script, logging to <stem>.out.
+    // The script is fed from memory; only dry-run mode writes it to <stem>.txt.
+    // When given, `extract` scans the output as it is produced (or the restored log on a cache hit).
+    // With a workDir, Multiwfn runs there while the log stays in the current directory.
+    // `outcome` receives the exit status and resource usage when Multiwfn was actually started.
+    bool runMultiwfnScript(const std::string& label, const std::string& stem, const std::string& commands,
+                           const std::string& wfnFile, int cores, const ExecutionOptions& options,
+                           ExtractSink* extract = nullptr, const std::string& workDir = "",
+                           ProcessResult* outcome = nullptr) {
+        // In dryrun mode, only generate the command file
         if (options.dryrun) {
-            std::cout << "Dry-run mode: Command file generated, skipping execution." << std::endl;
+            std::string cmdFileName = stem + ".txt";
+            std::ofstream cmdFile(cmdFileName);
+            if (!cmdFile.is_open()) {
+                std::cerr << "Error: Cannot create command file: " << cmdFileName << std::endl;
+                return false;
+            }
+            cmdFile << commands;
+            cmdFile.close();
+            std::cout << "Dry-run mode: Command file " << cmdFileName << " generated, skipping execution." << std::endl;
             return true;
         }
         
+        // Result cache: identical wavefunction + script + Multiwfn binary -> restore instead of rerunning
+        std::string cacheKey;
+        if (resultCache.isEnabled() && options.resultCache && !options.screen) {
+            cacheKey = resultCache.makeKey(wfnFile, commands, configManager.getConfig().multiwfnExec);
+            if (resultCache.restore(cacheKey, stem + ".out", workDir.empty() ? "." : workDir)) {
+                std::cout << "Restored cached result for " << label << " (" << cacheKey << ")" << std::endl;
+                if (extract) {
+                    extract->scanFile(stem + ".out");
+                }
+                return true;
+            }
+        }
+        // Outputs can only be attributed to this run when no other job shares the directory
+        std::string runDir = workDir.empty() ? "." : workDir;
+        bool recordResult = !cacheKey.empty() && ((options.jobs <= 1 && !options.sharedDirectory) || !workDir.empty());
+        ResultCache::Snapshot before;
+        if (recordResult) {
+            before = ResultCache::snapshot(runDir);
+        }
+        
         // Generate output filename or screen output
         std::string outFile;
         if (!options.screen) {
-            outFile = task.moduleName + "_" + wfnBaseName;
-            if (task.blockIndex > 0) {
-                outFile += "_" + std::to_string(task.blockIndex);
-            }
-            outFile += ".out";
+            outFile = stem + ".out";
             
             std::ofstream outFileStream(outFile);
             if (outFileStream.is_open()) {
@@ -181,41 +448,548 @@ public:
             }
         }
         
-        std::stringstream cmd;
-        cmd << configManager.getConfig().multiwfnExec << " " << wfnFile << " < " << cmdFileName;
+        ProcessSpec spec;
+        spec.args = multiwfnArgs(wfnFile, cores, !workDir.empty());
+        spec.env = multiwfnEnv(cores);
+        spec.input = commands;
+        spec.outputFile = outFile;
+        spec.workDir = workDir;
+        spec.ownProcessGroup = options.ownProcessGroup;
         
-        if (!options.screen) {
-            cmd << " >> " << outFile;
+        if (extract) {
+            spec.sinks.push_back(extract);
         }
         
-        if (cores > 0) {
-            cmd << " -np " << cores;
+        // Console output: --tee mirrors the log, --screen replaces it. Concurrent jobs get
+        // line-prefixed output so that they don't garble each other.
+        std::unique_ptr<ConsoleStream> console;
+        bool multiplexed = options.jobs > 1 || options.blocks > 1;
+        if (options.tee || (options.screen && (multiplexed || extract))) {
+            console.reset(new ConsoleStream(multiplexed ? stem : ""));
+            spec.sinks.push_back(console.get());
         }
         
-        std::cout << "Executing command: " << cmd.str() << std::endl;
+        std::cout << "Executing command: " << ProcessLauncher::describe(spec) << std::endl;
         std::cout << "Starting Multiwfn process..." << std::endl;
         
         // Execute command
-        int result = system(cmd.str().c_str());
-        
-        // Clean up command file only if not in dryrun mode
-        if (!options.dryrun) {
-            remove(cmdFileName.c_str());
+        ProcessResult result = ProcessLauncher::run(spec);
+        if (!result.started) {
+            std::cerr << "Error: Module " << label << " could not be started: " << result.error << std::endl;
+            return false;
+        }
+        if (outcome) {
+            *outcome = result;
         }
         
-        if (result == 0) {
-            std::cout << "Module " << task.moduleName << " execution completed." << std::endl;
+        if (result.exitCode == 0) {
+            std::cout << "Module " << label << " execution completed." << std::endl;
+            if (recordResult) {
+                resultCache.store(cacheKey, outFile, before, {outFile}, runDir);
+            }
             return true;
         } else {
-            std::cerr << "Error: Module " << task.moduleName 
-                     << " execution failed with error code " << result << std::endl;
+            std::cerr << "Error: Module " << label 
+                     << " execution failed with error code " << result.exitCode << std::endl;
+            return false;
+        }
+    }
+    
+    // Block of the mwfn module writing the converted wavefunction to `output`
+    static ModuleTask conversionTask(const std::string& output) {
+        ModuleTask task;
+        task.moduleName = "mwfn";
+        task.useWait = false;
+        task.blockIndex = 0;
+        task.params["output"] = output;
+        return task;
+    }
+    
+    // Load mwfn.conf for the wavefunction cache; its script and the Multiwfn binary are part of the cache key
+    bool loadConverter() {
+        if (!loadModuleConfig("mwfn")) {
+            return false;
+        }
+        wfnCache.setConverter(ResultCache::binaryIdentity(configManager.getConfig().multiwfnExec) + "\n" +
+                              generateModuleScript(conversionTask("<output>"), true));
+        return true;
+    }
+    
+    // Convert a wavefunction to .mwfn with the "mwfn" module conf (used by the wavefunction cache)
+    bool convertWavefunction(const std::string& src, const std::string& dst, int cores, bool ownProcessGroup = false) {
+        std::string commands = generateModuleScript(conversionTask(dst), true);
+        if (commands.empty()) {
+            return false;
+        }
+        
+        ExecutionOptions convertOptions;
+        convertOptions.resultCache = false;  // The output goes to the wavefunction cache, not the CWD
+        convertOptions.ownProcessGroup = ownProcessGroup;
+        std::string stem = "mwfn_" + getBaseName(src);
+        bool ok = runMultiwfnScript("mwfn", stem, commands, src, cores, convertOptions);
+        if (ok) {
+            remove((stem + ".out").c_str());
+        }
+        return ok;
+    }
+    
+    // Streaming extractor with the [extract] rules of the given tasks' modules
+    // (null when no result table is requested or none of the modules declares rules)
+    std::unique_ptr<ExtractSink> makeExtractSink(const std::vector<const ModuleTask*>& group) const {
+        if (!resultTable.isOpen()) {
+            return nullptr;
+        }
+        std::vector<const ExtractRule*> rules;
+        std::set<std::string> seen;
+        for (const ModuleTask* task : group) {
+            auto it = extractRules.find(task->moduleName);
+            if (it == extractRules.end() || !seen.insert(task->moduleName).second) {
+                continue;
+            }
+            for (const auto& rule : it->second) {
+                rules.push_back(&rule);
+            }
+        }
+        if (rules.empty()) {
+            return nullptr;
+        }
+        return std::unique_ptr<ExtractSink>(new ExtractSink(rules));
+    }
+    
+    // Append the extracted values of one Multiwfn run to the result table
+    void recordExtracted(const std::string& wfnFile, const std::string& label, const ExtractSink& extract) {
+        ResultRow row = {{"file", wfnFile}, {"module", label}};
+        for (auto& cell : extract.values()) {
+            row.push_back(std::move(cell));
+        }
+        resultTable.addRow(row);
+    }
+    
+    // Post-processing steps of a task, as recorded in the timing history
+    static std::string stepList(const ModuleTask& task) {
+        std::string steps;
+        for (const auto& step : task.postProcessSteps) {
+            steps += (steps.empty() ? "" : ",") + step.first;
+        }
+        return steps;
+    }
+    
+    // Append a finished Multiwfn run of a task group to the timing history
+    void recordTiming(const std::vector<const ModuleTask*>& group, const std::string& label,
+                      const std::string& wfnFile, int cores, const ProcessResult& outcome) {
+        if (!history.isEnabled() || !outcome.started) {
+            return;  // Also nothing to record for dry runs and cache hits
+        }
+        HistoryRecord record;
+        record.time = static_cast<long long>(time(nullptr));
+        record.module = label;
+        record.block = group[0]->blockIndex;
+        for (const ModuleTask* task : group) {
+            std::string steps = stepList(*task);
+            if (!steps.empty()) {
+                record.steps += (record.steps.empty() ? "" : ",") + steps;
+            }
+            // Grid settings dominate the cost of most analyses
+            auto addGrid = [&](const std::map<std::string, std::string>& params) {
+                for (const auto& param : params) {
+                    std::string key = param.first;
+                    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                    if (key.find("grid") != std::string::npos) {
+                        record.grid += (record.grid.empty() ? "" : ";") + param.first + "=" + param.second;
+                    }
+                }
+            };
+            addGrid(task->params);
+            for (const auto& step : task->postProcessSteps) {
+                addGrid(step.second);
+            }
+        }
+        FchkHeader header;
+        if (FchkFile::isFchkFile(wfnFile) && header.scan(wfnFile)) {
+            record.nbasis = header.nbasis;
+            record.natoms = header.natoms;
+        }
+        record.cores = cores;
+        record.wall = outcome.wallSeconds;
+        record.cpu = outcome.cpuSeconds;
+        record.peakRssKb = outcome.peakRssKb;
+        record.exitCode = outcome.exitCode;
+        record.wfnFile = wfnFile;
+        if (!history.append(record)) {
+            std::cerr << "Warning: Cannot append to timing history " << history.getFile() << std::endl;
+        }
+    }
+    
+    // Run the Multiwfn script of a task group. With a scratch area, Multiwfn runs in a fresh
+    // scratch directory and everything it leaves there is promoted into the group's working
+    // directory afterwards (also after a failure, so that partial results can be inspected).
+    bool runTaskScript(const std::vector<const ModuleTask*>& group, const std::string& label,
+                       const std::string& commands, const std::string& wfnFile, int cores,
+                       const ExecutionOptions& options, ExtractSink* extract) {
+        const ModuleTask& first = *group[0];
+        std::string stem = taskFileStem(first, wfnFile);
+        ProcessResult outcome;
+        if (!scratch.isEnabled() || !options.scratch || options.dryrun) {
+            bool ok = runMultiwfnScript(label, stem, commands, wfnFile, cores, options, extract, first.workDir, &outcome);
+            recordTiming(group, label, wfnFile, cores, outcome);
+            return ok;
+        }
+        
+        std::string scratchDir = scratch.create(stem);
+        if (scratchDir.empty()) {
+            std::cerr << "Error: Cannot create scratch directory in " << scratch.getDirectory() << std::endl;
+            return false;
+        }
+        bool ok = runMultiwfnScript(label, stem, commands, wfnFile, cores, options, extract, scratchDir, &outcome);
+        recordTiming(group, label, wfnFile, cores, outcome);
+        
+        std::vector<std::string> declared;
+        for (const ModuleTask* task : group) {
+            std::vector<std::string> outputs = generateOutputs(*task);
+            declared.insert(declared.end(), outputs.begin(), outputs.end());
+        }
+        if (!scratch.promote(scratchDir, first.workDir, outputVars(first, wfnFile), declared, ok)) {
+            return false;
+        }
+        return ok;
+    }
+    
+    // Run a module block in the warm session: its script followed by the conf's [return]
+    // sequence, logged to <stem>.out. The wavefunction stays loaded for the next block or job.
+    bool runSessionTask(const ModuleTask& task, const std::string& wfnFile, const ExecutionOptions& options,
+                        ExtractSink* extract) {
+        std::string commands = generateModuleScript(task, false);
+        if (commands.empty()) {
+            return false;
+        }
+        for (const auto& retCmd : configManager.getModuleConfig(task.moduleName).returnCommands) {
+            commands += retCmd + "\n";
+        }
+        
+        std::string outFile = taskFileStem(task, wfnFile) + ".out";
+        std::ofstream log(outFile, std::ios::binary);
+        if (!log.is_open()) {
+            std::cerr << "Error: Cannot create output file: " << outFile << std::endl;
             return false;
         }
+        log << UI::getLogoString();
+        StreamSink logSink(log);
+        std::vector<OutputSink*> sinks = {&logSink};
+        if (extract) {
+            sinks.push_back(extract);
+        }
+        std::unique_ptr<ConsoleStream> console;
+        if (options.tee) {
+            console.reset(new ConsoleStream(options.jobs > 1 ? taskFileStem(task, wfnFile) : ""));
+            sinks.push_back(console.get());
+        }
+        
+        std::cout << "Running in the warm Multiwfn session (pid " << session->getPid() << ") >> " << outFile << std::endl;
+        std::string error;
+        bool ok = session->run(commands, configManager.getConfig().sessionPrompt, sinks, error);
+        for (OutputSink* sink : sinks) {
+            sink->close();
+        }
+        if (!ok) {
+            // Its state is unknown now: the remaining blocks start Multiwfn as usual
+            std::cerr << "Error: Module " << task.moduleName << " failed in the warm session: " << error << std::endl;
+            session = nullptr;
+            return false;
+        }
+        std::cout << "Module " << task.moduleName << " execution completed." << std::endl;
+        return true;
+    }
+    
+    // Execute single module Multiwfn task (file-based mode)
+    bool executeModuleTaskFile(const ModuleTask& task, const std::string& wfnFile, 
+                               int cores, const ExecutionOptions& options) {
+        TraceSpan span("module", task.moduleName);
+        span.arg("file", wfnFile);
+        std::cout << "\n>>> Processing module: " << task.moduleName << std::endl;
+        
+        if (canUseSession(task, wfnFile, options)) {
+            std::unique_ptr<ExtractSink> extract = makeExtractSink({&task});
+            if (!runSessionTask(task, wfnFile, options, extract.get())) {
+                return false;
+            }
+            if (extract) {
+                recordExtracted(wfnFile, task.moduleName, *extract);
+            }
+            packTaskOutputs({&task}, wfnFile, cores, options);
+            return true;
+        }
+        
+        // Generate command script with quit commands
+        std::string commands = generateModuleScript(task, true, usesScratch(options));
+        if (commands.empty()) {
+            return false;
+        }
+        
+        std::unique_ptr<ExtractSink> extract = options.dryrun ? nullptr : makeExtractSink({&task});
+        if (!runTaskScript({&task}, task.moduleName, commands, wfnFile, cores, options, extract.get())) {
+            return false;
+        }
+        if (extract) {
+            recordExtracted(wfnFile, task.moduleName, *extract);
+        }
+        packTaskOutputs({&task}, wfnFile, cores, options);
+        return true;
+    }
+    
+    // Whether a task may be followed by another task in the same fused Multiwfn session:
+    // it must be a non-interactive module block with no %command, and its conf must
+    // declare a [return] sequence leading back to the Multiwfn main menu
+    bool canFuseWithNext(const ModuleTask& task) const {
+        if (task.moduleName.empty() || task.useWait || !task.commands.empty() || !task.cubeOps.empty()) {
+            return false;
+        }
+        return configManager.getModuleConfig(task.moduleName).hasReturn;
+    }
+    
+    // Execute consecutive module tasks in one Multiwfn session (wavefunction loaded once).
+    // The group's output is written to the first task's <module>_<wfn>.out, and only the
+    // last task's [quit] sequence and %command block are run.
+    bool executeModuleTasksFused(const std::vector<const ModuleTask*>& group, const std::string& wfnFile,
+                                 int cores, const ExecutionOptions& options) {
+        if (group.size() == 1) {
+            return executeModuleTask(*group[0], wfnFile, cores, options);
+        }
+        
+        std::string label;
+        for (size_t i = 0; i < group.size(); i++) {
+            label += (i > 0 ? "+" : "") + group[i]->moduleName;
+        }
+        TraceSpan span("module", label);
+        span.arg("file", wfnFile);
+        std::cout << "\n>>> Processing fused modules: " << label << std::endl;
+        
+        std::string commands;
+        for (size_t i = 0; i < group.size(); i++) {
+            const ModuleTask& task = *group[i];
+            bool isLast = (i + 1 == group.size());
+            std::string script = generateModuleScript(task, isLast, usesScratch(options));
+            if (script.empty()) {
+                return false;
+            }
+            commands += script;
+            if (!isLast) {
+                for (const auto& retCmd : configManager.getModuleConfig(task.moduleName).returnCommands) {
+                    commands += retCmd + "\n";
+                }
+            }
+        }
+        
+        std::unique_ptr<ExtractSink> extract = options.dryrun ? nullptr : makeExtractSink(group);
+        if (!runTaskScript(group, label, commands, wfnFile, cores, options, extract.get())) {
+            return false;
+        }
+        if (extract) {
+            recordExtracted(wfnFile, label, *extract);
+        }
+        packTaskOutputs(group, wfnFile, cores, options);
+        return executeCubeBlock(*group.back(), cores, options) && executeCommandBlock(*group.back(), wfnFile, options);
+    }
+    
+    // Execute the tasks of one wavefunction in order, fusing consecutive blocks when requested
+    bool executeTaskList(const std::vector<const ModuleTask*>& tasks, const std::string& wfnFile,
+                         int cores, const ExecutionOptions& options) {
+        bool allSuccess = true;
+        size_t i = 0;
+        while (i < tasks.size()) {
+            std::vector<const ModuleTask*> group;
+            group.push_back(tasks[i]);
+            if (options.fuse) {
+                while (i + group.size() < tasks.size() && canFuseWithNext(*group.back())) {
+                    const ModuleTask* next = tasks[i + group.size()];
+                    if (next->moduleName.empty() || next->useWait) {
+                        break;
+                    }
+                    group.push_back(next);
+                }
+            }
+            if (!executeModuleTasksFused(group, wfnFile, cores, options)) {
+                allSuccess = false;
+            }
+            i += group.size();
+        }
+        return allSuccess;
+    }
+    
+    // Bare %command/%cube blocks and interactive blocks are barriers in dependency scheduling:
+    // they wait for every earlier block and every later block waits for them
+    static bool isBarrier(const ModuleTask& task) {
+        return task.moduleName.empty() || task.useWait;
+    }
+    
+    // Blocks an after= reference points to: blocks with that name=, else all blocks of that
+    // module, else the blocks declaring that file in an -output- block of their conf
+    std::vector<size_t> findReferencedBlocks(const std::vector<ModuleTask>& tasks, size_t self,
+                                             const std::string& ref) const {
+        std::vector<size_t> matches;
+        for (int pass = 0; pass < 3 && matches.empty(); pass++) {
+            for (size_t j = 0; j < tasks.size(); j++) {
+                if (j == self) {
+                    continue;
+                }
+                const ModuleTask& other = tasks[j];
+                bool match = false;
+                if (pass == 0) {
+                    match = other.name == ref;
+                } else if (pass == 1) {
+                    match = other.moduleName == ref;
+                } else {
+                    std::vector<std::string> outputs = generateOutputs(other);
+                    match = std::find(outputs.begin(), outputs.end(), ref) != outputs.end();
+                }
+                if (match) {
+                    matches.push_back(j);
+                }
+            }
+        }
+        return matches;
+    }
+    
+    // Dependency lists of the blocks of one wavefunction (deps[i] = blocks that block i waits for)
+    bool resolveDependencies(const std::vector<ModuleTask>& tasks, std::vector<std::vector<size_t>>& deps) const {
+        deps.assign(tasks.size(), std::vector<size_t>());
+        bool hasBarrier = false;
+        size_t lastBarrier = 0;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            const ModuleTask& task = tasks[i];
+            std::set<size_t> found;
+            if (isBarrier(task)) {
+                for (size_t j = 0; j < i; j++) {
+                    found.insert(j);
+                }
+            } else if (hasBarrier) {
+                found.insert(lastBarrier);
+            }
+            for (const auto& ref : task.after) {
+                std::vector<size_t> matches = findReferencedBlocks(tasks, i, ref);
+                if (matches.empty()) {
+                    std::cerr << "Error: Block [" << task.moduleName << "] depends on unknown block or output: "
+                              << ref << std::endl;
+                    return false;
+                }
+                found.insert(matches.begin(), matches.end());
+            }
+            deps[i].assign(found.begin(), found.end());
+            if (isBarrier(task)) {
+                hasBarrier = true;
+                lastBarrier = i;
+            }
+        }
+        
+        // Every block must become ready at some point: peel off blocks without pending dependencies
+        std::vector<size_t> pending(tasks.size());
+        std::vector<size_t> queue;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            pending[i] = deps[i].size();
+            if (pending[i] == 0) {
+                queue.push_back(i);
+            }
+        }
+        for (size_t q = 0; q < queue.size(); q++) {
+            for (size_t i = 0; i < tasks.size(); i++) {
+                if (std::find(deps[i].begin(), deps[i].end(), queue[q]) != deps[i].end() && --pending[i] == 0) {
+                    queue.push_back(i);
+                }
+            }
+        }
+        if (queue.size() != tasks.size()) {
+            for (size_t i = 0; i < tasks.size(); i++) {
+                if (pending[i] > 0) {
+                    std::cerr << "Error: Block [" << tasks[i].moduleName << "] is part of a dependency cycle" << std::endl;
+                }
+            }
+            return false;
+        }
+        return true;
+    }
+    
+    // Make the declared outputs of a finished block visible in the working directory of a block
+    // that depends on it (hard link, or copy across filesystems)
+    void linkDependencyOutputs(const ModuleTask& from, const ModuleTask& to, const std::string& wfnFile,
+                               const ExecutionOptions& options) const {
+        for (const auto& declared : generateOutputs(from)) {
+            std::string output = finalOutputName(from, wfnFile, declared, options);
+            std::string src = inWorkDir(from, output);
+            std::string dst = inWorkDir(to, output);
+            if (src == dst || !Utils::fileExists(src)) {
+                continue;
+            }
+            if (!Utils::linkOrCopyFile(src, dst)) {
+                std::cerr << "Warning: Cannot make " << src << " available as " << dst << std::endl;
+            }
+        }
+    }
+    
+    // Execute the tasks of one wavefunction as a dependency graph (--blocks): blocks without
+    // unfinished dependencies run concurrently, each module block in its own working directory
+    // named after its output stem, so that fixed output names don't collide
+    bool executeTaskGraph(const std::vector<const ModuleTask*>& blocks, const std::string& wfnFile,
+                          int cores, const ExecutionOptions& options) {
+        // Blocks are copied here: their working directories depend on the wavefunction
+        std::vector<ModuleTask> tasks;
+        tasks.reserve(blocks.size());
+        for (const ModuleTask* block : blocks) {
+            tasks.push_back(*block);
+            if (!isBarrier(tasks.back())) {
+                tasks.back().workDir = taskFileStem(tasks.back(), wfnFile);
+            }
+        }
+        std::vector<std::vector<size_t>> deps;
+        if (!resolveDependencies(tasks, deps)) {
+            return false;
+        }
+        
+        // Barriers run alone and get the whole budget. Concurrent blocks are pinned to disjoint
+        // parts of the CPUs this thread may use (those of the file's job with --jobs).
+        int blockCores = BatchScheduler::splitCores(cores, options.blocks);
+        CpuSet cpuSet = CpuSet::detect();
+        std::vector<std::vector<int>> blockCpus = cpuSet.partition(options.blocks, blockCores);
+        BatchScheduler scheduler(options.blocks);
+        std::vector<bool> results = scheduler.runGraph(deps, [&](size_t idx, int workerId) {
+            const ModuleTask& task = tasks[idx];
+            if (!blockCpus.empty()) {
+                CpuSet::pinThread(isBarrier(task) ? cpuSet.getCpus() : blockCpus[workerId]);
+            }
+            if (!options.dryrun) {
+                if (!task.workDir.empty() && !Utils::makeDirs(task.workDir)) {
+                    std::cerr << "Error: Cannot create working directory: " << task.workDir << std::endl;
+                    return false;
+                }
+                for (size_t dep : deps[idx]) {
+                    linkDependencyOutputs(tasks[dep], task, wfnFile, options);
+                }
+            }
+            return executeModuleTask(task, wfnFile, isBarrier(task) ? cores : blockCores, options);
+        });
+        if (!blockCpus.empty()) {
+            CpuSet::pinThread(cpuSet.getCpus());  // A single worker runs on this thread
+        }
+        
+        bool allSuccess = true;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            if (results[i]) {
+                continue;
+            }
+            allSuccess = false;
+            for (size_t dep : deps[i]) {
+                if (!results[dep]) {
+                    std::cerr << "Skipped block [" << tasks[i].moduleName << "]: a block it depends on failed" << std::endl;
+                    break;
+                }
+            }
+        }
+        return allSuccess;
     }
     
     // Execute single module Multiwfn task (pipe/interactive mode)
     bool executeModuleTaskPipe(const ModuleTask& task, const std::string& wfnFile, 
                                int cores, const ExecutionOptions& options) {
+        TraceSpan span("module", task.moduleName + " (interactive)");
+        span.arg("file", wfnFile);
         std::cout << "\nProcessing module: " << task.moduleName << " (interactive mode)" << std::endl;
         
         // In dryrun mode, skip wait tasks
@@ -229,7 +1003,13 @@ public:
         if (commands.empty()) {
             return false;
         }
-        
+        return runInteractiveScript(task.moduleName, commands, wfnFile, cores);
+    }
+    
+    // Feed a script to Multiwfn, then hand its stdin over to the user
+    bool runInteractiveScript(const std::string& label, const std::string& commands,
+                              const std::string& wfnFile, int cores) {
+#ifdef PLATFORM_WINDOWS
         // Parse commands into individual lines (preserve empty lines!)
         std::vector<std::string> cmdLines;
         std::stringstream ss(commands);
@@ -239,10 +1019,9 @@ public:
             cmdLines.push_back(line);
         }
         
-        // Build pipe command: cross-platform compatible
+        // Build pipe command
         std::stringstream cmd;
         
-#ifdef PLATFORM_WINDOWS
         // Windows style: cmd /c "(echo cmd1; echo cmd2; ...; type con) | Multiwfn file"
         cmd << "cmd /c \"(";
         
@@ -264,31 +1043,7 @@ public:
             }
         }
         
-        cmd << "type con) | " << configManager.getConfig().multiwfnExec << " " << wfnFile << "\"";
-#else
-        // Linux style: (echo cmd1; echo cmd2; ...; cat) | Multiwfn file
-        cmd << "(";
-        
-        for (const auto& cmdLine : cmdLines) {
-            std::string trimmedLine = trim(cmdLine);
-            if (trimmedLine.empty()) {
-                // For empty lines, use echo without arguments to produce empty input
-                cmd << "echo; ";
-            } else {
-                // For non-empty lines, escape quotes and use echo
-                std::string escaped = cmdLine;
-                // Escape any existing quotes in the command
-                size_t pos = 0;
-                while ((pos = escaped.find('"', pos)) != std::string::npos) {
-                    escaped.replace(pos, 1, "\\\"");
-                    pos += 2;
-                }
-                cmd << "echo \"" << escaped << "\"; ";
-            }
-        }
-        
-        cmd << "cat) | " << configManager.getConfig().multiwfnExec << " " << wfnFile;
-#endif
+        cmd << "type con) | " << configManager.getConfig().multiwfnExec << " " << wfnCache.resolve(wfnFile) << "\"";
         
         if (cores > 0) {
             cmd << " -np " << cores;
@@ -299,23 +1054,68 @@ public:
         
         // Execute command
         int result = system(cmd.str().c_str());
+#else
+        // Feed the generated commands through a pipe, then hand stdin over to the user
+        ProcessSpec spec;
+        spec.args = multiwfnArgs(wfnFile, cores);
+        spec.env = multiwfnEnv(cores);
+        spec.input = commands;
+        spec.forwardStdin = true;
+        
+        std::cout << "Executing command: " << ProcessLauncher::describe(spec) << std::endl;
+        std::cout << "Starting Multiwfn in interactive mode...\n" << std::endl;
+        
+        ProcessResult launch = ProcessLauncher::run(spec);
+        if (!launch.started) {
+            std::cerr << "Error: Module " << label << " could not be started: " << launch.error << std::endl;
+            return false;
+        }
+        int result = launch.exitCode;
+#endif
         
         if (result == 0) {
-            std::cout << "\nModule " << task.moduleName << " session ended." << std::endl;
+            std::cout << "\nModule " << label << " session ended." << std::endl;
             return true;
         } else {
-            std::cerr << "Error: Module " << task.moduleName 
+            std::cerr << "Error: Module " << label 
                      << " execution failed with error code " << result << std::endl;
             return false;
         }
     }
     
+    // Execute %cube block (built-in cube arithmetic, run before the %command block)
+    bool executeCubeBlock(const ModuleTask& task, int cores, const ExecutionOptions& options) {
+        if (task.cubeOps.empty()) {
+            return true;
+        }
+        
+        TraceSpan span("block", "%cube");
+        span.arg("module", task.moduleName);
+        std::cout << "\nExecuting cube operations for module: " << task.moduleName << std::endl;
+        for (const auto& op : task.cubeOps) {
+            if (options.dryrun) {
+                std::cout << "Dry-run mode: Would run cube operation: " << op << std::endl;
+                continue;
+            }
+            std::cout << "Cube: " << op << std::endl;
+            std::string error;
+            if (!runCubeStatement(op, cores, error, task.workDir)) {
+                std::cerr << "Error: Cube operation failed: " << error << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    
     // Execute command block (shell commands)
-    bool executeCommandBlock(const ModuleTask& task, const ExecutionOptions& options) {
+    bool executeCommandBlock(const ModuleTask& task, const std::string& wfnFile, const ExecutionOptions& options) {
         if (task.commands.empty()) {
             return true; // No commands to execute
         }
         
+        TraceSpan span("block", "%command");
+        span.arg("module", task.moduleName);
+        span.arg("file", wfnFile);
         std::cout << "\nExecuting command block for module: " << task.moduleName << std::endl;
         
         // In dryrun mode, only show what would be executed
@@ -327,13 +1127,13 @@ public:
             return true;
         }
         
-        // Create temporary script file
-        std::string scriptFileName = task.moduleName + "_commands";
+#ifdef PLATFORM_WINDOWS
+        // Create temporary script file (named per wavefunction so that concurrent files don't collide)
+        std::string scriptFileName = task.moduleName + "_commands_" + getBaseName(wfnFile);
         if (task.blockIndex > 0) {
             scriptFileName += "_" + std::to_string(task.blockIndex);
         }
         
-#ifdef PLATFORM_WINDOWS
         int result = 0;
         
         // Check if gitbash_exec is configured and first line is shebang #!/bin/bash
@@ -415,7 +1215,7 @@ public:
                 TRUE,                          // bInheritHandles
                 0,                            // dwCreationFlags
                 nullptr,                       // lpEnvironment
-                nullptr,                       // lpCurrentDirectory
+                task.workDir.empty() ? nullptr : task.workDir.c_str(),  // lpCurrentDirectory
                 &si,                          // lpStartupInfo
                 &pi                           // lpProcessInformation
             );
@@ -450,9 +1250,13 @@ public:
             }
             scriptFile.close();
             
-            // Execute batch file
+            // Execute batch file (from the block's working directory, if any)
             std::stringstream cmd;
-            cmd << "cmd /c \"" << scriptFileName << "\"";
+            if (task.workDir.empty()) {
+                cmd << "cmd /c \"" << scriptFileName << "\"";
+            } else {
+                cmd << "cd /d \"" << task.workDir << "\" && cmd /c \"" << Utils::absolutePath(scriptFileName) << "\"";
+            }
             std::cout << "Running script: " << cmd.str() << " ..." << std::endl;
             
             result = system(cmd.str().c_str());
@@ -461,86 +1265,581 @@ public:
             remove(scriptFileName.c_str());
         }
         
-#else
-        scriptFileName += ".sh";
-        std::ofstream scriptFile(scriptFileName);
-        if (!scriptFile.is_open()) {
-            std::cerr << "Error: Cannot create shell script: " << scriptFileName << std::endl;
+#else
+        (void)wfnFile;  // Only needed for script file names on Windows
+        
+        // Pass the script to bash directly, no script file needed
+        std::string script = "#!/bin/bash\n";
+        for (const auto& cmd : task.commands) {
+            script += cmd + "\n";
+        }
+        
+        ProcessSpec spec;
+        if (script.size() < 100000) {
+            spec.args = {"/bin/bash", "-c", script};
+            spec.inheritStdin = true;
+        } else {
+            // Beyond the kernel's single-argument limit: let bash read the script from stdin
+            spec.args = {"/bin/bash", "-s"};
+            spec.input = script;
+        }
+        spec.workDir = task.workDir;
+        spec.ownProcessGroup = options.ownProcessGroup;
+        std::cout << "Running script: " << ProcessLauncher::describe(spec) << " ..." << std::endl;
+        
+        ProcessResult launch = ProcessLauncher::run(spec);
+        if (!launch.started) {
+            std::cerr << "Error: Command block could not be started: " << launch.error << std::endl;
+            return false;
+        }
+        int result = launch.exitCode;
+#endif
+        
+        if (result == 0) {
+            std::cout << "Command block execution completed." << std::endl;
+            return true;
+        } else {
+            std::cerr << "Error: Command block execution failed with error code " << result << std::endl;
+            return false;
+        }
+    }
+    
+    // Execute single module task (dispatch to appropriate method)
+    bool executeModuleTask(const ModuleTask& task, const std::string& wfnFile, 
+                          int cores, const ExecutionOptions& options) {
+        bool success = false;
+        
+        // Support command-only task (no module, only %cube/%command blocks)
+        if (task.moduleName.empty()) {
+            return executeCubeBlock(task, cores, options) && executeCommandBlock(task, wfnFile, options);
+        }
+
+        if (task.useWait) {
+            // Concurrent files (-j) and blocks (-b) must not read the keyboard at the same time
+            std::lock_guard<std::mutex> lock(terminalMutex);
+            success = executeModuleTaskPipe(task, wfnFile, cores, options);
+        } else {
+            success = executeModuleTaskFile(task, wfnFile, cores, options);
+        }
+        
+        // Execute cube operations and command block if module execution was successful
+        if (success) {
+            success = executeCubeBlock(task, cores, options) && executeCommandBlock(task, wfnFile, options);
+        }
+        
+        return success;
+    }
+    
+    // Render every wavefunction x block of a batch and write it as a plan file (--emit-plan)
+    bool emitResolvedPlan(const ExecutionPlan& plan, const std::vector<std::string>& wfnFiles, int cores,
+                          const std::map<std::string, std::string>& vars, const ExecutionOptions& options) {
+        if (options.blocks > 1 || options.fuse) {
+            std::cerr << "Warning: --blocks and --fuse are ignored with --emit-plan" << std::endl;
+        }
+        ResolvedPlan resolved;
+        resolved.multiwfnExec = configManager.getConfig().multiwfnExec;
+        resolved.gitbashExec = configManager.getConfig().gitbashExec;
+        resolved.jobs = std::max(1, std::min(options.jobs, static_cast<int>(wfnFiles.size())));
+        int jobCores = BatchScheduler::splitCores(cores, resolved.jobs);
+        
+        size_t blockCount = 0;
+        for (const auto& wfnFile : wfnFiles) {
+            PlanInstance fileTasks = plan.instantiate(wfnFile, vars);
+            ResolvedFile file;
+            file.wfnFile = wfnFile;
+            for (const ModuleTask* task : fileTasks.getTasks()) {
+                ResolvedBlock block;
+                block.module = task->moduleName;
+                block.index = task->blockIndex;
+                block.cores = jobCores;
+                block.interactive = task->useWait;
+                if (!task->moduleName.empty()) {
+                    block.script = generateModuleScript(*task, !task->useWait);
+                    if (block.script.empty()) {
+                        return false;
+                    }
+                    block.outputs = generateOutputs(*task);
+                }
+                block.commands = task->commands;
+                block.cubeOps = task->cubeOps;
+                file.blocks.push_back(std::move(block));
+            }
+            blockCount += file.blocks.size();
+            resolved.files.push_back(std::move(file));
+        }
+        
+        std::string error;
+        if (!resolved.write(options.emitPlan, error)) {
+            std::cerr << "Error: Cannot write plan: " << error << std::endl;
+            return false;
+        }
+        std::cout << "\nPlan written to " << options.emitPlan << ": " << wfnFiles.size() << " file(s), "
+                  << blockCount << " block(s)" << std::endl;
+        return true;
+    }
+    
+    // Execute a plan written by --emit-plan. Nothing is parsed or searched for: the plan
+    // carries the Multiwfn executable, the rendered scripts and the core counts.
+    bool runResolvedPlan(const ResolvedPlan& resolved, const ExecutionOptions& options) {
+        configManager.setExecutables(resolved.multiwfnExec, resolved.gitbashExec);
+        if (resolved.files.empty()) {
+            std::cerr << "Error: The plan contains no wavefunction files" << std::endl;
+            return false;
+        }
+        if (options.dryrun) {
+            std::cout << "\n** DRY-RUN MODE: Only generating command files **\n" << std::endl;
+        }
+        
+        ExecutionOptions runOptions = options;
+        runOptions.jobs = std::min(options.jobs > 1 ? options.jobs : resolved.jobs,
+                                   static_cast<int>(resolved.files.size()));
+        runOptions.blocks = 1;
+        
+        // The plan may come from another machine: its core counts are capped to our share of
+        // the usable CPUs, and concurrent jobs are pinned like in a normal run
+        CpuSet cpuSet = CpuSet::detect();
+        int jobCores = BatchScheduler::splitCores(cpuSet.usableCount(), runOptions.jobs);
+        std::vector<std::vector<int>> jobCpus;
+        if (runOptions.jobs > 1) {
+            jobCpus = cpuSet.partition(runOptions.jobs, jobCores);
+        }
+        
+        BatchScheduler scheduler(runOptions.jobs);
+        std::vector<bool> fileResults = scheduler.run(resolved.files.size(), [&](size_t fileIdx, int workerId) {
+            const ResolvedFile& file = resolved.files[fileIdx];
+            if (!jobCpus.empty()) {
+                CpuSet::pinThread(jobCpus[workerId]);
+            }
+            if (resolved.files.size() > 1) {
+                std::cout << "\n========================================" << std::endl;
+                std::cout << "Processing file " << (fileIdx + 1) << "/" << resolved.files.size()
+                          << ": " << file.wfnFile << std::endl;
+                std::cout << "========================================\n" << std::endl;
+            }
+            bool allSuccess = true;
+            for (const auto& block : file.blocks) {
+                if (!runResolvedBlock(block, file.wfnFile, std::min(block.cores, jobCores), runOptions)) {
+                    allSuccess = false;
+                }
+            }
+            return allSuccess;
+        });
+        
+        size_t failed = 0;
+        for (size_t i = 0; i < fileResults.size(); i++) {
+            if (!fileResults[i]) {
+                std::cerr << "Failed: " << resolved.files[i].wfnFile << std::endl;
+                failed++;
+            }
+        }
+        if (failed > 0) {
+            std::cerr << "\n" << failed << " of " << resolved.files.size() << " files failed." << std::endl;
+            return false;
+        }
+        std::cout << "\nAll done." << std::endl;
+        return true;
+    }
+    
+    // Run one block of a resolved plan: its Multiwfn script, then %cube, then %command
+    bool runResolvedBlock(const ResolvedBlock& block, const std::string& wfnFile, int cores,
+                          const ExecutionOptions& options) {
+        ModuleTask task;
+        task.moduleName = block.module;
+        task.blockIndex = block.index;
+        task.useWait = block.interactive;
+        task.commands = block.commands;
+        task.cubeOps = block.cubeOps;
+        
+        if (!block.module.empty()) {
+            bool ok;
+            if (block.interactive) {
+                std::cout << "\nProcessing module: " << block.module << " (interactive mode)" << std::endl;
+                if (options.dryrun) {
+                    std::cout << "Dry-run mode: Skipping interactive task." << std::endl;
+                    ok = true;
+                } else {
+                    ok = runInteractiveScript(block.module, block.script, wfnFile, cores);
+                }
+            } else {
+                std::cout << "\n>>> Processing module: " << block.module << std::endl;
+                ok = runMultiwfnScript(block.module, taskFileStem(task, wfnFile), block.script, wfnFile,
+                                       cores, options);
+            }
+            if (!ok) {
+                return false;
+            }
+            if (!options.dryrun && !block.interactive) {
+                for (const auto& output : block.outputs) {
+                    if (!Utils::fileExists(output)) {
+                        std::cerr << "Warning: Expected output " << output << " was not produced" << std::endl;
+                    }
+                }
+            }
+        }
+        return executeCubeBlock(task, cores, options) && executeCommandBlock(task, wfnFile, options);
+    }
+    
+    // Put every wavefunction x block of a batch into a shared queue directory (--enqueue)
+    bool enqueueJobs(const ExecutionPlan& plan, const std::vector<std::string>& wfnFiles, int cores,
+                     const std::map<std::string, std::string>& vars, const ExecutionOptions& options) {
+        if (options.blocks > 1 || options.fuse) {
+            std::cerr << "Warning: --blocks and --fuse are ignored with --enqueue" << std::endl;
+        }
+        WorkQueue queue;
+        std::string error;
+        if (!queue.create(options.enqueue, plan.getInpFile(), Utils::absolutePath("."), vars,
+                          options.leaseSeconds, error)) {
+            std::cerr << "Error: Cannot create queue: " << error << std::endl;
+            return false;
+        }
+        
+        const std::vector<ModuleTask>& tasks = plan.getBlocks();
+        size_t jobCount = 0;
+        for (size_t f = 0; f < wfnFiles.size(); f++) {
+            QueueJob job;
+            job.wfnFile = wfnFiles[f];
+            job.file = f;
+            job.cores = cores;
+            for (size_t t = 0; t < tasks.size(); t++) {
+                if (tasks[t].useWait) {
+                    if (f == 0) {
+                        std::cerr << "Warning: Interactive block [" << tasks[t].moduleName << "] is not queued" << std::endl;
+                    }
+                    continue;
+                }
+                job.task = t;
+                if (!queue.addJob(job, error)) {
+                    std::cerr << "Error: Cannot queue job: " << error << std::endl;
+                    return false;
+                }
+                job.block++;
+                jobCount++;
+            }
+        }
+        std::cout << "\nQueued " << jobCount << " job(s) for " << wfnFiles.size() << " file(s) in "
+                  << options.enqueue << std::endl;
+        std::cout << "Start workers with: banewfn --worker " << options.enqueue << std::endl;
+        return true;
+    }
+    
+    // Claim and run jobs of a shared queue until it is empty (--worker). Each job runs through
+    // executeModuleTask, exactly as in a normal run; a heartbeat thread keeps the lease alive.
+    bool runQueueWorker(WorkQueue& queue, int cores, const ExecutionOptions& options) {
+        ExecutionPlan plan;
+        if (!plan.load(queue.getInpFile())) {
+            return false;
+        }
+        std::set<std::string> modules;
+        for (const auto& task : plan.getBlocks()) {
+            if (!task.moduleName.empty()) {
+                modules.insert(task.moduleName);
+            }
+        }
+        for (const auto& mod : modules) {
+            if (!loadModuleConfig(mod)) {
+                std::cerr << "Error: Failed to load module config for " << mod << std::endl;
+                return false;
+            }
+        }
+        bool useWfnCache = wfnCache.isEnabled() && options.wfnCache && !options.dryrun;
+        if (useWfnCache && !loadConverter()) {
+            std::cerr << "Warning: Wavefunction cache disabled (mwfn.conf not available)" << std::endl;
+            useWfnCache = false;
+        }
+        
+        // One job at a time, but other workers share the directory
+        ExecutionOptions jobOptions = options;
+        jobOptions.jobs = 1;
+        jobOptions.blocks = 1;
+        jobOptions.sharedDirectory = true;
+        
+        std::cout << "\nWorker " << queue.getWorkerId() << " serving queue in " << queue.getWorkDir() << std::endl;
+        // Jobs were sized on the enqueuing machine: cap them to the CPUs usable here
+        CpuSet cpuSet = CpuSet::detect();
+        std::cout << "Usable CPUs: " << cpuSet.describe() << std::endl;
+        if (!queue.heartbeat()) {
+            std::cerr << "Error: Cannot write heartbeat in the queue directory" << std::endl;
+            return false;
+        }
+        
+        std::mutex beatMutex;
+        std::condition_variable beatSignal;
+        bool stop = false;
+        std::thread beat([&]() {
+            std::unique_lock<std::mutex> lock(beatMutex);
+            std::chrono::seconds interval(std::max(1, queue.getLeaseSeconds() / 4));
+            while (!beatSignal.wait_for(lock, interval, [&]() { return stop; })) {
+                queue.heartbeat();
+            }
+        });
+        
+        size_t ran = 0, failed = 0;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(beatMutex);
+                queue.heartbeat();
+                queue.requeueExpired();
+            }
+            QueueJob job;
+            WorkQueue::ClaimResult claim;
+            {
+                std::lock_guard<std::mutex> lock(beatMutex);
+                claim = queue.claim(job);
+            }
+            if (claim == WorkQueue::Empty) {
+                break;
+            }
+            if (claim == WorkQueue::Waiting) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+            
+            std::cout << "\n========================================" << std::endl;
+            std::cout << "Job " << job.name << ": " << job.wfnFile << std::endl;
+            std::cout << "========================================\n" << std::endl;
+            bool ok = job.task < plan.getBlocks().size();
+            if (ok) {
+                int jobCores = std::min(cores > 0 ? cores : job.cores, cpuSet.usableCount());
+                if (useWfnCache) {
+                    wfnCache.prepare(job.wfnFile, [&](const std::string& src, const std::string& dst) {
+                        return convertWavefunction(src, dst, jobCores);
+                    }, jobCores);
+                }
+                PlanInstance fileTasks = plan.instantiate(job.wfnFile, queue.getVars());
+                ok = executeModuleTask(*fileTasks.getTasks()[job.task], job.wfnFile, jobCores, jobOptions);
+            } else {
+                std::cerr << "Error: Job " << job.name << " refers to a block that is not in the input file" << std::endl;
+            }
+            
+            std::lock_guard<std::mutex> lock(beatMutex);
+            if (!queue.finish(job, ok)) {
+                std::cerr << "Warning: Lease of job " << job.name << " expired; it was requeued" << std::endl;
+                continue;
+            }
+            ran++;
+            if (!ok) {
+                failed++;
+            }
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(beatMutex);
+            stop = true;
+        }
+        beatSignal.notify_all();
+        beat.join();
+        queue.leave();
+        
+        std::cout << "\nQueue empty. This worker ran " << ran << " job(s), " << failed << " failed." << std::endl;
+        return failed == 0;
+    }
+    
+    // Analyse wavefunctions as they appear under a directory tree (--watch). A file is taken once
+    // it was closed after writing (or moved in) and its size and mtime then stay the same for the
+    // settle time; up to -j files run at a time, each through the same per-file flow as a batch.
+    // Analysed files are recorded in the done set, so a restarted watch only picks up new work.
+    bool runWatch(const ExecutionPlan& plan, const std::string& dir, const std::string& wfnPattern, int cores,
+                  const ExecutionOptions& options) {
+        if (plan.getBlocks().empty()) {
+            std::cerr << "Error: No modules found in inp file" << std::endl;
+            return false;
+        }
+        if (!options.table.empty() || !options.emitPlan.empty() || !options.enqueue.empty()) {
+            std::cerr << "Warning: --table, --emit-plan and --enqueue are ignored with --watch" << std::endl;
+        }
+        std::set<std::string> modules;
+        for (const auto& task : plan.getBlocks()) {
+            if (!task.moduleName.empty()) {
+                modules.insert(task.moduleName);
+            }
+        }
+        for (const auto& mod : modules) {
+            if (!loadModuleConfig(mod)) {
+                std::cerr << "Error: Failed to load module config for " << mod << std::endl;
+                return false;
+            }
+        }
+        bool useWfnCache = wfnCache.isEnabled() && options.wfnCache && !options.dryrun;
+        if (useWfnCache && !loadConverter()) {
+            std::cerr << "Warning: Wavefunction cache disabled (mwfn.conf not available)" << std::endl;
+            useWfnCache = false;
+        }
+        
+        // The wfn pattern selects file names anywhere in the tree
+        size_t slash = wfnPattern.find_last_of("/\\");
+        std::string namePattern = slash == std::string::npos ? wfnPattern : wfnPattern.substr(slash + 1);
+        std::string root = Utils::absolutePath(dir);
+        DirectoryWatcher watcher;
+        std::string error;
+        if (!watcher.open(root, namePattern, error)) {
+            std::cerr << "Error: Cannot watch directory: " << error << std::endl;
             return false;
         }
-        
-        // Write shell script header
-        scriptFile << "#!/bin/bash" << std::endl;
-        // scriptFile << "set -e" << std::endl; // Exit on error is not necessary
-        
-        // Write shell commands
-        for (const auto& cmd : task.commands) {
-            scriptFile << cmd << std::endl;
+        DoneSet done;
+        done.load(Utils::absolutePath(".banewfn_watch"));
+        
+        int jobs = std::max(1, options.jobs);
+        CpuSet cpuSet = CpuSet::detect();
+        int jobCores = BatchScheduler::splitCores(fitCoreBudget(cores, jobs > 1, cpuSet), jobs);
+        ExecutionOptions jobOptions = options;
+        jobOptions.jobs = jobs;
+        jobOptions.ownProcessGroup = true;  // Ctrl+C stops watching; running files are finished
+        std::chrono::seconds settle(std::max(0, options.settleSeconds));
+        
+        std::cout << "\nWatching " << root << " for " << namePattern << " (up to " << jobs
+                  << " file(s) at a time, settle time " << settle.count() << " s)" << std::endl;
+        std::cout << "Done set: " << done.getFile() << " (" << done.size() << " file(s) already analysed)" << std::endl;
+        std::cout << "Press Ctrl+C to stop.\n" << std::endl;
+        
+        // Bounded pool: `jobs` threads take settled files from the queue
+        std::mutex poolMutex;
+        std::condition_variable poolSignal;
+        std::deque<std::pair<std::string, FileStamp>> queue;
+        std::set<std::string> inFlight;  // Queued or running
+        std::map<std::string, FileStamp> failedRuns;  // Not retried until the file changes
+        bool closing = false;
+        size_t ran = 0, failed = 0;
+        std::vector<std::thread> workers;
+        for (int w = 0; w < jobs; w++) {
+            workers.emplace_back([&]() {
+                while (true) {
+                    std::pair<std::string, FileStamp> item;
+                    {
+                        std::unique_lock<std::mutex> lock(poolMutex);
+                        poolSignal.wait(lock, [&]() { return closing || !queue.empty(); });
+                        if (closing) {
+                            return;
+                        }
+                        item = queue.front();
+                        queue.pop_front();
+                    }
+                    const std::string& wfnFile = item.first;
+                    std::cout << "\n========================================" << std::endl;
+                    std::cout << "New wavefunction: " << wfnFile << std::endl;
+                    std::cout << "========================================\n" << std::endl;
+                    if (useWfnCache) {
+                        wfnCache.prepare(wfnFile, [&](const std::string& src, const std::string& dst) {
+                            return convertWavefunction(src, dst, jobCores, true);
+                        }, jobCores);
+                    }
+                    PlanInstance fileTasks = plan.instantiate(wfnFile, options.customVars);
+                    bool ok = jobOptions.blocks > 1
+                        ? executeTaskGraph(fileTasks.getTasks(), wfnFile, jobCores, jobOptions)
+                        : executeTaskList(fileTasks.getTasks(), wfnFile, jobCores, jobOptions);
+                    if (ok && !options.dryrun && !done.add(wfnFile, item.second)) {
+                        std::cerr << "Warning: Cannot record " << wfnFile << " in " << done.getFile() << std::endl;
+                    }
+                    std::cout << (ok ? "\n[ OK ] " : "\n[FAIL] ") << wfnFile << std::endl;
+                    
+                    std::lock_guard<std::mutex> lock(poolMutex);
+                    inFlight.erase(wfnFile);
+                    ran++;
+                    if (!ok) {
+                        failed++;
+                        failedRuns[wfnFile] = item.second;
+                    }
+                }
+            });
         }
-        scriptFile.close();
-        
-        // Make script executable
-        chmod(scriptFileName.c_str(), 0755);
-        
-        // Execute shell script
-        std::stringstream cmd;
-        cmd << "./" << scriptFileName;
-        std::cout << "Running script: " << cmd.str() << " ..." << std::endl;
         
-        int result = system(cmd.str().c_str());
-        
-        // Clean up shell script
-        remove(scriptFileName.c_str());  // Comment out this line for debugging
-#endif
+        // Files seen but not settled yet: stamp at the last look and when that was
+        struct Candidate {
+            FileStamp stamp;
+            std::chrono::steady_clock::time_point seen;
+        };
+        std::map<std::string, Candidate> pending;
+        auto consider = [&](const std::string& path) {
+            FileStamp stamp;
+            if (!FileStamp::of(path, stamp) || done.contains(path, stamp)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(poolMutex);
+            auto it = failedRuns.find(path);
+            if (inFlight.count(path) || (it != failedRuns.end() && it->second == stamp)) {
+                return;
+            }
+            pending[path] = {stamp, std::chrono::steady_clock::now()};
+        };
         
-        if (result == 0) {
-            std::cout << "Command block execution completed." << std::endl;
-            return true;
-        } else {
-            std::cerr << "Error: Command block execution failed with error code " << result << std::endl;
-            return false;
+        // Files written while no watch was running are picked up first
+        for (const auto& path : watcher.scan()) {
+            consider(path);
         }
-    }
-    
-    // Execute single module task (dispatch to appropriate method)
-    bool executeModuleTask(const ModuleTask& task, const std::string& wfnFile, 
-                          int cores, const ExecutionOptions& options) {
-        bool success = false;
         
-        // Support command-only task (no module, only %command block)
-        if (task.moduleName.empty()) {
-            return executeCommandBlock(task, options);
+        watchStopRequested = 0;
+        std::signal(SIGINT, requestWatchStop);
+        std::signal(SIGTERM, requestWatchStop);
+        while (!watchStopRequested) {
+            for (const auto& path : watcher.wait(500)) {
+                consider(path);
+            }
+            auto now = std::chrono::steady_clock::now();
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (now - it->second.seen < settle) {
+                    ++it;
+                    continue;
+                }
+                FileStamp stamp;
+                if (!FileStamp::of(it->first, stamp)) {
+                    it = pending.erase(it);  // Deleted or renamed meanwhile
+                    continue;
+                }
+                if (stamp != it->second.stamp || stamp.size == 0) {
+                    it->second = {stamp, now};  // Still being written
+                    ++it;
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(poolMutex);
+                    inFlight.insert(it->first);
+                    queue.push_back({it->first, stamp});
+                }
+                poolSignal.notify_one();
+                it = pending.erase(it);
+            }
         }
-
-        if (task.useWait) {
-            success = executeModuleTaskPipe(task, wfnFile, cores, options);
-        } else {
-            success = executeModuleTaskFile(task, wfnFile, cores, options);
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        
+        size_t dropped;
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            dropped = queue.size();
+            std::cout << "\nStopping watch: waiting for " << inFlight.size() - dropped << " running file(s)" << std::endl;
+            closing = true;
         }
-        
-        // Execute command block if module execution was successful
-        if (success) {
-            success = executeCommandBlock(task, options);
+        poolSignal.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
         }
-        
-        return success;
+        std::cout << "Watch stopped. Analysed " << ran << " file(s), " << failed << " failed";
+        if (dropped + pending.size() > 0) {
+            std::cout << "; " << dropped + pending.size() << " waiting file(s) are picked up at the next start";
+        }
+        std::cout << "." << std::endl;
+        return failed == 0;
     }
     
     // Execute all module tasks
-    bool executeAllTasks(const std::string& inpFile, const std::string& wfnFile, 
+    bool executeAllTasks(const ExecutionPlan& plan, const std::string& wfnFile,
                         int cores, const ExecutionOptions& options) {
-        // Parse inp file, get all tasks, optional wfn file, core count, and custom variables
-        auto parseResult = InputParser::parseInpFileWithWfnAndCoresAndVars(inpFile);
-        std::vector<ModuleTask> tasks = std::get<0>(parseResult);
-        std::string inputWfnFile = std::get<1>(parseResult);
-        int inputCores = std::get<2>(parseResult);
-        std::map<std::string, std::string> fileVars = std::get<3>(parseResult);
+        TraceSpan span("main", "executeAllTasks");
+        // The inp file was parsed once into the plan: blocks, optional wfn file, core count, and custom variables
+        const std::vector<ModuleTask>& tasks = plan.getBlocks();
+        const std::string& inputWfnFile = plan.getWfnFile();
+        int inputCores = plan.getCores();
+        const std::map<std::string, std::string>& fileVars = plan.getVars();
         
         // Use wfn file from input file if specified, otherwise use command line argument
         std::string wfnPattern = inputWfnFile.empty() ? wfnFile : inputWfnFile;
         
         // 展开通配符
-        std::vector<std::string> wfnFiles = Utils::expandWildcard(wfnPattern);
+        std::vector<std::string> wfnFiles;
+        {
+            TraceSpan expandSpan("phase", "expand wavefunction pattern");
+            wfnFiles = Utils::expandWildcard(wfnPattern);
+            expandSpan.arg("files", static_cast<double>(wfnFiles.size()));
+        }
         
         if (wfnFiles.empty()) {
             std::cerr << "Error: No matching wavefunction files found for pattern: " << wfnPattern << std::endl;
@@ -595,19 +1894,114 @@ public:
         }
         if (options.screen) {
             std::cout << "\n** SCREEN MODE: Output to screen instead of files **\n" << std::endl;
+        } else if (options.tee) {
+            std::cout << "\n** TEE MODE: Output to files and screen **\n" << std::endl;
+        }
+        if (options.blocks > 1) {
+            std::cout << "\n** BLOCK MODE: Up to " << options.blocks
+                      << " independent blocks run concurrently, each in its own directory **\n" << std::endl;
+            if (options.fuse) {
+                std::cerr << "Warning: --fuse is ignored with --blocks" << std::endl;
+            }
+        } else if (options.fuse) {
+            std::cout << "\n** FUSED MODE: Consecutive module blocks share one Multiwfn session **\n" << std::endl;
         }
         
-        for (const auto& mod : modules) {
-            if (!loadModuleConfig(mod)) {
-                std::cerr << "Error: Failed to load module config for " << mod << std::endl;
+        {
+            TraceSpan configSpan("phase", "load module configs");
+            for (const auto& mod : modules) {
+                if (!loadModuleConfig(mod)) {
+                    std::cerr << "Error: Failed to load module config for " << mod << std::endl;
+                    return false;
+                }
+            }
+        }
+        
+        if (!options.emitPlan.empty()) {
+            return emitResolvedPlan(plan, wfnFiles, finalCores, allCustomVars, options);
+        }
+        if (!options.enqueue.empty()) {
+            return enqueueJobs(plan, wfnFiles, finalCores, allCustomVars, options);
+        }
+        
+        // Compile the extraction rules once for the whole batch
+        if (!options.table.empty() && !options.dryrun) {
+            for (const auto& mod : modules) {
+                std::string error;
+                if (!compileExtractRules(configManager.getModuleConfig(mod).extractRules, extractRules[mod], error)) {
+                    std::cerr << "Error: [extract] section of module " << mod << ": " << error << std::endl;
+                    return false;
+                }
+            }
+            if (!resultTable.open(options.table)) {
                 return false;
             }
+            std::cout << "\nExtracted results will be collected in: " << options.table << std::endl;
+        }
+        
+        // Wavefunction pre-conversion cache needs the "mwfn" conversion module
+        bool useWfnCache = wfnCache.isEnabled() && options.wfnCache && !options.dryrun;
+        if (resultCache.isEnabled() && options.resultCache && !options.dryrun) {
+            std::cout << "\nResult cache: " << resultCache.getDirectory() << std::endl;
+            if (options.jobs > 1 && options.blocks <= 1) {
+                std::cout << "Note: with --jobs, cached results are reused but new results are not recorded" << std::endl;
+            }
+        }
+        if (scratch.isEnabled() && options.scratch && !options.dryrun) {
+            std::cout << "\nScratch directory: " << scratch.getDirectory() << std::endl;
+        }
+        if (useWfnCache) {
+            std::cout << "\nWavefunction cache: " << wfnCache.getDirectory() << std::endl;
+            if (!loadConverter()) {
+                std::cerr << "Warning: Wavefunction cache disabled (mwfn.conf not available)" << std::endl;
+                useWfnCache = false;
+            }
+        }
+        
+        // Split the core budget among concurrent workers, within the CPUs we may actually use
+        // (Slurm allocations, containers and taskset restrict them)
+        int jobs = options.jobs;
+        if (jobs > static_cast<int>(wfnFiles.size())) {
+            jobs = static_cast<int>(wfnFiles.size());
+        }
+        CpuSet cpuSet = CpuSet::detect();
+        finalCores = fitCoreBudget(finalCores, jobs > 1 || options.blocks > 1, cpuSet);
+        int jobCores = BatchScheduler::splitCores(finalCores, jobs);
+        // Each concurrent job gets its own CPUs, on one NUMA node where possible
+        std::vector<std::vector<int>> jobCpus;
+        if (jobs > 1) {
+            jobCpus = cpuSet.partition(jobs, jobCores);
+            std::cout << "\nRunning " << jobs << " files concurrently";
+            if (jobCores > 0) {
+                std::cout << " with " << jobCores << " cores each";
+            }
+            if (!jobCpus.empty()) {
+                std::cout << ", pinned to separate CPUs";
+            }
+            std::cout << "\n" << std::endl;
+        }
+        
+        // Per-job options carry the effective concurrency (used for output multiplexing and caching)
+        ExecutionOptions jobOptions = options;
+        jobOptions.jobs = jobs;
+        
+        // Concurrent jobs start with the longest predicted files, so that a long job doesn't
+        // start last and hold up the end of the batch
+        std::vector<size_t> order;
+        if (jobs > 1) {
+            TraceSpan orderSpan("phase", "order batch");
+            order = costOrder(wfnFiles, plan.getBlocks(), jobs);
         }
         
         // 对每个匹配的文件执行任务
-        bool allSuccess = true;
-        for (size_t fileIdx = 0; fileIdx < wfnFiles.size(); fileIdx++) {
-            std::string finalWfnFile = wfnFiles[fileIdx];
+        BatchScheduler scheduler(jobs);
+        std::vector<bool> fileResults = scheduler.run(wfnFiles.size(), [&](size_t fileIdx, int workerId) {
+            const std::string& finalWfnFile = wfnFiles[fileIdx];
+            TraceSpan fileSpan("file", getBaseName(finalWfnFile));
+            fileSpan.arg("file", finalWfnFile);
+            if (!jobCpus.empty()) {
+                CpuSet::pinThread(jobCpus[workerId]);
+            }
             
             if (wfnFiles.size() > 1) {
                 std::cout << "\n========================================" << std::endl;
@@ -616,16 +2010,47 @@ public:
                 std::cout << "========================================\n" << std::endl;
             }
             
-            // 为当前文件创建任务副本并应用占位符替换
-            std::vector<ModuleTask> fileTasks = tasks;
-            InputParser::applyPlaceholderReplacement(fileTasks, finalWfnFile, allCustomVars);
+            // Convert once into the cache; Multiwfn then loads the cached copy transparently
+            if (useWfnCache) {
+                TraceSpan cacheSpan("phase", "wavefunction cache");
+                wfnCache.prepare(finalWfnFile, [&](const std::string& src, const std::string& dst) {
+                    return convertWavefunction(src, dst, jobCores);
+                }, jobCores);
+            }
+            
+            // 为当前文件应用占位符替换（只复制含占位符的块）
+            PlanInstance fileTasks = [&]() {
+                TraceSpan instantiateSpan("phase", "instantiate placeholders");
+                return plan.instantiate(finalWfnFile, allCustomVars);
+            }();
             
-            // Execute each module task in sequence
-            for (const auto& task : fileTasks) {
-                if (!executeModuleTask(task, finalWfnFile, finalCores, options)) {
-                    allSuccess = false;
+            // Execute each module task in sequence, or as a dependency graph with --blocks
+            if (jobOptions.blocks > 1) {
+                return executeTaskGraph(fileTasks.getTasks(), finalWfnFile, jobCores, jobOptions);
+            }
+            return executeTaskList(fileTasks.getTasks(), finalWfnFile, jobCores, jobOptions);
+        }, order);
+        
+        bool allSuccess = resultTable.finish();
+        for (bool ok : fileResults) {
+            if (!ok) {
+                allSuccess = false;
+            }
+        }
+        
+        // Report per-file results for batches
+        if (wfnFiles.size() > 1) {
+            size_t failed = 0;
+            std::cout << "\n========================================" << std::endl;
+            std::cout << "Batch summary:" << std::endl;
+            for (size_t i = 0; i < wfnFiles.size(); i++) {
+                std::cout << "  [" << (fileResults[i] ? " OK " : "FAIL") << "] " << wfnFiles[i] << std::endl;
+                if (!fileResults[i]) {
+                    failed++;
                 }
             }
+            std::cout << (wfnFiles.size() - failed) << " succeeded, " << failed << " failed" << std::endl;
+            std::cout << "========================================" << std::endl;
         }
         
         if (allSuccess) {
@@ -638,16 +2063,204 @@ public:
     }
     
     int getCores() const { return configManager.getCores(); }
+    const BaneWfnConfig& getConfig() const { return configManager.getConfig(); }
+    bool moduleHasReturn(const std::string& moduleName) const {
+        return configManager.getModuleConfig(moduleName).hasReturn;
+    }
+    const std::string& getHistoryFile() const { return history.getFile(); }
 };
 
+// banewfn serve: keep banewfn.rc, the module confs and each submitted input file loaded in
+// this process and run the submitted jobs in forked children under one core budget. With
+// sessions= in banewfn.rc, jobs on a single wavefunction reuse a warm Multiwfn that this
+// process keeps at the main menu; the job's child drives it through the inherited pipes.
+static int runServe(const char* progName, const std::string& socketPath, int cores) {
+    std::string configFile = findConfigFile(progName);
+    if (configFile.empty()) {
+        std::cerr << "Error: Could not find banewfn.rc in any of the search locations" << std::endl;
+        return 1;
+    }
+    auto generator = std::make_unique<MultiwfnScriptGenerator>();
+    if (!generator->loadBaneWfnConfig(configFile)) {
+        return 1;
+    }
+    FileStamp configStamp;
+    FileStamp::of(configFile, configStamp);
+    
+    int budget = cores > 0 ? cores : CpuSet::detect().usableCount();
+    JobServer server;
+    std::string error;
+    if (!server.listen(socketPath, budget, error)) {
+        std::cerr << "Error: Cannot start the server: " << error << std::endl;
+        return 1;
+    }
+    
+    std::map<int, ExecutionPlan> plans;  // Parsed input files of queued and running jobs
+    SessionPool sessions;
+    sessions.setLimits(generator->getConfig().sessions, generator->getConfig().sessionIdleSeconds);
+    std::map<int, std::pair<MultiwfnSession*, std::string>> jobSessions;  // Session and wavefunction of running jobs
+    
+    JobServer::Handlers handlers;
+    handlers.prepare = [&](ServeJob& job, std::string& error) {
+        // Pick up edits without a restart: a changed banewfn.rc starts over, changed confs are read again
+        FileStamp stamp;
+        if (FileStamp::of(configFile, stamp) && stamp != configStamp) {
+            configStamp = stamp;
+            auto reloaded = std::make_unique<MultiwfnScriptGenerator>();
+            if (reloaded->loadBaneWfnConfig(configFile)) {
+                generator = std::move(reloaded);
+                sessions.setLimits(generator->getConfig().sessions, generator->getConfig().sessionIdleSeconds);
+                std::cout << "[serve] reloaded " << configFile << std::endl;
+            } else {
+                std::cerr << "Warning: Keeping the previous settings: cannot load " << configFile << std::endl;
+            }
+        }
+        for (const auto& mod : generator->dropChangedModules()) {
+            std::cout << "[serve] conf of module " << mod << " changed, reloading" << std::endl;
+        }
+        
+        ExecutionPlan plan;
+        if (!plan.load(job.inpFile)) {
+            error = "cannot read input file " + job.inpFile;
+            return false;
+        }
+        if (plan.getBlocks().empty()) {
+            error = "no modules found in " + job.inpFile;
+            return false;
+        }
+        for (const auto& task : plan.getBlocks()) {
+            if (!task.moduleName.empty() && !generator->loadModuleConfig(task.moduleName)) {
+                error = "cannot load module config for " + task.moduleName;
+                return false;
+            }
+        }
+        if (job.wfn.empty() && plan.getWfnFile().empty()) {
+            error = "no wavefunction file: pass one or set wfn= in the input file";
+            return false;
+        }
+        if (job.cores <= 0) {
+            job.cores = plan.getCores() > 0 ? plan.getCores() : generator->getCores();
+        }
+        plans[job.id] = std::move(plan);
+        return true;
+    };
+    handlers.start = [&](const ServeJob& job) {
+        // One wavefunction (wfn= of the input file wins, as in a batch) and a block that can return to the main menu
+        const ExecutionPlan& plan = plans.at(job.id);
+        std::string wfn = plan.getWfnFile().empty() ? job.wfn : plan.getWfnFile();
+        if (!sessions.isEnabled() || job.dryrun || wfn.find_first_of("*?") != std::string::npos) {
+            return;
+        }
+        bool returns = false;
+        for (const auto& task : plan.getBlocks()) {
+            returns = returns || (!task.moduleName.empty() && !task.useWait && generator->moduleHasReturn(task.moduleName));
+        }
+        if (!returns) {
+            return;
+        }
+        if (!Utils::isAbsolutePath(wfn)) {
+            wfn = job.cwd + "/" + wfn;
+        }
+        std::string key = job.cwd + "\n" + wfn + "\n" + std::to_string(job.cores);
+        MultiwfnSession* session = sessions.acquire(key, [&](MultiwfnSession& fresh) {
+            std::string error;
+            if (!fresh.start(generator->multiwfnArgs(wfn, job.cores, true), generator->multiwfnEnv(job.cores), job.cwd, error)) {
+                std::cerr << "Warning: Cannot start a warm Multiwfn session: " << error << std::endl;
+                return false;
+            }
+            std::cout << "[serve] warm Multiwfn session " << fresh.getPid() << " started for " << wfn << std::endl;
+            return true;
+        });
+        if (session) {
+            jobSessions[job.id] = {session, wfn};
+        }
+    };
+    handlers.run = [&](const ServeJob& job) {
+        ExecutionOptions options;
+        options.jobs = job.jobs;
+        options.blocks = job.blocks;
+        options.fuse = job.fuse;
+        options.dryrun = job.dryrun;
+        options.screen = job.screen;
+        options.tee = job.tee;
+        options.table = job.table;
+        options.packCubes = job.pack;
+        options.packError = job.packError;
+        options.wfnCache = job.wfnCache;
+        options.resultCache = job.resultCache;
+        options.scratch = job.scratch;
+        options.customVars = job.vars;
+        auto it = jobSessions.find(job.id);
+        if (it != jobSessions.end()) {
+            generator->useSession(it->second.first, it->second.second);
+            options.fuse = false;  // The wavefunction stays loaded anyway
+        }
+        return generator->executeAllTasks(plans.at(job.id), job.wfn, job.cores, options) ? 0 : 1;
+    };
+    handlers.done = [&](const ServeJob& job, int exitCode) {
+        plans.erase(job.id);
+        auto it = jobSessions.find(job.id);
+        if (it != jobSessions.end()) {
+            // A failed job may have left Multiwfn anywhere in its menus
+            sessions.release(it->second.first, exitCode == 0);
+            jobSessions.erase(it);
+        }
+    };
+    handlers.idle = [&]() {
+        sessions.evictIdle();
+    };
+    // Jobs ask whether their session's Multiwfn waits for input: only we, its parent, may look
+    handlers.watch = [&]() {
+        return sessions.answerFds();
+    };
+    handlers.readable = [&](int fd) {
+        sessions.answer(fd);
+    };
+    return server.serve(handlers) ? 0 : 1;
+}
+
 void printUsage(const char* progName) {
     std::cout << "Hmm... You need some advice? No problem, Bane will help you! :)\n";
     std::cout << "Usage: " << progName << " <input.inp> <molecule.fchk> [options]\n";
     std::cout << "       " << progName << " -w <molecule.fchk> <input.inp> [options]\n";
+    std::cout << "       " << progName << " report [history file]   (p50/p95 run times from the timing history)\n";
+    std::cout << "       " << progName << " serve [-c <num>] [--socket <path>]   (job server for --submit, Linux)\n";
     std::cout << "\nOptions:\n";
     std::cout << "  -c, --cores <num>   Specify the number of CPU cores to use\n";
+    std::cout << "  -j, --jobs <num>    Process up to <num> wavefunction files concurrently (cores are split among them)\n";
+    std::cout << "  -b, --blocks <num>  Run up to <num> independent blocks of a file concurrently, each in its\n";
+    std::cout << "                      own directory (order blocks with after=<block|module|output>)\n";
     std::cout << "  -d, --dryrun        Generate command files only, don't execute (skip wait tasks)\n";
     std::cout << "  -s, --screen        Display output on screen instead of redirecting to files\n";
+    std::cout << "  -t, --tee           Write output files and display the output on screen at the same time\n";
+    std::cout << "  -T, --table <file>  Collect values from the modules' [extract] rules into one table\n";
+    std::cout << "                      (.json/.jsonl: JSON lines, otherwise CSV)\n";
+    std::cout << "  -P, --pack          Replace cube outputs declared in the confs by packed .bcub files\n";
+    std::cout << "  --pack-error <e>    Pack cubes quantized to absolute error e instead of lossless float32\n";
+    std::cout << "  -f, --fuse          Run consecutive module blocks in one Multiwfn session (load wavefunction once)\n";
+    std::cout << "      --no-wfncache   Don't use the .mwfn wavefunction cache configured in banewfn.rc\n";
+    std::cout << "      --no-cache      Don't reuse or record results in the result cache configured in banewfn.rc\n";
+    std::cout << "      --no-scratch    Run Multiwfn in place instead of in the scratch directory configured in banewfn.rc\n";
+    std::cout << "  --cube <statement>  Run a cube operation \"<out> = <op> <operands>\" and exit (repeatable;\n";
+    std::cout << "                      ops: add, sub, scale, abs, mask)\n";
+    std::cout << "  --bundle <dir> <file>\n";
+    std::cout << "                      Pack the .conf files of <dir> into one bundle file (usable as confpath) and exit\n";
+    std::cout << "  --emit-plan <file>  Write the fully resolved plan (scripts, commands, cores, outputs of every\n";
+    std::cout << "                      file x block) to <file> instead of running it\n";
+    std::cout << "  --run-plan <file>   Run a plan written by --emit-plan (no input file, banewfn.rc or confs needed)\n";
+    std::cout << "  --enqueue <dir>     Put every file x block job into the shared queue directory <dir> instead of running\n";
+    std::cout << "  --worker <dir>      Claim and run jobs from a queue directory until it is empty (run any number\n";
+    std::cout << "                      of workers on any nodes sharing the filesystem)\n";
+    std::cout << "  --lease <sec>       With --enqueue: requeue jobs of workers silent for <sec> seconds (default: 60)\n";
+    std::cout << "  --watch <dir>       Analyse new wavefunctions matching the wfn pattern as they appear anywhere\n";
+    std::cout << "                      under <dir> (up to -j at a time; runs until Ctrl+C)\n";
+    std::cout << "  --settle <sec>      With --watch: seconds a file's size must stay unchanged before it is taken (default: 2)\n";
+    std::cout << "  --submit            Run the input file on the banewfn server (banewfn serve) and stream its output\n";
+    std::cout << "  --priority <num>    With --submit: higher priorities start first (default: 0)\n";
+    std::cout << "  --socket <path>     Socket of the banewfn server (default: $XDG_RUNTIME_DIR/banewfn.sock,\n";
+    std::cout << "                      else /tmp/banewfn-<uid>.sock)\n";
+    std::cout << "  --trace <file>      Write a Chrome trace-event file of the run's phases and child processes\n";
+    std::cout << "                      (open in ui.perfetto.dev or chrome://tracing)\n";
     std::cout << "  -w, --wfn <file>    Specify wavefunction file (.fchk/.wfn or other supported file)\n";
     std::cout << "  -v, --var <key=val> Set custom variable for placeholder replacement (can be used multiple times)\n";
     std::cout << "  -h, --help          Show this help message\n";
@@ -659,9 +2272,10 @@ void printUsage(const char* progName) {
     std::cout << "  " << progName << " input.inp molecule.fchk --screen\n";
     std::cout << "  " << progName << " -w molecule.fchk input.inp -d -s -c 8\n";
     std::cout << "  " << progName << " input.inp molecule.fchk -v myvar=value -v other=123\n";
+    std::cout << "  " << progName << " input.inp -w \"*.fchk\" -c 64 -j 16\n";
 }
 
-int main(int argc, char* argv[]) {
+int runBaneWfn(int argc, char* argv[]) {
 #ifdef _WIN32
     // Ensure Windows console uses UTF-8 for input/output to avoid garbled ASCII art
     // and other UTF-8 text when double-click launching.
@@ -676,6 +2290,13 @@ int main(int argc, char* argv[]) {
     std::string wfnParam;  // Store wfn parameter from -w/--wfn
     int cores = -1;
     ExecutionOptions options;
+    std::vector<std::string> cubeStatements;  // Standalone cube operations from --cube
+    std::string runPlanFile;  // Plan to execute from --run-plan
+    std::string queueDir;  // Queue served by --worker
+    std::string watchDir;  // Directory tree watched by --watch
+    bool submit = false;  // Hand the job to banewfn serve
+    int priority = 0;
+    std::string socketPath;
     
     // Parse command line arguments
     std::vector<std::string> positionalArgs;
@@ -694,10 +2315,159 @@ int main(int argc, char* argv[]) {
                 std::cerr << "Error: -c/--cores requires an argument" << std::endl;
                 return 1;
             }
+        } else if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 < argc) {
+                options.jobs = std::atoi(argv[i + 1]);
+                if (options.jobs < 1) {
+                    options.jobs = 1;
+                }
+                i++;
+            } else {
+                std::cerr << "Error: -j/--jobs requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-b" || arg == "--blocks") {
+            if (i + 1 < argc) {
+                options.blocks = std::atoi(argv[++i]);
+                if (options.blocks < 1) {
+                    options.blocks = 1;
+                }
+            } else {
+                std::cerr << "Error: -b/--blocks requires an argument" << std::endl;
+                return 1;
+            }
         } else if (arg == "-d" || arg == "--dryrun") {
             options.dryrun = true;
         } else if (arg == "-s" || arg == "--screen") {
             options.screen = true;
+        } else if (arg == "-t" || arg == "--tee") {
+            options.tee = true;
+        } else if (arg == "-T" || arg == "--table") {
+            if (i + 1 < argc) {
+                options.table = argv[++i];
+            } else {
+                std::cerr << "Error: -T/--table requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-P" || arg == "--pack") {
+            options.packCubes = true;
+        } else if (arg == "--pack-error") {
+            if (i + 1 < argc) {
+                options.packCubes = true;
+                options.packError = std::atof(argv[++i]);
+            } else {
+                std::cerr << "Error: --pack-error requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "-f" || arg == "--fuse") {
+            options.fuse = true;
+        } else if (arg == "--no-wfncache") {
+            options.wfnCache = false;
+        } else if (arg == "--no-cache") {
+            options.resultCache = false;
+        } else if (arg == "--no-scratch") {
+            options.scratch = false;
+        } else if (arg == "--bundle") {
+            if (i + 2 < argc) {
+                std::string error;
+                if (!ConfStore::writeBundle(argv[i + 1], argv[i + 2], error)) {
+                    std::cerr << "Error: Cannot create conf bundle: " << error << std::endl;
+                    return 1;
+                }
+                std::cout << "Conf bundle written to: " << argv[i + 2] << std::endl;
+                return 0;
+            } else {
+                std::cerr << "Error: --bundle requires a conf directory and an output file" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--emit-plan") {
+            if (i + 1 < argc) {
+                options.emitPlan = argv[++i];
+            } else {
+                std::cerr << "Error: --emit-plan requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--run-plan") {
+            if (i + 1 < argc) {
+                runPlanFile = argv[++i];
+            } else {
+                std::cerr << "Error: --run-plan requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--enqueue") {
+            if (i + 1 < argc) {
+                options.enqueue = argv[++i];
+            } else {
+                std::cerr << "Error: --enqueue requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--worker") {
+            if (i + 1 < argc) {
+                queueDir = argv[++i];
+            } else {
+                std::cerr << "Error: --worker requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--lease") {
+            if (i + 1 < argc) {
+                options.leaseSeconds = std::atoi(argv[++i]);
+                if (options.leaseSeconds <= 0) {
+                    std::cerr << "Error: --lease requires a positive number of seconds" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: --lease requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--watch") {
+            if (i + 1 < argc) {
+                watchDir = argv[++i];
+            } else {
+                std::cerr << "Error: --watch requires a directory" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--settle") {
+            if (i + 1 < argc) {
+                options.settleSeconds = std::atoi(argv[++i]);
+                if (options.settleSeconds < 0) {
+                    std::cerr << "Error: --settle requires a non-negative number of seconds" << std::endl;
+                    return 1;
+                }
+            } else {
+                std::cerr << "Error: --settle requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--submit") {
+            submit = true;
+        } else if (arg == "--priority") {
+            if (i + 1 < argc) {
+                priority = std::atoi(argv[++i]);
+            } else {
+                std::cerr << "Error: --priority requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--socket") {
+            if (i + 1 < argc) {
+                socketPath = argv[++i];
+            } else {
+                std::cerr << "Error: --socket requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--trace") {
+            // Started by main() before anything else runs
+            if (i + 1 < argc) {
+                i++;
+            } else {
+                std::cerr << "Error: --trace requires an argument" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--cube") {
+            if (i + 1 < argc) {
+                cubeStatements.push_back(argv[++i]);
+            } else {
+                std::cerr << "Error: --cube requires an argument" << std::endl;
+                return 1;
+            }
         } else if (arg == "-w" || arg == "--wfn") {
             if (i + 1 < argc) {
                 wfnParam = argv[i + 1];
@@ -745,6 +2515,137 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // Standalone cube arithmetic: no input file or Multiwfn needed
+    if (!cubeStatements.empty()) {
+        for (const auto& statement : cubeStatements) {
+            std::cout << "Cube: " << statement << std::endl;
+            std::string error;
+            if (!runCubeStatement(statement, cores, error)) {
+                std::cerr << "Error: Cube operation failed: " << error << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    
+    // banewfn report [history file]: timing summary of past runs
+    if (!positionalArgs.empty() && positionalArgs[0] == "report" && !Utils::fileExists("report")) {
+        TimingHistory report;
+        if (positionalArgs.size() >= 2) {
+            report.setFile(positionalArgs[1]);
+        } else {
+            MultiwfnScriptGenerator generator;
+            std::string configFile = findConfigFile(argv[0]);
+            if (configFile.empty()) {
+                std::cerr << "Error: Could not find banewfn.rc in any of the search locations" << std::endl;
+                return 1;
+            }
+            if (!generator.loadBaneWfnConfig(configFile)) {
+                return 1;
+            }
+            report.setFile(generator.getHistoryFile());
+        }
+        if (!report.isEnabled()) {
+            std::cerr << "Error: No timing history: set history=<file> in banewfn.rc or pass the file" << std::endl;
+            return 1;
+        }
+        std::vector<HistoryRecord> records;
+        if (!report.load(records)) {
+            std::cerr << "Error: Cannot read timing history: " << report.getFile() << std::endl;
+            return 1;
+        }
+        std::cout << "\nTiming history: " << report.getFile() << " (" << records.size() << " runs)\n" << std::endl;
+        TimingHistory::printReport(records);
+        return 0;
+    }
+    
+    if (socketPath.empty()) {
+        socketPath = JobServer::defaultSocket();
+    }
+    
+    // banewfn serve: long-running job server
+    if (!positionalArgs.empty() && positionalArgs[0] == "serve" && !Utils::fileExists("serve")) {
+        return runServe(argv[0], socketPath, cores);
+    }
+    
+    // Thin client: the server parses the input file in this directory and runs the job
+    if (submit) {
+        if (positionalArgs.empty()) {
+            std::cerr << "Error: --submit requires an input file" << std::endl;
+            return 1;
+        }
+        std::vector<std::string> unsupported;
+        if (!options.emitPlan.empty()) unsupported.push_back("--emit-plan");
+        if (!options.enqueue.empty()) unsupported.push_back("--enqueue");
+        if (!runPlanFile.empty()) unsupported.push_back("--run-plan");
+        if (!queueDir.empty()) unsupported.push_back("--worker");
+        if (!watchDir.empty()) unsupported.push_back("--watch");
+        if (!unsupported.empty()) {
+            std::cerr << "Error: --submit cannot be combined with";
+            for (const auto& option : unsupported) {
+                std::cerr << " " << option;
+            }
+            std::cerr << std::endl;
+            return 1;
+        }
+        ServeJob job;
+        job.cwd = Utils::absolutePath(".");
+        job.inpFile = Utils::absolutePath(positionalArgs[0]);
+        job.wfn = !wfnParam.empty() ? wfnParam : (positionalArgs.size() >= 2 ? positionalArgs[1] : "");
+        job.cores = std::max(cores, 0);
+        job.jobs = options.jobs;
+        job.blocks = options.blocks;
+        job.priority = priority;
+        job.fuse = options.fuse;
+        job.dryrun = options.dryrun;
+        job.screen = options.screen;
+        job.tee = options.tee;
+        job.table = options.table;
+        job.pack = options.packCubes;
+        job.packError = options.packError;
+        job.wfnCache = options.wfnCache;
+        job.resultCache = options.resultCache;
+        job.scratch = options.scratch;
+        job.vars = options.customVars;
+        return JobServer::submit(socketPath, job);
+    }
+    
+    // Resolved plan: nothing to parse and no config search
+    if (!runPlanFile.empty()) {
+        ResolvedPlan resolved;
+        std::string error;
+        if (!resolved.read(runPlanFile, error)) {
+            std::cerr << "Error: Cannot read plan: " << error << std::endl;
+            return 1;
+        }
+        MultiwfnScriptGenerator generator;
+        return generator.runResolvedPlan(resolved, options) ? 0 : 1;
+    }
+    
+    // Queue worker: the queue holds the input file; run in the directory it was created from
+    if (!queueDir.empty()) {
+        WorkQueue queue;
+        std::string error;
+        if (!queue.open(Utils::absolutePath(queueDir), error)) {
+            std::cerr << "Error: Cannot open queue: " << error << std::endl;
+            return 1;
+        }
+        if (chdir(queue.getWorkDir().c_str()) != 0) {
+            std::cerr << "Error: Cannot enter the queue's working directory: " << queue.getWorkDir() << std::endl;
+            return 1;
+        }
+        MultiwfnScriptGenerator generator;
+        std::string configFile = findConfigFile(argv[0]);
+        if (configFile.empty()) {
+            std::cerr << "Error: Could not find banewfn.rc in any of the search locations" << std::endl;
+            return 1;
+        }
+        if (!generator.loadBaneWfnConfig(configFile)) {
+            return 1;
+        }
+        return generator.runQueueWorker(queue, cores, options) ? 0 : 1;
+    }
+    
     // Handle positional arguments
     if (positionalArgs.size() >= 1) {
         inpFile = positionalArgs[0];
@@ -752,11 +2653,18 @@ int main(int argc, char* argv[]) {
         inpFile = UI::requestInputFile();
     }
     
-    // Check if input file contains wfn definition, core setting, and custom variables
-    auto parseResult = InputParser::parseInpFileWithWfnAndCoresAndVars(inpFile);
-    std::string inputWfnFile = std::get<1>(parseResult);
-    int inputCores = std::get<2>(parseResult);
-    std::map<std::string, std::string> inputVars = std::get<3>(parseResult);
+    // Parse the input file once: blocks, wfn definition, core setting, and custom variables
+    ExecutionPlan plan;
+    {
+        TraceSpan parseSpan("phase", "parse input file");
+        parseSpan.arg("file", inpFile);
+        if (!plan.load(inpFile)) {
+            return 1;
+        }
+    }
+    std::string inputWfnFile = plan.getWfnFile();
+    int inputCores = plan.getCores();
+    const std::map<std::string, std::string>& inputVars = plan.getVars();
     
     // Merge input file variables with command line variables (command line takes precedence)
     for (const auto& var : inputVars) {
@@ -771,6 +2679,9 @@ int main(int argc, char* argv[]) {
         std::cout << "Using wavefunction file from -w/--wfn parameter: " << wfnFile << std::endl;
     } else if (positionalArgs.size() >= 2) {
         wfnFile = positionalArgs[1];
+    } else if (inputWfnFile.empty() && !watchDir.empty()) {
+        // Watching without a pattern: take every .fchk that appears
+        wfnFile = "*.fchk";
     } else if (inputWfnFile.empty()) {
         // Only request wfn file if not defined in input file
         wfnFile = UI::requestWavefunctionFile();
@@ -783,6 +2694,7 @@ int main(int argc, char* argv[]) {
     MultiwfnScriptGenerator generator;
     
     // Search for banewfn.rc
+    TraceSpan configSpan("phase", "load banewfn.rc");
     std::string configFile = findConfigFile(argv[0]);
     
     if (configFile.empty()) {
@@ -798,6 +2710,8 @@ int main(int argc, char* argv[]) {
     if (!generator.loadBaneWfnConfig(configFile)) {
         return 1;
     }
+    configSpan.arg("file", configFile);
+    configSpan.finish();
     
     // If cores not specified, use input file setting or default value from banewfn.rc
     if (cores < 0) {
@@ -809,10 +2723,47 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // Watch a directory tree instead of running a batch; wfn= of the input file wins, as in a batch
+    if (!watchDir.empty()) {
+        return generator.runWatch(plan, watchDir, inputWfnFile.empty() ? wfnFile : inputWfnFile, cores, options) ? 0 : 1;
+    }
+    
     // Execute all module tasks
-    if (!generator.executeAllTasks(inpFile, wfnFile, cores, options)) {
+    if (!generator.executeAllTasks(plan, wfnFile, cores, options)) {
         return 1;
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+#ifndef PLATFORM_WINDOWS
+    // A child that exits without reading all of its input, or a client that goes away, must not
+    // kill us; launched processes get the default disposition back
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    // --trace is picked up first so that the spans cover the whole run
+    std::string traceFile;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--trace") {
+            traceFile = argv[i + 1];
+        }
+    }
+    if (!traceFile.empty()) {
+        Trace::start(traceFile);
+    }
+    int status;
+    {
+        TraceSpan span("main", "banewfn");
+        status = runBaneWfn(argc, argv);
+        span.arg("exit_code", status);
+    }
+    if (!traceFile.empty()) {
+        if (Trace::finish()) {
+            std::cout << "Trace written to: " << traceFile << std::endl;
+        } else {
+            std::cerr << "Warning: Cannot write trace file: " << traceFile << std::endl;
+        }
+    }
+    return status;
+}
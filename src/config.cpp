@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <limits.h>
+#include <sys/stat.h>
 
 #ifdef PLATFORM_WINDOWS
 #include <windows.h>
@@ -184,6 +185,24 @@ bool ConfigManager::loadBaneWfnConfig(const std::string& configFile) {
                 config.confPath = expandPath(value);
             } else if (key == "cores") {
                 config.cores = std::stoi(value);
+            } else if (key == "wfncache") {
+                config.wfnCacheDir = expandPath(value);
+            } else if (key == "resultcache") {
+                config.resultCacheDir = expandPath(value);
+            } else if (key == "resultcache_max") {
+                config.resultCacheMaxMB = std::stoll(value);
+            } else if (key == "scratch") {
+                config.scratchDir = expandPath(value);
+            } else if (key == "scratch_output") {
+                config.scratchOutput = value;
+            } else if (key == "history") {
+                config.historyFile = expandPath(value);
+            } else if (key == "sessions") {
+                config.sessions = std::stoi(value);
+            } else if (key == "session_idle") {
+                config.sessionIdleSeconds = std::stoi(value);
+            } else if (key == "session_prompt") {
+                config.sessionPrompt = value;
             } else if (key == "gitbash_exec") {
 #ifdef PLATFORM_WINDOWS
                 config.gitbashExec = expandPath(value);
@@ -205,9 +224,28 @@ bool ConfigManager::loadBaneWfnConfig(const std::string& configFile) {
         config.confPath = expandPath("~/.bane/wfn");
     }
     
+    if (!confStore.setConfPath(config.confPath)) {
+        std::cerr << "Error: " << confStore.getError() << std::endl;
+        return false;
+    }
+    
     return true;
 }
 
+// Size and modification time of a conf source; (-1, 0) if it does not exist
+static std::pair<long long, long long> sourceStamp(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return {-1, 0};
+    }
+#ifdef PLATFORM_LINUX
+    long long mtime = static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    long long mtime = static_cast<long long>(st.st_mtime) * 1000000000LL;
+#endif
+    return {static_cast<long long>(st.st_size), mtime};
+}
+
 // Load module-specific conf file
 bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
     // If already loaded, return directly
@@ -215,10 +253,13 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
         return true;
     }
     
-    std::string confFile = config.confPath + "/" + moduleName + ".conf";
-    std::ifstream file(confFile);
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open module config file: " << confFile << std::endl;
+    // Stamped before reading, so that a change during the read is seen by the next check
+    std::pair<long long, long long> stamp = sourceStamp(confStore.sourceFile(moduleName));
+    std::string_view text;
+    std::string storage;
+    std::string confFile;
+    if (!confStore.find(moduleName, text, storage, confFile)) {
+        std::cerr << "Error: Cannot open module config file: " << config.confPath + "/" + moduleName + ".conf" << std::endl;
         return false;
     }
     
@@ -228,10 +269,24 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
     std::string line;
     std::string currentSection;
     bool inDefaultBlock = false;
+    bool inOutputBlock = false;
     bool inQuitSection = false;
+    bool inReturnSection = false;
+    bool inExtractSection = false;
     
-    while (std::getline(file, line)) {
-        line = trim(line);
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) {
+            lineEnd = text.size();
+        }
+        line = trim(std::string(text.substr(lineStart, lineEnd - lineStart)));
+        lineStart = lineEnd + 1;
+        
+        // An output block ends at a blank or comment line, so later commands are not taken as file names
+        if (inOutputBlock && (line.empty() || line[0] == '#')) {
+            inOutputBlock = false;
+        }
         
         // 去除行内注释
         line = Utils::removeInlineComment(line);
@@ -242,22 +297,39 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
         if (line[0] == '[' && line[line.length()-1] == ']') {
             currentSection = line.substr(1, line.length() - 2);
             
-            // Special handling for quit section
+            // Special handling for quit, return and extract sections
+            inQuitSection = false;
+            inReturnSection = false;
+            inExtractSection = false;
+            inDefaultBlock = false;
+            inOutputBlock = false;
             if (currentSection == "quit") {
                 inQuitSection = true;
-                inDefaultBlock = false;
+            } else if (currentSection == "return") {
+                modConfig.hasReturn = true;
+                inReturnSection = true;
+            } else if (currentSection == "extract") {
+                inExtractSection = true;
             } else {
                 modConfig.sections[currentSection] = Section();
-                inQuitSection = false;
-                inDefaultBlock = false;
             }
             continue;
         }
         
         // Default value block
         if (line == "-default-") {
-            if (!inQuitSection) {
+            if (!inQuitSection && !inReturnSection && !inExtractSection) {
                 inDefaultBlock = true;
+                inOutputBlock = false;
+            }
+            continue;
+        }
+        
+        // Output declaration block (files produced by the section)
+        if (line == "-output-") {
+            if (!inQuitSection && !inReturnSection && !inExtractSection) {
+                inOutputBlock = true;
+                inDefaultBlock = false;
             }
             continue;
         }
@@ -268,9 +340,37 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
             continue;
         }
         
+        // Handle return section commands
+        if (inReturnSection) {
+            modConfig.returnCommands.push_back(line);
+            continue;
+        }
+        
+        // Handle extract rules: column = regex (quotes keep surrounding spaces)
+        if (inExtractSection) {
+            size_t pos = line.find('=');
+            if (pos == std::string::npos) {
+                std::cerr << "Warning: Ignoring malformed [extract] rule in " << confFile << ": " << line << std::endl;
+                continue;
+            }
+            std::string column = trim(line.substr(0, pos));
+            std::string pattern = trim(line.substr(pos + 1));
+            if (pattern.length() >= 2 && pattern[0] == '"' && pattern[pattern.length()-1] == '"') {
+                pattern = pattern.substr(1, pattern.length() - 2);
+            }
+            modConfig.extractRules.emplace_back(column, pattern);
+            continue;
+        }
+        
         // Handle regular sections
         if (!currentSection.empty()) {
-            if (inDefaultBlock) {
+            if (inOutputBlock) {
+                for (const auto& name : Utils::split(line, ' ')) {
+                    if (!trim(name).empty()) {
+                        modConfig.sections[currentSection].outputs.push_back(trim(name));
+                    }
+                }
+            } else if (inDefaultBlock) {
                 size_t pos = line.find('=');
                 if (pos != std::string::npos) {
                     std::string key = trim(line.substr(0, pos));
@@ -286,7 +386,16 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
         }
     }
     
-    file.close();
+    // Compile the templates once the -default- blocks are known
+    for (auto& entry : modConfig.sections) {
+        Section& section = entry.second;
+        for (const auto& cmd : section.commands) {
+            section.commandTemplates.push_back(CommandTemplate::compile(cmd, section.defaults));
+        }
+        for (const auto& output : section.outputs) {
+            section.outputTemplates.push_back(CommandTemplate::compile(output, section.defaults));
+        }
+    }
     
     // If no quit section defined, use default value
     if (modConfig.quitCommands.empty()) {
@@ -294,10 +403,30 @@ bool ConfigManager::loadModuleConfig(const std::string& moduleName) {
         modConfig.quitCommands.push_back("q");
     }
     
-    moduleConfigs[moduleName] = modConfig;
+    moduleConfigs[moduleName] = std::move(modConfig);
+    moduleSources[moduleName] = stamp;
     return true;
 }
 
+// Forget module confs whose source changed since they were loaded
+std::vector<std::string> ConfigManager::dropChangedModules() {
+    std::vector<std::string> dropped;
+    for (auto it = moduleSources.begin(); it != moduleSources.end();) {
+        if (sourceStamp(confStore.sourceFile(it->first)) != it->second) {
+            dropped.push_back(it->first);
+            moduleConfigs.erase(it->first);
+            it = moduleSources.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // A rewritten bundle is a new file: map it again
+    if (!dropped.empty() && ConfStore::isBundleFile(config.confPath) && !confStore.setConfPath(config.confPath)) {
+        std::cerr << "Warning: " << confStore.getError() << std::endl;
+    }
+    return dropped;
+}
+
 // Get module configuration
 const ModuleConfig& ConfigManager::getModuleConfig(const std::string& moduleName) const {
     static ModuleConfig emptyConfig;
@@ -313,6 +442,66 @@ bool ConfigManager::hasModuleConfig(const std::string& moduleName) const {
     return moduleConfigs.find(moduleName) != moduleConfigs.end();
 }
 
+// Compile a command line: same placeholder syntax as replacePlaceholders()
+CommandTemplate CommandTemplate::compile(const std::string& text, const std::map<std::string, std::string>& defaults) {
+    CommandTemplate tmpl;
+    tmpl.literal.reserve(text.size());
+    
+    size_t pos = 0;
+    size_t dollar;
+    while ((dollar = text.find('$', pos)) != std::string::npos) {
+        tmpl.literal.append(text, pos, dollar - pos);
+        size_t endPos = dollar + 1;
+        Slot slot;
+        std::string inlineDefault;
+        
+        size_t braceEnd = std::string::npos;
+        if (endPos < text.length() && text[endPos] == '{') {
+            braceEnd = text.find('}', endPos + 1);
+        }
+        if (braceEnd != std::string::npos) {
+            std::string inside = text.substr(endPos + 1, braceEnd - endPos - 1);
+            size_t defaultSep = inside.find(":-");
+            if (defaultSep != std::string::npos) {
+                slot.name = inside.substr(0, defaultSep);
+                inlineDefault = inside.substr(defaultSep + 2);
+            } else {
+                slot.name = inside;
+            }
+            endPos = braceEnd + 1;
+        } else {
+            // $name (an unclosed "${" gives an empty name, like replacePlaceholders)
+            while (endPos < text.length() && (isalnum(text[endPos]) || text[endPos] == '_')) {
+                endPos++;
+            }
+            slot.name = text.substr(dollar + 1, endPos - dollar - 1);
+        }
+        
+        auto it = defaults.find(slot.name);
+        slot.fallback = (it != defaults.end() && !it->second.empty()) ? it->second : inlineDefault;
+        slot.at = tmpl.literal.size();
+        tmpl.slots.push_back(std::move(slot));
+        pos = endPos;
+    }
+    tmpl.literal.append(text, pos, std::string::npos);
+    return tmpl;
+}
+
+void CommandTemplate::render(const std::map<std::string, std::string>& params, std::string& out) const {
+    size_t prev = 0;
+    for (const Slot& slot : slots) {
+        out.append(literal, prev, slot.at - prev);
+        auto it = params.find(slot.name);
+        if (it != params.end() && !it->second.empty()) {
+            out += it->second;
+        } else {
+            out += slot.fallback;
+        }
+        prev = slot.at;
+    }
+    out.append(literal, prev, std::string::npos);
+}
+
 // Replace placeholders in command string
 std::string replacePlaceholders(const std::string& cmd, 
                                const std::map<std::string, std::string>& params) {
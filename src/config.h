@@ -1,5 +1,6 @@
 #ifndef CONFIG_H
 #define CONFIG_H
+#include "confstore.h"
 #include <string>
 #include <map>
 #include <vector>
@@ -11,16 +12,43 @@
     #define PLATFORM_LINUX
 #endif
 
+// A .conf line compiled once: literal text with placeholder slots ($name, ${name},
+// ${name:-default}). Each slot's fallback (-default- value, else the inline default) is
+// resolved at load time, so rendering is a single pass that appends to the caller's buffer.
+// Renders exactly what replacePlaceholders() would produce for the merged parameters.
+class CommandTemplate {
+public:
+    static CommandTemplate compile(const std::string& text, const std::map<std::string, std::string>& defaults);
+
+    // Append the line; parameters with empty values don't override the fallbacks
+    void render(const std::map<std::string, std::string>& params, std::string& out) const;
+
+private:
+    struct Slot {
+        size_t at;             // Insertion offset in `literal`
+        std::string name;
+        std::string fallback;  // Used when the parameter is missing or empty
+    };
+    std::string literal;  // Literal text with the placeholders cut out
+    std::vector<Slot> slots;
+};
+
 // Section structure
 struct Section {
     std::vector<std::string> commands;
     std::map<std::string, std::string> defaults;
+    std::vector<std::string> outputs;  // Files the section produces (-output- block)
+    std::vector<CommandTemplate> commandTemplates;  // Compiled commands (filled after loading)
+    std::vector<CommandTemplate> outputTemplates;  // Compiled outputs
 };
 
 // Module configuration structure
 struct ModuleConfig {
     std::map<std::string, Section> sections;
     std::vector<std::string> quitCommands;  // Quit command sequence
+    std::vector<std::string> returnCommands;  // Return-to-main-menu sequence (used by fused mode)
+    bool hasReturn = false;  // Whether a [return] section is declared
+    std::vector<std::pair<std::string, std::string>> extractRules;  // [extract] section: column = regex
 };
 
 // Global configuration structure
@@ -29,6 +57,15 @@ struct BaneWfnConfig {
     std::string confPath;
     int cores;
     std::string gitbashExec;  // Git Bash executable path (Windows only)
+    std::string wfnCacheDir;  // Directory of pre-converted .mwfn files (empty = disabled)
+    std::string resultCacheDir;  // Directory of cached Multiwfn results (empty = disabled)
+    long long resultCacheMaxMB = 10240;  // Size cap of the result cache in MB
+    std::string scratchDir;  // Parent of the per-run scratch directories (empty = run in place)
+    std::string scratchOutput;  // Final name template of promoted outputs (empty = keep names)
+    std::string historyFile;  // Timing history of Multiwfn runs (empty = disabled)
+    int sessions = 0;  // Warm Multiwfn sessions kept by banewfn serve (0 = disabled)
+    int sessionIdleSeconds = 600;  // Idle time after which a warm session is stopped
+    std::string sessionPrompt = "Main function menu";  // Text of the Multiwfn main menu
 };
 
 // Utility functions
@@ -45,7 +82,9 @@ std::string replacePlaceholders(const std::string& cmd,
 class ConfigManager {
 private:
     std::map<std::string, ModuleConfig> moduleConfigs;
+    std::map<std::string, std::pair<long long, long long>> moduleSources;  // Size and mtime (ns) of each module's source when loaded
     BaneWfnConfig config;
+    ConfStore confStore;  // Conf directory or bundle, plus the built-in library
     
 public:
     // Load banewfn.rc configuration file
@@ -54,6 +93,10 @@ public:
     // Load module-specific conf file
     bool loadModuleConfig(const std::string& moduleName);
     
+    // Forget loaded module confs whose source file changed since loading (banewfn serve);
+    // they are read again on next use. Returns the modules dropped.
+    std::vector<std::string> dropChangedModules();
+    
     // Get configuration values
     const BaneWfnConfig& getConfig() const { return config; }
     const ModuleConfig& getModuleConfig(const std::string& moduleName) const;
@@ -61,6 +104,12 @@ public:
     
     // Get cores setting
     int getCores() const { return config.cores; }
+    
+    // Use the executables recorded in a resolved plan (--run-plan reads no banewfn.rc)
+    void setExecutables(const std::string& multiwfnExec, const std::string& gitbashExec) {
+        config.multiwfnExec = multiwfnExec;
+        config.gitbashExec = gitbashExec;
+    }
 };
 
 #endif // CONFIG_H
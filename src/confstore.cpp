@@ -0,0 +1,245 @@
+#include "confstore.h"
+#include "config.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <vector>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// Bundle layout (little endian):
+//   "BANECONF" | u32 version | u32 count
+//   count x { u32 nameOffset | u32 nameLength | u64 textOffset | u64 textLength | i64 mtime }, sorted by name
+//   names and texts
+namespace {
+
+const char kMagic[8] = {'B', 'A', 'N', 'E', 'C', 'O', 'N', 'F'};
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 16;
+const size_t kEntrySize = 32;
+
+struct BundleEntry {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint64_t textOffset;
+    uint64_t textLength;
+    int64_t mtime;
+};
+
+template <typename T>
+T get(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+template <typename T>
+void put(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+BundleEntry readEntry(const char* data, size_t idx) {
+    const char* p = data + kHeaderSize + idx * kEntrySize;
+    return {get<uint32_t>(p), get<uint32_t>(p + 4), get<uint64_t>(p + 8), get<uint64_t>(p + 16),
+            get<int64_t>(p + 24)};
+}
+
+bool modificationTime(const std::string& path, long long& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFDIR)) {
+        return false;
+    }
+    mtime = static_cast<long long>(st.st_mtime);
+    return true;
+}
+
+} // namespace
+
+bool ConfStore::isBundleFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool ConfStore::setConfPath(const std::string& path) {
+    confPath = path;
+    useBundle = false;
+    bundle.close();
+    bundleCount = 0;
+    if (!isBundleFile(path)) {
+        return true;
+    }
+
+    if (!bundle.open(path) || bundle.size() < kHeaderSize) {
+        error = "cannot read conf bundle " + path;
+        return false;
+    }
+    const char* data = bundle.data();
+    uint32_t version = get<uint32_t>(data + 8);
+    uint32_t count = get<uint32_t>(data + 12);
+    if (version != kVersion) {
+        error = "unsupported conf bundle version " + std::to_string(version) + " in " + path;
+        return false;
+    }
+    if (kHeaderSize + static_cast<uint64_t>(count) * kEntrySize > bundle.size()) {
+        error = "truncated conf bundle " + path;
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        BundleEntry e = readEntry(data, i);
+        if (static_cast<uint64_t>(e.nameOffset) + e.nameLength > bundle.size() ||
+            e.textOffset > bundle.size() || e.textLength > bundle.size() - e.textOffset) {
+            error = "corrupt conf bundle " + path;
+            return false;
+        }
+    }
+    useBundle = true;
+    bundleCount = count;
+    return true;
+}
+
+bool ConfStore::findInBundle(const std::string& module, std::string_view& text) const {
+    const char* data = bundle.data();
+    size_t lo = 0, hi = bundleCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        BundleEntry e = readEntry(data, mid);
+        int cmp = std::string_view(data + e.nameOffset, e.nameLength).compare(module);
+        if (cmp == 0) {
+            text = std::string_view(data + e.textOffset, e.textLength);
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+const EmbeddedConf* ConfStore::findEmbedded(const std::string& module) {
+    const EmbeddedConf* end = kEmbeddedConfs + kEmbeddedConfCount;
+    const EmbeddedConf* it = std::lower_bound(kEmbeddedConfs, end, module,
+        [](const EmbeddedConf& conf, const std::string& name) { return name.compare(conf.name) > 0; });
+    return (it != end && module == it->name) ? it : nullptr;
+}
+
+bool ConfStore::find(const std::string& module, std::string_view& text, std::string& storage,
+                     std::string& origin) const {
+    const EmbeddedConf* embedded = findEmbedded(module);
+
+    if (useBundle) {
+        if (findInBundle(module, text)) {
+            origin = confPath + ":" + module + ".conf";
+            return true;
+        }
+    } else {
+        // A conf on disk wins unless the embedded copy is at least as new
+        std::string path = confPath + "/" + module + ".conf";
+        long long mtime = 0;
+        if (modificationTime(path, mtime) && (!embedded || mtime > embedded->mtime)) {
+            std::ifstream in(path, std::ios::binary);
+            if (in.is_open()) {
+                std::stringstream buffer;
+                buffer << in.rdbuf();
+                storage = buffer.str();
+                text = storage;
+                origin = path;
+                return true;
+            }
+        }
+    }
+
+    if (embedded) {
+        text = std::string_view(embedded->text, embedded->size);
+        origin = "<built-in>/" + module + ".conf";
+        return true;
+    }
+    return false;
+}
+
+bool ConfStore::writeBundle(const std::string& confDir, const std::string& bundlePath, std::string& error) {
+    std::vector<std::string> files;
+    for (const auto& name : Utils::listDirectory(confDir)) {
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".conf") == 0) {
+            files.push_back(name);
+        }
+    }
+    if (files.empty()) {
+        error = "no .conf files in " + confDir;
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<std::string> names, texts;
+    std::vector<long long> mtimes;
+    for (const auto& file : files) {
+        std::string path = confDir + "/" + file;
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            error = "cannot read " + path;
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        long long mtime = 0;
+        modificationTime(path, mtime);
+        names.push_back(file.substr(0, file.size() - 5));
+        texts.push_back(buffer.str());
+        mtimes.push_back(mtime);
+    }
+
+    std::string out(kMagic, sizeof(kMagic));
+    put<uint32_t>(out, kVersion);
+    put<uint32_t>(out, static_cast<uint32_t>(names.size()));
+    uint64_t offset = kHeaderSize + names.size() * kEntrySize;
+    std::string blob;
+    for (size_t i = 0; i < names.size(); i++) {
+        put<uint32_t>(out, static_cast<uint32_t>(offset + blob.size()));
+        put<uint32_t>(out, static_cast<uint32_t>(names[i].size()));
+        blob += names[i];
+        put<uint64_t>(out, offset + blob.size());
+        put<uint64_t>(out, texts[i].size());
+        put<int64_t>(out, mtimes[i]);
+        blob += texts[i];
+    }
+    out += blob;
+
+    // Written next to the target and renamed, so running jobs never see a partial bundle
+    static std::atomic<unsigned> counter(0);
+    std::string tmp = bundlePath + "." + std::to_string(getpid()) + "_" + std::to_string(counter.fetch_add(1)) + ".tmp";
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        error = "cannot create " + tmp;
+        return false;
+    }
+    file << out;
+    file.close();
+    if (file.fail()) {
+        remove(tmp.c_str());
+        error = "cannot write " + tmp;
+        return false;
+    }
+#ifdef PLATFORM_WINDOWS
+    remove(bundlePath.c_str());  // rename() does not replace on Windows
+#endif
+    if (rename(tmp.c_str(), bundlePath.c_str()) != 0) {
+        remove(tmp.c_str());
+        error = "cannot rename " + tmp + " to " + bundlePath;
+        return false;
+    }
+    return true;
+}
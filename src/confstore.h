@@ -0,0 +1,61 @@
+#ifndef CONFSTORE_H
+#define CONFSTORE_H
+#include "mmapfile.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Module conf compiled into the binary at build time (see tools/embed_confs.cpp)
+struct EmbeddedConf {
+    const char* name;  // Module name (file name without .conf)
+    const char* text;
+    size_t size;
+    long long mtime;  // Modification time of the source file when it was embedded
+};
+
+// Sorted by name
+extern const EmbeddedConf kEmbeddedConfs[];
+extern const size_t kEmbeddedConfCount;
+
+// Where module confs come from. confpath may name a directory of .conf files or a bundle
+// written by `banewfn --bundle` (one indexed file, loaded with a single mmap).
+// Lookup order for <module>:
+//   bundle:    the bundled copy, else the embedded one
+//   directory: <dir>/<module>.conf if it exists and is newer than the embedded copy
+//              (one stat per module), else the embedded one
+class ConfStore {
+public:
+    // Select the conf directory or bundle; returns false if a bundle is unreadable
+    bool setConfPath(const std::string& path);
+
+    // Text of <module>.conf. `storage` holds the text when it is read from disk; `origin`
+    // describes where it came from. Returns false if no copy exists anywhere.
+    bool find(const std::string& module, std::string_view& text, std::string& storage,
+              std::string& origin) const;
+
+    const std::string& getError() const { return error; }
+
+    // File whose changes can alter what find() returns for a module: the bundle, or
+    // <dir>/<module>.conf (which need not exist yet)
+    std::string sourceFile(const std::string& module) const {
+        return useBundle ? confPath : confPath + "/" + module + ".conf";
+    }
+
+    // Pack the *.conf files of a directory into a bundle file
+    static bool writeBundle(const std::string& confDir, const std::string& bundlePath, std::string& error);
+
+    // Whether a file starts with the bundle signature
+    static bool isBundleFile(const std::string& path);
+
+private:
+    bool findInBundle(const std::string& module, std::string_view& text) const;
+    static const EmbeddedConf* findEmbedded(const std::string& module);
+
+    std::string confPath;
+    bool useBundle = false;
+    MappedFile bundle;
+    size_t bundleCount = 0;
+    std::string error;
+};
+
+#endif // CONFSTORE_H
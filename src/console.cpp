@@ -0,0 +1,93 @@
+#include "console.h"
+#include <cstdio>
+
+ConsoleMux& ConsoleMux::instance() {
+    static ConsoleMux mux;
+    return mux;
+}
+
+ConsoleMux::~ConsoleMux() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void ConsoleMux::post(std::string text) {
+    if (text.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!writer.joinable()) {
+            writer = std::thread(&ConsoleMux::writerLoop, this);
+        }
+        pending.push_back(std::move(text));
+    }
+    queued.notify_one();
+}
+
+void ConsoleMux::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    written.wait(lock, [this] { return pending.empty() && !writing; });
+}
+
+void ConsoleMux::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queued.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
+        // Take everything queued so far and write it in one go
+        std::string batch;
+        while (!pending.empty()) {
+            batch += pending.front();
+            pending.pop_front();
+        }
+        writing = true;
+        lock.unlock();
+        fwrite(batch.data(), 1, batch.size(), stdout);
+        fflush(stdout);
+        lock.lock();
+        writing = false;
+        written.notify_all();
+    }
+}
+
+void ConsoleStream::write(const char* data, size_t len) {
+    if (prefix.empty()) {
+        ConsoleMux::instance().post(std::string(data, len));
+        return;
+    }
+
+    // Emit complete lines only, so that lines of different jobs never interleave
+    std::string out;
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            out += "[" + prefix + "] ";
+            out += partial;
+            out.append(data + start, i - start + 1);
+            partial.clear();
+            start = i + 1;
+        }
+    }
+    partial.append(data + start, len - start);
+    ConsoleMux::instance().post(std::move(out));
+}
+
+void ConsoleStream::close() {
+    if (!prefix.empty() && !partial.empty()) {
+        ConsoleMux::instance().post("[" + prefix + "] " + partial + "\n");
+        partial.clear();
+    }
+    ConsoleMux::instance().drain();
+}
@@ -0,0 +1,52 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+#include "process.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Serializes console output of concurrently running jobs.
+// Text is queued and written by a background thread, so a slow terminal
+// never stalls the threads that drain the children's pipes.
+class ConsoleMux {
+public:
+    static ConsoleMux& instance();
+
+    // Queue text for the console
+    void post(std::string text);
+
+    // Wait until everything queued so far has been written
+    void drain();
+
+    ~ConsoleMux();
+
+private:
+    ConsoleMux() = default;
+    void writerLoop();
+
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable written;
+    std::deque<std::string> pending;
+    bool writing = false;
+    bool stopping = false;
+    std::thread writer;
+};
+
+// Console sink for one job's output. With a prefix, output is buffered per job
+// and emitted as whole lines tagged "[prefix] "; without one it is passed through.
+class ConsoleStream : public OutputSink {
+public:
+    explicit ConsoleStream(const std::string& prefix = "") : prefix(prefix) {}
+
+    void write(const char* data, size_t len) override;
+    void close() override;
+
+private:
+    std::string prefix;
+    std::string partial;  // Unterminated last line (prefixed mode)
+};
+
+#endif // CONSOLE_H
@@ -0,0 +1,226 @@
+#include "cpuset.h"
+#include "config.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#ifdef PLATFORM_LINUX
+#include <sched.h>
+#endif
+
+namespace {
+
+#ifdef PLATFORM_LINUX
+std::string readLine(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return Utils::trim(line);
+}
+
+// Kernel CPU list format: "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> list;
+    for (const auto& range : Utils::split(text, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) {
+            list.push_back(cpu);
+        }
+    }
+    return list;
+}
+
+// Quota of "cpu.max" ("<quota> <period>" or "max <period>") in CPUs, 0 if unlimited
+double readCpuMax(const std::string& path) {
+    std::istringstream line(readLine(path));
+    std::string limit;
+    double period = 0;
+    if (!(line >> limit >> period) || limit == "max" || period <= 0) {
+        return 0;
+    }
+    return std::atof(limit.c_str()) / period;
+}
+
+// Tightest cpu.max from the process's cgroup up to the root of the v2 hierarchy
+double cgroupQuota() {
+    std::ifstream file("/proc/self/cgroup");
+    std::string line, path;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            path = Utils::trim(line.substr(3));
+        }
+    }
+    if (path.empty()) {
+        return 0;
+    }
+    double quota = 0;
+    // Pure v2 systems mount it at /sys/fs/cgroup, hybrid ones at /sys/fs/cgroup/unified
+    for (const char* root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+        std::string dir = path;
+        while (true) {
+            double limit = readCpuMax(root + (dir == "/" ? "" : dir) + "/cpu.max");
+            if (limit > 0 && (quota == 0 || limit < quota)) {
+                quota = limit;
+            }
+            if (dir.empty() || dir == "/") {
+                break;
+            }
+            size_t slash = dir.rfind('/');
+            dir = slash == 0 || slash == std::string::npos ? "/" : dir.substr(0, slash);
+        }
+    }
+    return quota;
+}
+#endif
+
+std::string formatCpuList(const std::vector<int>& list) {
+    std::ostringstream out;
+    for (size_t i = 0; i < list.size();) {
+        size_t j = i;
+        while (j + 1 < list.size() && list[j + 1] == list[j] + 1) {
+            j++;
+        }
+        out << (i > 0 ? "," : "") << list[i];
+        if (j > i) {
+            out << "-" << list[j];
+        }
+        i = j + 1;
+    }
+    return out.str();
+}
+
+} // namespace
+
+CpuSet CpuSet::detect() {
+    CpuSet set;
+#ifdef PLATFORM_LINUX
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &mask)) {
+                set.cpus.push_back(cpu);
+            }
+        }
+    }
+
+    std::map<int, int> nodeOf;
+    for (const auto& entry : Utils::listDirectory("/sys/devices/system/node")) {
+        if (entry.compare(0, 4, "node") != 0 || entry.size() == 4 ||
+            entry.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        int node = std::atoi(entry.c_str() + 4);
+        for (int cpu : parseCpuList(readLine("/sys/devices/system/node/" + entry + "/cpulist"))) {
+            nodeOf[cpu] = node;
+        }
+    }
+    for (int cpu : set.cpus) {
+        auto it = nodeOf.find(cpu);
+        set.nodes.push_back(it == nodeOf.end() ? 0 : it->second);
+    }
+    set.quota = cgroupQuota();
+#endif
+    if (set.cpus.empty()) {
+        unsigned count = std::thread::hardware_concurrency();
+        for (unsigned cpu = 0; cpu < std::max(1u, count); cpu++) {
+            set.cpus.push_back(static_cast<int>(cpu));
+            set.nodes.push_back(0);
+        }
+    }
+    return set;
+}
+
+int CpuSet::usableCount() const {
+    int count = static_cast<int>(cpus.size());
+    if (quota > 0) {
+        count = std::min(count, std::max(1, static_cast<int>(std::ceil(quota))));
+    }
+    return count;
+}
+
+int CpuSet::nodeCount() const {
+    std::vector<int> distinct(nodes);
+    std::sort(distinct.begin(), distinct.end());
+    return static_cast<int>(std::unique(distinct.begin(), distinct.end()) - distinct.begin());
+}
+
+std::string CpuSet::describe() const {
+    std::ostringstream out;
+    out << cpus.size() << " CPU" << (cpus.size() == 1 ? "" : "s") << " (" << formatCpuList(cpus) << ")";
+    int nodeTotal = nodeCount();
+    if (nodeTotal > 1) {
+        out << " on " << nodeTotal << " NUMA nodes";
+    }
+    if (quota > 0) {
+        out << ", cgroup quota " << quota;
+    }
+    return out.str();
+}
+
+std::vector<std::vector<int>> CpuSet::partition(int slots, int perSlot) const {
+    if (slots <= 0 || perSlot <= 0 || static_cast<size_t>(slots) * perSlot > cpus.size()) {
+        return {};
+    }
+    std::map<int, std::vector<int>> freeCpus;  // By node
+    for (size_t i = 0; i < cpus.size(); i++) {
+        freeCpus[nodes[i]].push_back(cpus[i]);
+    }
+
+    std::vector<std::vector<int>> sets;
+    for (int s = 0; s < slots; s++) {
+        std::vector<int> set;
+        // Best fit: the node with the fewest free CPUs that still holds a whole slot
+        auto best = freeCpus.end();
+        for (auto it = freeCpus.begin(); it != freeCpus.end(); ++it) {
+            if (static_cast<int>(it->second.size()) >= perSlot &&
+                (best == freeCpus.end() || it->second.size() < best->second.size())) {
+                best = it;
+            }
+        }
+        if (best != freeCpus.end()) {
+            set.assign(best->second.begin(), best->second.begin() + perSlot);
+            best->second.erase(best->second.begin(), best->second.begin() + perSlot);
+        } else {
+            // No node has room left: take what is free, node by node
+            for (auto& node : freeCpus) {
+                while (!node.second.empty() && static_cast<int>(set.size()) < perSlot) {
+                    set.push_back(node.second.front());
+                    node.second.erase(node.second.begin());
+                }
+            }
+        }
+        std::sort(set.begin(), set.end());
+        sets.push_back(std::move(set));
+    }
+    return sets;
+}
+
+bool CpuSet::pinThread(const std::vector<int>& list) {
+#ifdef PLATFORM_LINUX
+    if (list.empty()) {
+        return false;
+    }
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (int cpu : list) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+#else
+    (void)list;
+    return false;
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef CPUSET_H
+#define CPUSET_H
+#include <string>
+#include <vector>
+
+// CPUs the calling thread may run on: its affinity mask (set by Slurm, taskset, containers),
+// the NUMA node of each CPU and the cgroup v2 CPU quota (cpu.max) of the process.
+// On Windows only the processor count is known and nothing is pinned.
+class CpuSet {
+public:
+    static CpuSet detect();
+
+    // CPUs worth running threads on: the allowed CPUs, limited by the quota (rounded up)
+    int usableCount() const;
+    const std::vector<int>& getCpus() const { return cpus; }
+    // cgroup quota in CPUs, 0 if unlimited
+    double getQuota() const { return quota; }
+    int nodeCount() const;
+    // e.g. "8 CPUs (0-7) on 2 NUMA nodes, cgroup quota 4"
+    std::string describe() const;
+
+    // Split into `slots` disjoint sets of `perSlot` CPUs. Each set lies on one NUMA node when
+    // a node has room for it. Empty if there are not enough CPUs for all slots.
+    std::vector<std::vector<int>> partition(int slots, int perSlot) const;
+
+    // Restrict the calling thread to `cpus`; processes it starts afterwards inherit the mask
+    static bool pinThread(const std::vector<int>& cpus);
+
+private:
+    std::vector<int> cpus;  // Sorted
+    std::vector<int> nodes;  // NUMA node of each CPU
+    double quota = 0;
+};
+
+#endif // CPUSET_H
@@ -0,0 +1,557 @@
+#include "cube.h"
+#include "cubepack.h"
+#include "mmapfile.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int resolveThreads(int threads) {
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    return threads < 1 ? 1 : threads;
+}
+
+// Split [0, count) into one contiguous range per thread
+void parallelFor(size_t count, int threads, const std::function<void(size_t, size_t)>& fn) {
+    size_t parts = std::min<size_t>(static_cast<size_t>(threads), std::max<size_t>(1, count / 65536));
+    if (parts <= 1) {
+        fn(0, count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (size_t p = 0; p < parts; p++) {
+        pool.emplace_back(fn, count * p / parts, count * (p + 1) / parts);
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+// Parse a Fortran-style real ("-1.23456E-01", "1.23456-100", "1.0D+00").
+// Short mantissas with small exponents take an exact fast path, anything else goes through strtod.
+bool parseReal(const char* begin, const char* end, double& out) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int scale = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+        if (digits < 18) {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            if (mantissa) digits++;
+        } else {
+            scale++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                if (mantissa) digits++;
+                scale--;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    int exponent = 0;
+    if (p < end) {
+        if (*p == 'E' || *p == 'e' || *p == 'D' || *p == 'd') {
+            p++;
+        } else if (*p != '-' && *p != '+') {
+            return false;
+        }
+        bool expNegative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            expNegative = (*p == '-');
+            p++;
+        }
+        if (p == end) {
+            return false;
+        }
+        for (; p < end; p++) {
+            if (*p < '0' || *p > '9' || exponent > 100000) {
+                return false;
+            }
+            exponent = exponent * 10 + (*p - '0');
+        }
+        if (expNegative) {
+            exponent = -exponent;
+        }
+    }
+    scale += exponent;
+
+    if (digits <= 15 && scale >= -22 && scale <= 22) {
+        double v = static_cast<double>(mantissa);
+        v = scale < 0 ? v / pow10[-scale] : v * pow10[scale];
+        out = negative ? -v : v;
+        return true;
+    }
+
+    // Slow path: normalize to C syntax
+    char buf[64];
+    size_t len = static_cast<size_t>(end - begin);
+    if (len >= sizeof(buf) - 1) {
+        return false;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = begin[i];
+        if (c == 'D' || c == 'd') c = 'E';
+        // "1.23456-100": insert the missing exponent letter
+        if ((c == '-' || c == '+') && i > 0 && begin[i - 1] >= '0' && begin[i - 1] <= '9') {
+            buf[k++] = 'E';
+        }
+        buf[k++] = c;
+    }
+    buf[k] = '\0';
+    char* stop = nullptr;
+    out = std::strtod(buf, &stop);
+    return *stop == '\0';
+}
+
+} // namespace
+
+// Format like Fortran 1PE13.5: three-digit exponents drop the 'E' to keep the field width
+void formatCubeValue(double v, std::string& out) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%.5E", v);
+    char* e = strchr(buf, 'E');
+    if (e && strlen(e) > 4) {
+        memmove(e, e + 1, strlen(e + 1) + 1);
+        len--;
+    }
+    if (len < 13) {
+        out.append(static_cast<size_t>(13 - len), ' ');
+    }
+    out.append(buf, static_cast<size_t>(len));
+}
+
+namespace {
+
+// Next line of the header; returns false at the end of the data
+bool nextLine(const char* data, size_t size, size_t& pos, std::string& line) {
+    if (pos >= size) {
+        return false;
+    }
+    const char* nl = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+    size_t end = nl ? static_cast<size_t>(nl - data) : size;
+    line.assign(data + pos, end - pos);
+    pos = nl ? end + 1 : size;
+    return true;
+}
+
+} // namespace
+
+bool CubeFile::parseHeader(const char* data, size_t size, const std::string& path) {
+    size_t pos = 0;
+    std::string line;
+
+    // Two comment lines, then "natoms x0 y0 z0 [nval]"
+    for (int i = 0; i < 2; i++) {
+        if (!nextLine(data, size, pos, line)) {
+            error = path + ": truncated header";
+            return false;
+        }
+    }
+    long long natoms = 0;
+    if (!nextLine(data, size, pos, line)) {
+        error = path + ": truncated header";
+        return false;
+    }
+    {
+        std::istringstream ss(line);
+        if (!(ss >> natoms >> origin[0] >> origin[1] >> origin[2])) {
+            error = path + ": malformed atom count/origin line";
+            return false;
+        }
+        if (!(ss >> nval) || nval < 1) {
+            nval = 1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        std::istringstream ss;
+        if (nextLine(data, size, pos, line)) {
+            ss.str(line);
+        }
+        if (!(ss >> n[i] >> axes[i][0] >> axes[i][1] >> axes[i][2])) {
+            error = path + ": malformed grid line";
+            return false;
+        }
+        n[i] = std::abs(n[i]);  // A negative count only marks Angstrom units
+        if (n[i] == 0) {
+            error = path + ": empty grid";
+            return false;
+        }
+    }
+
+    for (long long i = 0; i < std::llabs(natoms); i++) {
+        if (!nextLine(data, size, pos, line)) {
+            error = path + ": truncated atom list";
+            return false;
+        }
+    }
+
+    // Orbital cubes (negative atom count) list the orbital indices before the data
+    if (natoms < 0) {
+        long long wanted = -1, seen = 0;
+        while (wanted < 0 || seen < wanted + 1) {
+            if (!nextLine(data, size, pos, line)) {
+                error = path + ": truncated orbital list";
+                return false;
+            }
+            std::istringstream ss(line);
+            long long v;
+            while (ss >> v) {
+                if (wanted < 0) {
+                    wanted = v;
+                }
+                seen++;
+            }
+        }
+        nval = static_cast<int>(std::max(1LL, wanted));
+    }
+    header.assign(data, pos);
+    return true;
+}
+
+bool CubeFile::load(const std::string& path, int threads) {
+    threads = resolveThreads(threads);
+    values.clear();
+
+    // Packed cubes carry the text header and the values in binary form
+    if (PackedCube::isPackedFile(path)) {
+        PackedCube packed;
+        if (!packed.open(path)) {
+            error = packed.getError();
+            return false;
+        }
+        const std::string& text = packed.getHeader();
+        if (!parseHeader(text.data(), text.size(), path)) {
+            return false;
+        }
+        if (n[0] != packed.getNx() || n[1] != packed.getNy() || n[2] != packed.getNz() ||
+            nval != packed.getValuesPerPoint()) {
+            error = path + ": packed grid does not match its header";
+            return false;
+        }
+        if (!packed.readAll(values, threads)) {
+            error = packed.getError();
+            return false;
+        }
+        return true;
+    }
+
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot open cube file " + path;
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+    if (!parseHeader(data, size, path)) {
+        return false;
+    }
+    size_t pos = header.size();
+
+    // Decode the data section in chunks split at whitespace
+    size_t begin = pos;
+    size_t end = size;
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, (end - begin) / (1 << 20)));
+    std::vector<size_t> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    bounds[chunkCount] = end;
+    for (size_t c = 1; c < chunkCount; c++) {
+        size_t b = begin + (end - begin) * c / chunkCount;
+        while (b < end && !isSpace(data[b])) b++;
+        bounds[c] = std::max(b, bounds[c - 1]);
+    }
+
+    std::vector<std::vector<double>> parts(chunkCount);
+    std::vector<char> ok(chunkCount, 1);
+    auto decode = [&](size_t c) {
+        std::vector<double>& out = parts[c];
+        out.reserve((bounds[c + 1] - bounds[c]) / 13 + 1);
+        size_t p = bounds[c];
+        size_t stop = bounds[c + 1];
+        while (p < stop) {
+            while (p < stop && isSpace(data[p])) p++;
+            if (p >= stop) break;
+            size_t q = p;
+            while (q < stop && !isSpace(data[q])) q++;
+            double v;
+            if (!parseReal(data + p, data + q, v)) {
+                ok[c] = 0;
+                return;
+            }
+            out.push_back(v);
+            p = q;
+        }
+    };
+    if (chunkCount == 1) {
+        decode(0);
+    } else {
+        std::vector<std::thread> pool;
+        for (size_t c = 0; c < chunkCount; c++) {
+            pool.emplace_back(decode, c);
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+    }
+
+    size_t total = 0;
+    for (size_t c = 0; c < chunkCount; c++) {
+        if (!ok[c]) {
+            error = path + ": invalid number in grid data";
+            return false;
+        }
+        total += parts[c].size();
+    }
+    size_t expected = static_cast<size_t>(n[0]) * n[1] * n[2] * nval;
+    if (total != expected) {
+        error = path + ": expected " + std::to_string(expected) + " grid values, found " + std::to_string(total);
+        return false;
+    }
+    values.reserve(total);
+    for (auto& part : parts) {
+        values.insert(values.end(), part.begin(), part.end());
+        std::vector<double>().swap(part);
+    }
+    return true;
+}
+
+bool CubeFile::save(const std::string& path, int threads) {
+    threads = resolveThreads(threads);
+    std::string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) {
+        error = "cannot create " + tmp;
+        return false;
+    }
+    bool ok = fwrite(header.data(), 1, header.size(), out) == header.size();
+
+    // Each (x, y) row of nz * nval values starts a new line, 6 values per line.
+    // Rows are formatted in rounds of one block per thread to bound memory use.
+    size_t rowLen = static_cast<size_t>(n[2]) * nval;
+    size_t rows = static_cast<size_t>(n[0]) * n[1];
+    size_t rowsPerBlock = std::max<size_t>(1, (1 << 18) / rowLen);
+    std::vector<std::string> blocks(threads);
+    for (size_t row = 0; row < rows && ok;) {
+        size_t roundEnd = std::min(rows, row + rowsPerBlock * threads);
+        size_t used = (roundEnd - row + rowsPerBlock - 1) / rowsPerBlock;
+        auto format = [&](size_t b) {
+            std::string& text = blocks[b];
+            text.clear();
+            size_t first = row + b * rowsPerBlock;
+            size_t last = std::min(roundEnd, first + rowsPerBlock);
+            text.reserve((last - first) * (rowLen * 13 + rowLen / 6 + 1));
+            for (size_t r = first; r < last; r++) {
+                const double* v = values.data() + r * rowLen;
+                for (size_t i = 0; i < rowLen; i++) {
+                    formatCubeValue(v[i], text);
+                    if (i % 6 == 5 || i + 1 == rowLen) {
+                        text += '\n';
+                    }
+                }
+            }
+        };
+        if (used == 1) {
+            format(0);
+        } else {
+            std::vector<std::thread> pool;
+            for (size_t b = 0; b < used; b++) {
+                pool.emplace_back(format, b);
+            }
+            for (auto& t : pool) {
+                t.join();
+            }
+        }
+        for (size_t b = 0; b < used && ok; b++) {
+            ok = fwrite(blocks[b].data(), 1, blocks[b].size(), out) == blocks[b].size();
+        }
+        row = roundEnd;
+    }
+
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp.c_str(), path.c_str()) != 0) {
+        // Windows does not replace existing files on rename
+        remove(path.c_str());
+        ok = rename(tmp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        remove(tmp.c_str());
+        error = "cannot write " + path;
+    }
+    return ok;
+}
+
+bool CubeFile::sameGrid(const CubeFile& other, std::string& reason) const {
+    if (n[0] != other.n[0] || n[1] != other.n[1] || n[2] != other.n[2]) {
+        reason = "grid dimensions differ (" + std::to_string(n[0]) + "x" + std::to_string(n[1]) + "x" +
+                 std::to_string(n[2]) + " vs " + std::to_string(other.n[0]) + "x" + std::to_string(other.n[1]) +
+                 "x" + std::to_string(other.n[2]) + ")";
+        return false;
+    }
+    if (nval != other.nval) {
+        reason = "number of values per point differs";
+        return false;
+    }
+    const double tol = 1e-5;
+    for (int i = 0; i < 3; i++) {
+        if (std::fabs(origin[i] - other.origin[i]) > tol) {
+            reason = "grid origins differ";
+            return false;
+        }
+        for (int j = 0; j < 3; j++) {
+            if (std::fabs(axes[i][j] - other.axes[i][j]) > tol) {
+                reason = "grid spacings differ";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool runCubeStatement(const std::string& statement, int threads, std::string& error,
+                      const std::string& baseDir) {
+    threads = resolveThreads(threads);
+
+    // <out> = <op> <operands...>
+    size_t eq = statement.find('=');
+    if (eq == std::string::npos) {
+        error = "expected '<out> = <op> <operands>': " + statement;
+        return false;
+    }
+    std::string outPath = Utils::trim(statement.substr(0, eq));
+    std::vector<std::string> tokens;
+    {
+        std::istringstream ss(statement.substr(eq + 1));
+        std::string token;
+        while (ss >> token) {
+            tokens.push_back(token);
+        }
+    }
+    if (outPath.empty() || tokens.empty()) {
+        error = "expected '<out> = <op> <operands>': " + statement;
+        return false;
+    }
+
+    auto inBaseDir = [&](std::string& path) {
+        if (!baseDir.empty() && !Utils::isAbsolutePath(path)) {
+            path = baseDir + "/" + path;
+        }
+    };
+    inBaseDir(outPath);
+
+    const std::string& op = tokens[0];
+    size_t wantFiles = 0, wantNumbers = 0, optionalNumbers = 0;
+    if (op == "add" || op == "sub") {
+        wantFiles = 2;
+    } else if (op == "scale") {
+        wantFiles = 1;
+        wantNumbers = 1;
+    } else if (op == "abs") {
+        wantFiles = 1;
+    } else if (op == "mask") {
+        wantFiles = 2;
+        wantNumbers = 1;
+    } else if (op == "pack") {
+        wantFiles = 1;
+        optionalNumbers = 1;
+    } else if (op == "unpack") {
+        wantFiles = 1;
+    } else {
+        error = "unknown cube operation '" + op + "' (expected add, sub, scale, abs, mask, pack or unpack)";
+        return false;
+    }
+    if (tokens.size() == 1 + wantFiles + optionalNumbers) {
+        wantNumbers += optionalNumbers;
+    }
+    if (tokens.size() != 1 + wantFiles + wantNumbers) {
+        error = op + " expects " + std::to_string(wantFiles) + " cube file(s)" +
+                (wantNumbers ? " and a number" : "") + ": " + statement;
+        return false;
+    }
+    for (size_t i = 1; i <= wantFiles; i++) {
+        inBaseDir(tokens[i]);
+    }
+    double number = 0;
+    if (wantNumbers) {
+        const std::string& text = tokens[1 + wantFiles];
+        if (!parseReal(text.data(), text.data() + text.size(), number)) {
+            error = "invalid number '" + text + "'";
+            return false;
+        }
+    }
+
+    if (op == "pack") {
+        return packCube(tokens[1], outPath, number, threads, error);
+    }
+
+    CubeFile a, b;
+    if (!a.load(tokens[1], threads)) {
+        error = a.getError();
+        return false;
+    }
+    if (wantFiles == 2) {
+        if (!b.load(tokens[2], threads)) {
+            error = b.getError();
+            return false;
+        }
+        std::string reason;
+        if (!a.sameGrid(b, reason)) {
+            error = tokens[1] + " and " + tokens[2] + " are not on the same grid: " + reason;
+            return false;
+        }
+    }
+
+    // Plain loops over contiguous arrays; the compiler vectorizes them
+    double* x = a.getValues().data();
+    const double* y = b.getValues().data();
+    size_t count = a.getValues().size();
+    parallelFor(count, threads, [&](size_t lo, size_t hi) {
+        if (op == "add") {
+            for (size_t i = lo; i < hi; i++) x[i] += y[i];
+        } else if (op == "sub") {
+            for (size_t i = lo; i < hi; i++) x[i] -= y[i];
+        } else if (op == "scale") {
+            for (size_t i = lo; i < hi; i++) x[i] *= number;
+        } else if (op == "abs") {
+            for (size_t i = lo; i < hi; i++) x[i] = std::fabs(x[i]);
+        } else if (op == "mask") {
+            for (size_t i = lo; i < hi; i++) x[i] = y[i] > number ? x[i] : 0.0;
+        }
+    });
+
+    if (!a.save(outPath, threads)) {
+        error = a.getError();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef CUBE_H
+#define CUBE_H
+#include <string>
+#include <vector>
+
+// Gaussian cube file held in memory. The header is kept verbatim, so results
+// written from a loaded cube carry the same comments, grid and atoms.
+class CubeFile {
+public:
+    // Map and parse the file; the data section is decoded on several threads.
+    // Packed cubes (see cubepack.h) are accepted as well.
+    bool load(const std::string& path, int threads = 0);
+
+    // Write the cube (numbers formatted on several threads). The file is written
+    // next to the target and renamed over it, so a cube may be overwritten in place.
+    bool save(const std::string& path, int threads = 0);
+
+    const std::string& getError() const { return error; }
+
+    // Whether both cubes sample the same points; otherwise reason says what differs
+    bool sameGrid(const CubeFile& other, std::string& reason) const;
+
+    int getNx() const { return n[0]; }
+    int getNy() const { return n[1]; }
+    int getNz() const { return n[2]; }
+    int getValuesPerPoint() const { return nval; }
+
+    // Grid data in file order (z fastest, then y, then x; nval values per point)
+    std::vector<double>& getValues() { return values; }
+    const std::vector<double>& getValues() const { return values; }
+
+    // Verbatim header text (everything before the first data value)
+    const std::string& getHeader() const { return header; }
+
+private:
+    bool parseHeader(const char* data, size_t size, const std::string& path);
+
+    std::string header;
+    std::string error;
+    int n[3] = {0, 0, 0};
+    double origin[3] = {0, 0, 0};
+    double axes[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    int nval = 1;
+    std::vector<double> values;
+};
+
+// Format one grid value like Multiwfn does (Fortran 1PE13.5)
+void formatCubeValue(double v, std::string& out);
+
+// Run one cube arithmetic statement of the form "<out> = <op> <operands>":
+//   out = add a.cub b.cub         a + b
+//   out = sub a.cub b.cub         a - b
+//   out = scale a.cub <factor>    a * factor
+//   out = abs a.cub               |a|
+//   out = mask a.cub m.cub <t>    a where m > t, 0 elsewhere
+//   out = pack a.cub [maxerr]     packed binary cube (float32, or quantized to maxerr)
+//   out = unpack a.bcub           text cube from a packed one
+// Relative file names are taken relative to baseDir when given.
+// Returns false and sets error if the statement or the cubes are invalid.
+bool runCubeStatement(const std::string& statement, int threads, std::string& error,
+                      const std::string& baseDir = "");
+
+#endif // CUBE_H
@@ -0,0 +1,412 @@
+#include "cubepack.h"
+#include "cube.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+namespace {
+
+// File layout (little-endian):
+//   char[8] magic, u32 encoding, u32 planesPerChunk, i32 nx, ny, nz, nval,
+//   f64 step, u64 headerSize, u64 chunkCount, u64 exceptionCount       (64 bytes)
+//   header text, u64 offsets[chunkCount + 1], {u64 index, f64 value}[exceptionCount], chunk data
+const char kMagic[8] = {'B', 'A', 'N', 'E', 'C', 'U', 'B', '1'};
+const size_t kPrefixSize = 64;
+const size_t kChunkTarget = 1 << 20;  // Raw bytes per chunk (float32)
+
+void put32(std::string& out, uint32_t v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void put64(std::string& out, uint64_t v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void putDouble(std::string& out, double v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+T get(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+// Run fn(item) for every item in [0, count) on up to `threads` workers
+void forEachItem(size_t count, int threads, const std::function<void(size_t)>& fn) {
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    size_t workers = std::min<size_t>(count, threads < 1 ? 1 : threads);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (size_t w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                fn(i);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+} // namespace
+
+bool PackedCube::isPackedFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool PackedCube::open(const std::string& path) {
+    if (!file.open(path)) {
+        error = "cannot open packed cube " + path;
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+    if (size < kPrefixSize || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        error = path + ": not a packed cube";
+        return false;
+    }
+
+    encoding = get<uint32_t>(data + 8);
+    planesPerChunk = get<uint32_t>(data + 12);
+    for (int i = 0; i < 3; i++) {
+        n[i] = get<int32_t>(data + 16 + 4 * i);
+    }
+    nval = get<int32_t>(data + 28);
+    step = get<double>(data + 32);
+    uint64_t headerSize = get<uint64_t>(data + 40);
+    uint64_t chunkCount = get<uint64_t>(data + 48);
+    uint64_t exceptionCount = get<uint64_t>(data + 56);
+
+    if (encoding > 1 || planesPerChunk == 0 || n[0] <= 0 || n[1] <= 0 || n[2] <= 0 || nval <= 0 ||
+        chunkCount != (static_cast<uint64_t>(n[2]) + planesPerChunk - 1) / planesPerChunk ||
+        headerSize > size || exceptionCount > size) {
+        error = path + ": corrupt packed cube header";
+        return false;
+    }
+    size_t pos = kPrefixSize;
+    size_t indexEnd = pos + headerSize + (chunkCount + 1) * 8 + exceptionCount * 16;
+    if (indexEnd > size) {
+        error = path + ": truncated packed cube";
+        return false;
+    }
+    header.assign(data + pos, headerSize);
+    pos += headerSize;
+
+    chunkOffsets.resize(chunkCount + 1);
+    for (uint64_t c = 0; c <= chunkCount; c++, pos += 8) {
+        chunkOffsets[c] = get<uint64_t>(data + pos);
+    }
+    exceptions.resize(exceptionCount);
+    for (uint64_t e = 0; e < exceptionCount; e++, pos += 16) {
+        exceptions[e] = {get<uint64_t>(data + pos), get<double>(data + pos + 8)};
+    }
+
+    uint64_t total = static_cast<uint64_t>(n[0]) * n[1] * n[2] * nval;
+    if (chunkOffsets[0] != indexEnd || chunkOffsets[chunkCount] != size) {
+        error = path + ": corrupt chunk index";
+        return false;
+    }
+    for (uint64_t c = 0; c < chunkCount; c++) {
+        if (chunkOffsets[c + 1] < chunkOffsets[c]) {
+            error = path + ": corrupt chunk index";
+            return false;
+        }
+    }
+    for (const auto& e : exceptions) {
+        if (e.first >= total) {
+            error = path + ": corrupt exception list";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PackedCube::decodeChunk(size_t chunk, std::vector<double>& planes) const {
+    int z0 = static_cast<int>(chunk * planesPerChunk);
+    int z1 = std::min(n[2], z0 + static_cast<int>(planesPerChunk));
+    size_t count = static_cast<size_t>(z1 - z0) * n[0] * n[1] * nval;
+    const char* p = file.data() + chunkOffsets[chunk];
+    const char* end = file.data() + chunkOffsets[chunk + 1];
+    planes.resize(count);
+
+    if (encoding == 0) {
+        if (static_cast<size_t>(end - p) != count * sizeof(float)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            planes[i] = get<float>(p + i * sizeof(float));
+        }
+        return true;
+    }
+
+    // Quantized: zigzag varint deltas
+    int64_t q = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t v = 0;
+        int shift = 0;
+        while (true) {
+            if (p >= end || shift > 63) {
+                return false;
+            }
+            unsigned char byte = static_cast<unsigned char>(*p++);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+        }
+        q += static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+        planes[i] = static_cast<double>(q) * step;
+    }
+    return p == end;
+}
+
+void PackedCube::applyExceptions(int z0, int z1, std::vector<double>& planes) const {
+    for (const auto& e : exceptions) {
+        uint64_t point = e.first / nval;
+        int iv = static_cast<int>(e.first % nval);
+        int iz = static_cast<int>(point % n[2]);
+        if (iz < z0 || iz >= z1) {
+            continue;
+        }
+        uint64_t column = point / n[2];
+        uint64_t ix = column / n[1];
+        uint64_t iy = column % n[1];
+        planes[(((static_cast<uint64_t>(iz - z0) * n[0] + ix) * n[1] + iy) * nval) + iv] = e.second;
+    }
+}
+
+bool PackedCube::readSlab(int z0, int z1, std::vector<double>& values) const {
+    if (z0 < 0 || z1 > n[2] || z0 >= z1) {
+        return false;
+    }
+    size_t planeSize = static_cast<size_t>(n[0]) * n[1] * nval;
+    values.resize(static_cast<size_t>(z1 - z0) * planeSize);
+    std::vector<double> planes;
+    for (size_t c = z0 / planesPerChunk; c * planesPerChunk < static_cast<size_t>(z1); c++) {
+        if (!decodeChunk(c, planes)) {
+            error = "corrupt chunk data in packed cube";
+            return false;
+        }
+        int cz0 = static_cast<int>(c * planesPerChunk);
+        int from = std::max(z0, cz0);
+        int to = std::min(z1, cz0 + static_cast<int>(planesPerChunk));
+        std::copy(planes.begin() + (from - cz0) * planeSize, planes.begin() + (to - cz0) * planeSize,
+                  values.begin() + (from - z0) * planeSize);
+    }
+    applyExceptions(z0, z1, values);
+    return true;
+}
+
+bool PackedCube::readAll(std::vector<double>& values, int threads) const {
+    size_t nx = n[0], ny = n[1], nz = n[2], nv = nval;
+    values.assign(nx * ny * nz * nv, 0.0);
+    std::atomic<bool> ok(true);
+
+    forEachItem(chunkOffsets.size() - 1, threads, [&](size_t c) {
+        std::vector<double> planes;
+        if (!decodeChunk(c, planes)) {
+            ok = false;
+            return;
+        }
+        // Chunk order is z, x, y; cube order is x, y, z
+        size_t z0 = c * planesPerChunk;
+        size_t planesHere = planes.size() / (nx * ny * nv);
+        const double* src = planes.data();
+        for (size_t z = 0; z < planesHere; z++) {
+            for (size_t x = 0; x < nx; x++) {
+                for (size_t y = 0; y < ny; y++) {
+                    double* dst = values.data() + ((x * ny + y) * nz + z0 + z) * nv;
+                    for (size_t v = 0; v < nv; v++) {
+                        dst[v] = *src++;
+                    }
+                }
+            }
+        }
+    });
+    if (!ok) {
+        error = "corrupt chunk data in packed cube";
+        return false;
+    }
+    for (const auto& e : exceptions) {
+        values[e.first] = e.second;
+    }
+    return true;
+}
+
+bool packCube(const std::string& cubePath, const std::string& packedPath, double maxError,
+              int threads, std::string& error) {
+    CubeFile cube;
+    if (!cube.load(cubePath, threads)) {
+        error = cube.getError();
+        return false;
+    }
+    const std::vector<double>& values = cube.getValues();
+    const std::string& header = cube.getHeader();
+    size_t nx = cube.getNx(), ny = cube.getNy(), nz = cube.getNz(), nv = cube.getValuesPerPoint();
+    bool quantized = maxError > 0;
+    double step = quantized ? 2 * maxError : 0;
+
+    // Lossless mode: the text must be exactly what formatting the values gives back
+    if (!quantized) {
+        MappedFile original;
+        if (!original.open(cubePath)) {
+            error = "cannot open cube file " + cubePath;
+            return false;
+        }
+        size_t rowLen = nz * nv;
+        size_t rowBytes = rowLen * 13 + (rowLen + 5) / 6;
+        size_t rows = nx * ny;
+        if (original.size() != header.size() + rows * rowBytes) {
+            error = cubePath + " is not in Multiwfn's cube layout; pack it with a maximum error instead";
+            return false;
+        }
+        std::atomic<bool> same(true);
+        size_t blocks = (rows + 255) / 256;
+        forEachItem(blocks, threads, [&](size_t b) {
+            std::string text;
+            for (size_t r = b * 256; r < std::min(rows, (b + 1) * 256) && same; r++) {
+                text.clear();
+                const double* v = values.data() + r * rowLen;
+                for (size_t i = 0; i < rowLen; i++) {
+                    formatCubeValue(v[i], text);
+                    if (i % 6 == 5 || i + 1 == rowLen) {
+                        text += '\n';
+                    }
+                }
+                if (memcmp(text.data(), original.data() + header.size() + r * rowBytes, rowBytes) != 0) {
+                    same = false;
+                }
+            }
+        });
+        if (!same) {
+            error = cubePath + " is not in Multiwfn's cube layout; pack it with a maximum error instead";
+            return false;
+        }
+    }
+
+    // Encode chunks of whole z-planes in parallel
+    size_t planeValues = nx * ny * nv;
+    size_t planesPerChunk = std::max<size_t>(1, kChunkTarget / (planeValues * sizeof(float)));
+    size_t chunkCount = (nz + planesPerChunk - 1) / planesPerChunk;
+    std::vector<std::string> chunks(chunkCount);
+    std::vector<std::vector<std::pair<uint64_t, double>>> chunkExceptions(chunkCount);
+
+    forEachItem(chunkCount, threads, [&](size_t c) {
+        std::string& out = chunks[c];
+        size_t z0 = c * planesPerChunk;
+        size_t z1 = std::min(nz, z0 + planesPerChunk);
+        out.reserve((z1 - z0) * planeValues * (quantized ? 2 : sizeof(float)));
+        int64_t prev = 0;
+        for (size_t z = z0; z < z1; z++) {
+            for (size_t x = 0; x < nx; x++) {
+                for (size_t y = 0; y < ny; y++) {
+                    size_t base = ((x * ny + y) * nz + z) * nv;
+                    for (size_t v = 0; v < nv; v++) {
+                        double value = values[base + v];
+                        if (!quantized) {
+                            bool inRange = value == 0 || (std::fabs(value) >= FLT_MIN && std::fabs(value) <= FLT_MAX);
+                            if (!inRange) {
+                                chunkExceptions[c].emplace_back(base + v, value);
+                            }
+                            float f = inRange ? static_cast<float>(value) : 0.0f;
+                            out.append(reinterpret_cast<const char*>(&f), sizeof(f));
+                            continue;
+                        }
+                        double r = value / step;
+                        int64_t q = prev;
+                        if (std::isfinite(r) && std::fabs(r) < 4e18) {
+                            q = std::llround(r);
+                        } else {
+                            chunkExceptions[c].emplace_back(base + v, value);
+                        }
+                        int64_t delta = q - prev;
+                        putVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+                        prev = q;
+                    }
+                }
+            }
+        }
+    });
+
+    std::vector<std::pair<uint64_t, double>> exceptionList;
+    for (auto& part : chunkExceptions) {
+        exceptionList.insert(exceptionList.end(), part.begin(), part.end());
+    }
+    std::sort(exceptionList.begin(), exceptionList.end());
+
+    std::string head(kMagic, sizeof(kMagic));
+    put32(head, quantized ? 1 : 0);
+    put32(head, static_cast<uint32_t>(planesPerChunk));
+    put32(head, static_cast<uint32_t>(nx));
+    put32(head, static_cast<uint32_t>(ny));
+    put32(head, static_cast<uint32_t>(nz));
+    put32(head, static_cast<uint32_t>(nv));
+    putDouble(head, step);
+    put64(head, header.size());
+    put64(head, chunkCount);
+    put64(head, exceptionList.size());
+    head += header;
+
+    uint64_t offset = head.size() + (chunkCount + 1) * 8 + exceptionList.size() * 16;
+    for (size_t c = 0; c < chunkCount; c++) {
+        put64(head, offset);
+        offset += chunks[c].size();
+    }
+    put64(head, offset);
+    for (const auto& e : exceptionList) {
+        put64(head, e.first);
+        putDouble(head, e.second);
+    }
+
+    std::string tmp = packedPath + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) {
+        error = "cannot create " + tmp;
+        return false;
+    }
+    bool ok = fwrite(head.data(), 1, head.size(), out) == head.size();
+    for (size_t c = 0; c < chunkCount && ok; c++) {
+        ok = fwrite(chunks[c].data(), 1, chunks[c].size(), out) == chunks[c].size();
+    }
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp.c_str(), packedPath.c_str()) != 0) {
+        // Windows does not replace existing files on rename
+        remove(packedPath.c_str());
+        ok = rename(tmp.c_str(), packedPath.c_str()) == 0;
+    }
+    if (!ok) {
+        remove(tmp.c_str());
+        error = "cannot write " + packedPath;
+    }
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef CUBEPACK_H
+#define CUBEPACK_H
+#include "mmapfile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Packed binary cube (.bcub). The text header is stored verbatim, followed by an
+// index of chunks of whole z-planes, so any z-slab can be decoded from the mapping
+// without touching the rest of the file. Values are stored either as float32
+// (lossless for Multiwfn's 6 significant digits; values outside the float range
+// are kept exactly in an exception list) or quantized to a given absolute error.
+class PackedCube {
+public:
+    // Map the file and read its index
+    bool open(const std::string& path);
+
+    const std::string& getError() const { return error; }
+    const std::string& getHeader() const { return header; }
+    int getNx() const { return n[0]; }
+    int getNy() const { return n[1]; }
+    int getNz() const { return n[2]; }
+    int getValuesPerPoint() const { return nval; }
+    bool isQuantized() const { return encoding == 1; }
+    double getMaxError() const { return step / 2; }
+
+    // Decode planes [z0, z1) into `values`, ordered z, then x, then y (nval values per point)
+    bool readSlab(int z0, int z1, std::vector<double>& values) const;
+
+    // Decode the whole grid in cube file order (z fastest), chunks on several threads
+    bool readAll(std::vector<double>& values, int threads = 0) const;
+
+    // Whether a file starts with the packed cube signature
+    static bool isPackedFile(const std::string& path);
+
+private:
+    bool decodeChunk(size_t chunk, std::vector<double>& planes) const;
+    void applyExceptions(int z0, int z1, std::vector<double>& planes) const;
+
+    MappedFile file;
+    mutable std::string error;  // Also set by the const decoders
+    std::string header;
+    int n[3] = {0, 0, 0};
+    int nval = 1;
+    uint32_t encoding = 0;  // 0 = float32, 1 = quantized
+    uint32_t planesPerChunk = 1;
+    double step = 0;        // Quantization step
+    std::vector<uint64_t> chunkOffsets;  // chunkCount + 1 absolute offsets
+    std::vector<std::pair<uint64_t, double>> exceptions;  // (index in cube file order, exact value)
+};
+
+// Pack a text cube. maxError <= 0 selects lossless float32 storage, which requires the
+// cube to be in Multiwfn's layout (E13.5, 6 per line) so that unpacking reproduces it byte for byte.
+bool packCube(const std::string& cubePath, const std::string& packedPath, double maxError,
+              int threads, std::string& error);
+
+#endif // CUBEPACK_H
@@ -0,0 +1,332 @@
+#include "extract.h"
+#include "mmapfile.h"
+#include "utils.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+// Longest run of literal text that every match of the pattern must contain.
+// Conservative: alternations give up, and groups/classes/quantified atoms end a run.
+std::string requiredLiteral(const std::string& pattern) {
+    std::string best, run;
+    int depth = 0;
+    bool lastWasLiteral = false;
+
+    auto endRun = [&]() {
+        if (run.size() > best.size()) {
+            best = run;
+        }
+        run.clear();
+        lastWasLiteral = false;
+    };
+
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            char next = pattern[++i];
+            if (std::isalnum(static_cast<unsigned char>(next))) {
+                endRun();  // \d, \s, \b, back-references, ...
+            } else if (depth == 0) {
+                run += next;
+                lastWasLiteral = true;
+            }
+            continue;
+        }
+        switch (c) {
+        case '|':
+            return "";
+        case '(':
+            depth++;
+            endRun();
+            break;
+        case ')':
+            depth--;
+            endRun();
+            break;
+        case '[':
+            // Skip the character class
+            for (i++; i < pattern.size() && pattern[i] != ']'; i++) {
+                if (pattern[i] == '\\') {
+                    i++;
+                }
+            }
+            endRun();
+            break;
+        case '*':
+        case '?':
+        case '{':
+            // The preceding atom may be absent
+            if (lastWasLiteral && !run.empty()) {
+                run.pop_back();
+            }
+            if (c == '{') {
+                while (i < pattern.size() && pattern[i] != '}') {
+                    i++;
+                }
+            }
+            endRun();
+            break;
+        case '+':
+            endRun();
+            break;
+        case '.':
+        case '^':
+        case '$':
+            endRun();
+            break;
+        default:
+            if (depth == 0) {
+                run += c;
+                lastWasLiteral = true;
+            } else {
+                endRun();
+            }
+            break;
+        }
+    }
+    endRun();
+    return best;
+}
+
+bool isJsonNumber(const std::string& s) {
+    size_t i = 0;
+    if (i < s.size() && s[i] == '-') i++;
+    size_t digits = i;
+    while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) i++;
+    if (i == digits) return false;
+    if (i < s.size() && s[i] == '.') {
+        size_t frac = ++i;
+        while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) i++;
+        if (i == frac) return false;
+    }
+    if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < s.size() && (s[i] == '+' || s[i] == '-')) i++;
+        size_t exp = i;
+        while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) i++;
+        if (i == exp) return false;
+    }
+    return i == s.size();
+}
+
+std::string csvField(const std::string& s) {
+    if (s.find_first_of(",\"\r\n") == std::string::npos) {
+        return s;
+    }
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+bool compileExtractRules(const std::vector<std::pair<std::string, std::string>>& source,
+                         std::vector<ExtractRule>& rules, std::string& error) {
+    rules.clear();
+    for (const auto& entry : source) {
+        ExtractRule rule;
+        rule.column = entry.first;
+        if (rule.column.size() > 2 && rule.column.compare(rule.column.size() - 2, 2, "[]") == 0) {
+            rule.repeated = true;
+            rule.column.resize(rule.column.size() - 2);
+        }
+        try {
+            rule.pattern = std::regex(entry.second, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            error = "invalid pattern for " + entry.first + ": " + e.what();
+            return false;
+        }
+        rule.literal = requiredLiteral(entry.second);
+        rules.push_back(std::move(rule));
+    }
+    return true;
+}
+
+ExtractSink::ExtractSink(const std::vector<const ExtractRule*>& rules)
+    : rules(rules), matches(rules.size()) {
+    for (const ExtractRule* rule : rules) {
+        if (rule->repeated) {
+            repeatedRules++;
+        } else {
+            pendingSingles++;
+        }
+    }
+}
+
+void ExtractSink::write(const char* data, size_t len) {
+    const char* end = data + len;
+    const char* start = data;
+    while (start < end) {
+        const char* nl = static_cast<const char*>(memchr(start, '\n', end - start));
+        if (!nl) {
+            partial.append(start, end - start);
+            return;
+        }
+        if (partial.empty()) {
+            scanLine(start, nl);
+        } else {
+            partial.append(start, nl - start);
+            scanLine(partial.data(), partial.data() + partial.size());
+            partial.clear();
+        }
+        start = nl + 1;
+    }
+}
+
+void ExtractSink::close() {
+    if (!partial.empty()) {
+        scanLine(partial.data(), partial.data() + partial.size());
+        partial.clear();
+    }
+}
+
+bool ExtractSink::scanFile(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    write(file.data(), file.size());
+    close();
+    return true;
+}
+
+void ExtractSink::scanLine(const char* begin, const char* end) {
+    if (pendingSingles == 0 && repeatedRules == 0) {
+        return;
+    }
+    if (end > begin && end[-1] == '\r') {
+        end--;
+    }
+    std::string_view line(begin, end - begin);
+    std::cmatch m;
+    for (size_t i = 0; i < rules.size(); i++) {
+        const ExtractRule& rule = *rules[i];
+        if (!rule.repeated && !matches[i].empty()) {
+            continue;
+        }
+        if (!rule.literal.empty() && line.find(rule.literal) == std::string_view::npos) {
+            continue;
+        }
+        if (!std::regex_search(begin, end, m, rule.pattern)) {
+            continue;
+        }
+        matches[i].push_back(m.size() > 1 ? m[1].str() : m[0].str());
+        if (!rule.repeated) {
+            pendingSingles--;
+        }
+    }
+}
+
+ResultRow ExtractSink::values() const {
+    ResultRow row;
+    for (size_t i = 0; i < rules.size(); i++) {
+        const ExtractRule& rule = *rules[i];
+        if (!rule.repeated) {
+            row.emplace_back(rule.column, matches[i].empty() ? "" : matches[i][0]);
+            continue;
+        }
+        for (size_t j = 0; j < matches[i].size(); j++) {
+            row.emplace_back(rule.column + "_" + std::to_string(j + 1), matches[i][j]);
+        }
+    }
+    return row;
+}
+
+bool ResultTable::open(const std::string& tablePath) {
+    path = tablePath;
+    std::string lower = path;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    jsonLines = (lower.size() >= 5 && lower.compare(lower.size() - 5, 5, ".json") == 0) ||
+                (lower.size() >= 6 && lower.compare(lower.size() - 6, 6, ".jsonl") == 0);
+
+    out.open(path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Error: Cannot create result table: " << path << std::endl;
+        return false;
+    }
+    opened = true;
+    return true;
+}
+
+void ResultTable::addRow(const ResultRow& row) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!opened) {
+        return;
+    }
+    if (!jsonLines) {
+        rows.push_back(row);
+        return;
+    }
+
+    std::string line = "{";
+    for (size_t i = 0; i < row.size(); i++) {
+        if (i > 0) {
+            line += ",";
+        }
+        line += Utils::jsonString(row[i].first) + ":";
+        line += isJsonNumber(row[i].second) ? row[i].second : Utils::jsonString(row[i].second);
+    }
+    line += "}\n";
+    out << line;
+    out.flush();
+}
+
+bool ResultTable::finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!opened) {
+        return true;
+    }
+    opened = false;
+
+    if (!jsonLines) {
+        // Columns in order of first appearance
+        std::vector<std::string> columns;
+        for (const auto& row : rows) {
+            for (const auto& cell : row) {
+                if (std::find(columns.begin(), columns.end(), cell.first) == columns.end()) {
+                    columns.push_back(cell.first);
+                }
+            }
+        }
+
+        std::string text;
+        for (size_t i = 0; i < columns.size(); i++) {
+            text += (i > 0 ? "," : "") + csvField(columns[i]);
+        }
+        text += "\n";
+        for (const auto& row : rows) {
+            for (size_t i = 0; i < columns.size(); i++) {
+                if (i > 0) {
+                    text += ",";
+                }
+                for (const auto& cell : row) {
+                    if (cell.first == columns[i]) {
+                        text += csvField(cell.second);
+                        break;
+                    }
+                }
+            }
+            text += "\n";
+        }
+        out << text;
+        rows.clear();
+    }
+
+    out.close();
+    if (out.fail()) {
+        std::cerr << "Error: Failed to write result table: " << path << std::endl;
+        return false;
+    }
+    std::cout << "Result table written to: " << path << std::endl;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+#include "process.h"
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Ordered column -> value pairs of one extracted result
+using ResultRow = std::vector<std::pair<std::string, std::string>>;
+
+// One compiled rule of a conf [extract] section:
+//   name = regex     first match (capture group 1, or the whole match)
+//   name[] = regex   every match, as columns name_1, name_2, ...
+struct ExtractRule {
+    std::string column;
+    bool repeated = false;
+    std::regex pattern;
+    std::string literal;  // Text every match contains, used to skip lines without running the regex
+};
+
+// Compile the [extract] rules of a module; returns false and sets error on an invalid rule
+bool compileExtractRules(const std::vector<std::pair<std::string, std::string>>& source,
+                         std::vector<ExtractRule>& rules, std::string& error);
+
+// Applies extraction rules line by line to output as it is produced
+class ExtractSink : public OutputSink {
+public:
+    explicit ExtractSink(const std::vector<const ExtractRule*>& rules);
+
+    void write(const char* data, size_t len) override;
+    void close() override;
+
+    // Feed a complete log file (used when a result is restored from the cache)
+    bool scanFile(const std::string& path);
+
+    // Extracted values, in rule order
+    ResultRow values() const;
+
+private:
+    void scanLine(const char* begin, const char* end);
+
+    std::vector<const ExtractRule*> rules;
+    std::vector<std::vector<std::string>> matches;  // Per rule
+    size_t pendingSingles = 0;  // Single-value rules that have not matched yet
+    size_t repeatedRules = 0;
+    std::string partial;  // Unterminated last line
+};
+
+// Batch table of extracted results. JSON lines (.json/.jsonl) are appended as rows arrive;
+// CSV needs the union of all columns for its header and is written by finish().
+class ResultTable {
+public:
+    bool open(const std::string& path);
+    bool isOpen() const { return opened; }
+
+    // Thread-safe
+    void addRow(const ResultRow& row);
+
+    bool finish();
+
+private:
+    std::mutex mutex;
+    std::string path;
+    bool opened = false;
+    bool jsonLines = false;
+    std::ofstream out;
+    std::vector<ResultRow> rows;  // CSV mode only
+};
+
+#endif // EXTRACT_H
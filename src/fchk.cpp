@@ -0,0 +1,380 @@
+#include "fchk.h"
+#include "utils.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// Values per data line for each record type (I: 6I12, R: 5E16.8, C: 5A12, L: 72L1)
+long long valuesPerLine(char type) {
+    switch (type) {
+        case 'I': return 6;
+        case 'R': return 5;
+        case 'C': return 5;
+        case 'L': return 72;
+        default:  return 5;
+    }
+}
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parse one token into a value; tokens are copied so that parsing never reads past the mapping
+bool parseToken(const char* begin, const char* end, long long& out) {
+    char buf[64];
+    size_t len = static_cast<size_t>(end - begin);
+    if (len == 0 || len >= sizeof(buf)) return false;
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    char* stop = nullptr;
+    out = std::strtoll(buf, &stop, 10);
+    return *stop == '\0';
+}
+
+bool parseToken(const char* begin, const char* end, double& out) {
+    char buf[64];
+    size_t len = static_cast<size_t>(end - begin);
+    if (len == 0 || len >= sizeof(buf)) return false;
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    // Fortran may write exponents as 'D'
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == 'D' || buf[i] == 'd') buf[i] = 'E';
+    }
+    char* stop = nullptr;
+    out = std::strtod(buf, &stop);
+    return *stop == '\0';
+}
+
+} // namespace
+
+bool FchkHeader::scan(const std::string& path) {
+    *this = FchkHeader();
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+
+    struct Field {
+        const char* name;
+        long long* value;
+    };
+    const Field fields[] = {
+        {"Number of atoms", &natoms},
+        {"Charge", &charge},
+        {"Multiplicity", &multiplicity},
+        {"Number of electrons", &electrons},
+        {"Number of alpha electrons", &alpha},
+        {"Number of beta electrons", &beta},
+        {"Number of basis functions", &nbasis},
+        {"Number of independent functions", &nmo},
+    };
+    const size_t fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    const char* data = file.data();
+    size_t size = file.size();
+    size_t pos = 0;
+    size_t found = 0;
+    int lineNo = 0;
+    long long skipLines = 0;  // Data lines of the last array header
+    while (pos < size && found < fieldCount) {
+        const void* nl = memchr(data + pos, '\n', size - pos);
+        size_t end = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) : size;
+        std::string line(data + pos, end - pos);
+        pos = end + 1;
+        lineNo++;
+        if (lineNo == 2) {
+            // Job type, method and basis set: "SP        UB3LYP      6-31G(d)"
+            std::istringstream words(line);
+            std::string type, method;
+            words >> type >> method;
+            openShell = method.compare(0, 1, "U") == 0 || method.compare(0, 2, "RO") == 0;
+            continue;
+        }
+        if (skipLines > 0) {
+            skipLines--;
+            continue;
+        }
+        if (lineNo == 1 || line.size() < 44) {
+            continue;
+        }
+        std::string name = Utils::trim(line.substr(0, 40));
+        if (name == "Atomic numbers") {
+            break;  // The per-atom arrays follow the header scalars
+        }
+        std::string rest = Utils::trim(line.substr(40));
+        char type = rest.empty() ? '?' : rest[0];
+        rest = Utils::trim(rest.substr(rest.empty() ? 0 : 1));
+        if (rest.compare(0, 2, "N=") == 0) {
+            // Short arrays (Info1-9, title, route) sit among the scalars
+            long long count = std::atoll(rest.c_str() + 2);
+            skipLines = (count + valuesPerLine(type) - 1) / valuesPerLine(type);
+            continue;
+        }
+        if (type != 'I') {
+            continue;
+        }
+        for (const auto& field : fields) {
+            if (name == field.name && parseToken(rest.data(), rest.data() + rest.size(), *field.value)) {
+                found++;
+                break;
+            }
+        }
+    }
+
+    if (nmo <= 0) {
+        nmo = nbasis;
+    }
+    if (multiplicity > 1) {
+        openShell = true;
+    }
+    return natoms > 0 && nbasis > 0;
+}
+
+double FchkHeader::cost() const {
+    return static_cast<double>(nbasis) * static_cast<double>(nbasis) * static_cast<double>(natoms);
+}
+
+std::map<std::string, std::string> FchkHeader::variables() const {
+    return {
+        {"natoms", std::to_string(natoms)},
+        {"nbasis", std::to_string(nbasis)},
+        {"nmo", std::to_string(nmo)},
+        {"nelec", std::to_string(electrons)},
+        {"nalpha", std::to_string(alpha)},
+        {"nbeta", std::to_string(beta)},
+        {"charge", std::to_string(charge)},
+        {"mult", std::to_string(multiplicity)},
+        {"homo", std::to_string(alpha)},
+        {"lumo", std::to_string(alpha + 1)},
+        {"shell", openShell ? "open" : "closed"},
+    };
+}
+
+bool FchkHeader::isVariable(const std::string& name) {
+    static const char* const names[] = {"natoms", "nbasis", "nmo", "nelec", "nalpha", "nbeta",
+                                        "charge", "mult", "homo", "lumo", "shell"};
+    for (const char* known : names) {
+        if (name == known) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FchkFile::isFchkFile(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == "fchk" || ext == "fch";
+}
+
+bool FchkFile::open(const std::string& path) {
+    records.clear();
+    recordIndex.clear();
+    title.clear();
+    error.clear();
+
+    if (!file.open(path)) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    const char* data = file.data();
+    size_t size = file.size();
+    size_t pos = 0;
+    int lineNo = 0;
+
+    auto nextLine = [&](size_t& begin, size_t& end) -> bool {
+        if (pos >= size) return false;
+        begin = pos;
+        const void* nl = memchr(data + pos, '\n', size - pos);
+        end = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) : size;
+        pos = nl ? end + 1 : size;
+        return true;
+    };
+
+    size_t lineBegin, lineEnd;
+    while (nextLine(lineBegin, lineEnd)) {
+        lineNo++;
+        std::string line(data + lineBegin, lineEnd - lineBegin);
+        if (lineNo == 1) {
+            title = Utils::trim(line);
+            continue;
+        }
+        if (lineNo == 2 || Utils::trim(line).empty()) {
+            continue;
+        }
+
+        // Record header: name in columns 1-40, then type and value or "N=" count
+        if (line.size() < 44) {
+            error = "malformed record header at line " + std::to_string(lineNo);
+            return false;
+        }
+        FchkRecord rec;
+        rec.name = Utils::trim(line.substr(0, 40));
+        std::string rest = Utils::trim(line.substr(40));
+        rec.type = rest.empty() ? '?' : rest[0];
+        rest = Utils::trim(rest.substr(1));
+        rec.isArray = rest.compare(0, 2, "N=") == 0;
+        rec.count = 0;
+        rec.dataBegin = rec.dataEnd = 0;
+
+        if (rec.isArray) {
+            rec.count = std::atoll(rest.c_str() + 2);
+            long long lines = (rec.count + valuesPerLine(rec.type) - 1) / valuesPerLine(rec.type);
+            rec.dataBegin = pos;
+            for (long long i = 0; i < lines; i++) {
+                size_t b, e;
+                if (!nextLine(b, e)) {
+                    error = "truncated array \"" + rec.name + "\"";
+                    return false;
+                }
+                lineNo++;
+            }
+            rec.dataEnd = pos;
+        } else {
+            rec.value = rest;
+        }
+
+        recordIndex[rec.name] = records.size();
+        records.push_back(rec);
+    }
+
+    return true;
+}
+
+const FchkRecord* FchkFile::findRecord(const std::string& name) const {
+    auto it = recordIndex.find(name);
+    return it == recordIndex.end() ? nullptr : &records[it->second];
+}
+
+bool FchkFile::getInt(const std::string& name, long long& value) const {
+    const FchkRecord* rec = findRecord(name);
+    if (!rec || rec->isArray) return false;
+    return parseToken(rec->value.data(), rec->value.data() + rec->value.size(), value);
+}
+
+bool FchkFile::getReal(const std::string& name, double& value) const {
+    const FchkRecord* rec = findRecord(name);
+    if (!rec || rec->isArray) return false;
+    return parseToken(rec->value.data(), rec->value.data() + rec->value.size(), value);
+}
+
+template <typename T>
+bool FchkFile::decodeArray(const FchkRecord& rec, std::vector<T>& values, int threads) const {
+    values.clear();
+    const char* data = file.data();
+    size_t begin = rec.dataBegin;
+    size_t end = rec.dataEnd;
+
+    // Small arrays are not worth a thread
+    const size_t minChunk = 1 << 20;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads < 1 ? 1 : threads, (end - begin) / minChunk));
+
+    // Chunk boundaries are moved forward to whitespace so that no token is split
+    std::vector<size_t> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    bounds[chunkCount] = end;
+    for (size_t c = 1; c < chunkCount; c++) {
+        size_t b = begin + (end - begin) * c / chunkCount;
+        while (b < end && !isSpace(data[b])) b++;
+        bounds[c] = std::max(b, bounds[c - 1]);
+    }
+
+    std::vector<std::vector<T>> parts(chunkCount);
+    std::vector<char> ok(chunkCount, 1);
+    auto decode = [&](size_t c) {
+        std::vector<T>& out = parts[c];
+        out.reserve((bounds[c + 1] - bounds[c]) / 12 + 1);
+        size_t p = bounds[c];
+        size_t stop = bounds[c + 1];
+        while (p < stop) {
+            while (p < stop && isSpace(data[p])) p++;
+            if (p >= stop) break;
+            size_t q = p;
+            while (q < stop && !isSpace(data[q])) q++;
+            T v;
+            if (!parseToken(data + p, data + q, v)) {
+                ok[c] = 0;
+                return;
+            }
+            out.push_back(v);
+            p = q;
+        }
+    };
+
+    if (chunkCount == 1) {
+        decode(0);
+    } else {
+        std::vector<std::thread> pool;
+        for (size_t c = 0; c < chunkCount; c++) {
+            pool.emplace_back(decode, c);
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+    }
+
+    size_t total = 0;
+    for (size_t c = 0; c < chunkCount; c++) {
+        if (!ok[c]) return false;
+        total += parts[c].size();
+    }
+    values.reserve(total);
+    for (auto& part : parts) {
+        values.insert(values.end(), part.begin(), part.end());
+    }
+    return static_cast<long long>(values.size()) == rec.count;
+}
+
+bool FchkFile::readIntArray(const std::string& name, std::vector<long long>& values, int threads) const {
+    const FchkRecord* rec = findRecord(name);
+    if (!rec || !rec->isArray || rec->type != 'I') return false;
+    return decodeArray(*rec, values, threads);
+}
+
+bool FchkFile::readRealArray(const std::string& name, std::vector<double>& values, int threads) const {
+    const FchkRecord* rec = findRecord(name);
+    if (!rec || !rec->isArray || rec->type != 'R') return false;
+    return decodeArray(*rec, values, threads);
+}
+
+bool FchkFile::validate(std::string& message, int threads) const {
+    long long natoms = 0, nbasis = 0;
+    if (!getInt("Number of atoms", natoms) || natoms <= 0) {
+        message = "missing \"Number of atoms\"";
+        return false;
+    }
+    if (!getInt("Number of basis functions", nbasis) || nbasis <= 0) {
+        message = "missing \"Number of basis functions\"";
+        return false;
+    }
+
+    // The MO coefficient arrays are by far the largest; decode them fully to catch corruption
+    static const char* const required[] = {"Current cartesian coordinates", "Alpha MO coefficients"};
+    for (const char* name : required) {
+        std::vector<double> values;
+        if (!readRealArray(name, values, threads)) {
+            message = std::string("incomplete array \"") + name + "\"";
+            return false;
+        }
+    }
+    if (findRecord("Beta MO coefficients")) {
+        std::vector<double> values;
+        if (!readRealArray("Beta MO coefficients", values, threads)) {
+            message = "incomplete array \"Beta MO coefficients\"";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef FCHK_H
+#define FCHK_H
+#include "mmapfile.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// One record of a Gaussian formatted checkpoint file
+struct FchkRecord {
+    std::string name;
+    char type;          // 'I', 'R', 'C' or 'L'
+    bool isArray;
+    long long count;    // Number of values (arrays only)
+    std::string value;  // Scalar value text (scalars only)
+    size_t dataBegin;   // Byte range of the array data lines
+    size_t dataEnd;
+};
+
+// Scalars from the header of a .fchk file (the records before the per-atom arrays). Only the
+// first pages of the file are read, so scanning a whole batch is cheap.
+struct FchkHeader {
+    long long natoms = 0;
+    long long nbasis = 0;
+    long long nmo = 0;  // Number of independent functions: orbitals per spin
+    long long electrons = 0;
+    long long alpha = 0;
+    long long beta = 0;
+    long long charge = 0;
+    long long multiplicity = 0;
+    bool openShell = false;  // Unrestricted or restricted open-shell wavefunction
+
+    // Read the header; returns false if the file cannot be read or has no atoms/basis functions
+    bool scan(const std::string& path);
+
+    // Relative cost of loading the wavefunction (grows like nbasis^2 * natoms)
+    double cost() const;
+
+    // Header values as placeholders: natoms, nbasis, nmo, nelec, nalpha, nbeta, charge, mult,
+    // homo, lumo (alpha orbital indices), shell (open/closed)
+    std::map<std::string, std::string> variables() const;
+    static bool isVariable(const std::string& name);
+};
+
+// Native .fchk reader: maps the file, indexes all records in one pass and
+// decodes large numeric arrays on several threads
+class FchkFile {
+public:
+    // Map and index the file; returns false if it cannot be read or is truncated
+    bool open(const std::string& path);
+
+    const std::string& getTitle() const { return title; }
+    const std::string& getError() const { return error; }
+    const std::vector<FchkRecord>& getRecords() const { return records; }
+    const FchkRecord* findRecord(const std::string& name) const;
+
+    // Scalar accessors; return false if the record is missing or not a scalar
+    bool getInt(const std::string& name, long long& value) const;
+    bool getReal(const std::string& name, double& value) const;
+
+    // Array decoders; the data is split into chunks parsed concurrently
+    bool readIntArray(const std::string& name, std::vector<long long>& values, int threads = 0) const;
+    bool readRealArray(const std::string& name, std::vector<double>& values, int threads = 0) const;
+
+    // Check that the wavefunction records are present and complete
+    bool validate(std::string& message, int threads = 0) const;
+
+    uint64_t contentHash(int threads = 0) const { return file.contentHash(threads); }
+
+    // Whether a file name looks like a formatted checkpoint (.fchk/.fch)
+    static bool isFchkFile(const std::string& path);
+
+private:
+    MappedFile file;
+    std::string title;
+    std::string error;
+    std::vector<FchkRecord> records;
+    std::map<std::string, size_t> recordIndex;
+
+    template <typename T>
+    bool decodeArray(const FchkRecord& rec, std::vector<T>& values, int threads) const;
+};
+
+#endif // FCHK_H
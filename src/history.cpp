@@ -0,0 +1,201 @@
+#include "history.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+// Line format (tab separated):
+//   time module block steps grid nbasis natoms cores wall cpu rss_kb exit file
+namespace {
+
+const size_t kFieldCount = 13;
+
+// Tabs and line breaks would break the line format
+std::string clean(const std::string& text) {
+    std::string out = text;
+    for (char& c : out) {
+        if (c == '\t' || c == '\n' || c == '\r') {
+            c = ' ';
+        }
+    }
+    return out;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+double recordSize(const HistoryRecord& record) {
+    return static_cast<double>(record.nbasis) * static_cast<double>(record.nbasis) *
+           static_cast<double>(record.natoms);
+}
+
+} // namespace
+
+bool TimingHistory::append(const HistoryRecord& record) {
+    char numbers[160];
+    snprintf(numbers, sizeof(numbers), "%lld\t%lld\t%d\t%.3f\t%.3f\t%lld\t%d", record.nbasis, record.natoms,
+             record.cores, record.wall, record.cpu, record.peakRssKb, record.exitCode);
+    std::string line = std::to_string(record.time) + "\t" + clean(record.module) + "\t" +
+                       std::to_string(record.block) + "\t" + clean(record.steps) + "\t" + clean(record.grid) +
+                       "\t" + numbers + "\t" + clean(record.wfnFile) + "\n";
+
+    // Concurrent jobs of this process take turns; other processes rely on the append mode
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream out(file, std::ios::app | std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    out.write(line.data(), static_cast<std::streamsize>(line.size()));
+    out.close();
+    return !out.fail();
+}
+
+bool TimingHistory::load(std::vector<HistoryRecord>& records) const {
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields = Utils::split(line, '\t');
+        if (fields.size() != kFieldCount) {
+            continue;  // Partial line of an interrupted write
+        }
+        HistoryRecord record;
+        record.time = std::atoll(fields[0].c_str());
+        record.module = fields[1];
+        record.block = std::atoi(fields[2].c_str());
+        record.steps = fields[3];
+        record.grid = fields[4];
+        record.nbasis = std::atoll(fields[5].c_str());
+        record.natoms = std::atoll(fields[6].c_str());
+        record.cores = std::atoi(fields[7].c_str());
+        record.wall = std::atof(fields[8].c_str());
+        record.cpu = std::atof(fields[9].c_str());
+        record.peakRssKb = std::atoll(fields[10].c_str());
+        record.exitCode = std::atoi(fields[11].c_str());
+        record.wfnFile = fields[12];
+        if (!record.module.empty()) {
+            records.push_back(record);
+        }
+    }
+    return true;
+}
+
+void TimingHistory::printReport(const std::vector<HistoryRecord>& records) {
+    struct Group {
+        std::vector<double> wall;
+        std::vector<double> cpu;
+        long long peakRssKb = 0;
+        size_t failed = 0;
+    };
+    // Module rows sort before their step lists ("" < any step list)
+    std::map<std::pair<std::string, std::string>, Group> groups;
+    for (const auto& record : records) {
+        for (const std::string& steps : {std::string(), record.steps.empty() ? std::string("-") : record.steps}) {
+            Group& group = groups[{record.module, steps}];
+            if (record.exitCode != 0) {
+                group.failed++;
+                continue;
+            }
+            group.wall.push_back(record.wall);
+            group.cpu.push_back(record.cpu);
+            group.peakRssKb = std::max(group.peakRssKb, record.peakRssKb);
+        }
+    }
+
+    std::cout << std::left << std::setw(20) << "Module" << " " << std::setw(24) << "Section" << std::right
+              << std::setw(7) << "Runs" << std::setw(7) << "Failed" << std::setw(11) << "p50 (s)"
+              << std::setw(11) << "p95 (s)" << std::setw(11) << "CPU p50" << std::setw(11) << "RSS (MB)" << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto& entry : groups) {
+        Group& group = entry.second;
+        std::string section = entry.first.second.empty() ? "(all)" : entry.first.second;
+        std::cout << std::left << std::setw(20) << entry.first.first << " " << std::setw(24) << section
+                  << std::right << std::setw(7) << group.wall.size() << std::setw(7) << group.failed;
+        if (group.wall.empty()) {
+            std::cout << std::setw(11) << "-" << std::setw(11) << "-" << std::setw(11) << "-" << std::setw(11) << "-\n";
+            continue;
+        }
+        std::sort(group.wall.begin(), group.wall.end());
+        std::sort(group.cpu.begin(), group.cpu.end());
+        std::cout << std::setw(11) << percentile(group.wall, 0.5) << std::setw(11) << percentile(group.wall, 0.95)
+                  << std::setw(11) << percentile(group.cpu, 0.5) << std::setw(11) << group.peakRssKb / 1024.0 << "\n";
+    }
+    std::cout << std::defaultfloat << std::flush;
+}
+
+void CostModel::fit(const std::vector<HistoryRecord>& records) {
+    struct Samples {
+        std::vector<double> wall;
+        std::vector<std::pair<double, double>> sized;  // (log size, log wall)
+    };
+    std::map<std::string, Samples> samples;
+    for (const auto& record : records) {
+        if (record.exitCode != 0 || record.wall <= 0) {
+            continue;
+        }
+        double size = recordSize(record);
+        for (const std::string& key : {record.module, record.module + "\t" + record.steps}) {
+            Samples& s = samples[key];
+            s.wall.push_back(record.wall);
+            if (size > 0) {
+                s.sized.push_back({std::log(size), std::log(record.wall)});
+            }
+        }
+    }
+
+    fits.clear();
+    for (auto& entry : samples) {
+        Samples& s = entry.second;
+        Fit fit;
+        std::sort(s.wall.begin(), s.wall.end());
+        fit.median = percentile(s.wall, 0.5);
+        if (s.sized.size() >= 2) {
+            double n = static_cast<double>(s.sized.size());
+            double sx = 0, sy = 0, sxx = 0, sxy = 0;
+            for (const auto& p : s.sized) {
+                sx += p.first;
+                sy += p.second;
+                sxx += p.first * p.first;
+                sxy += p.first * p.second;
+            }
+            double var = sxx - sx * sx / n;
+            if (var > 1e-9) {
+                // Noise can give nonsense slopes; runs never get faster with size, nor beyond cubic
+                fit.exponent = std::min(3.0, std::max(0.0, (sxy - sx * sy / n) / var));
+                fit.logScale = (sy - fit.exponent * sx) / n;
+                fit.sized = true;
+            }
+        }
+        fits[entry.first] = fit;
+    }
+}
+
+bool CostModel::predict(const std::string& module, const std::string& steps, long long nbasis, long long natoms,
+                        double& seconds) const {
+    auto it = fits.find(module + "\t" + steps);
+    if (it == fits.end()) {
+        it = fits.find(module);
+    }
+    if (it == fits.end()) {
+        return false;
+    }
+    double size = static_cast<double>(nbasis) * static_cast<double>(nbasis) * static_cast<double>(natoms);
+    if (it->second.sized && size > 0) {
+        seconds = std::exp(it->second.logScale + it->second.exponent * std::log(size));
+    } else {
+        seconds = it->second.median;
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One finished Multiwfn run
+struct HistoryRecord {
+    long long time = 0;  // Unix time at completion
+    std::string module;  // Module name ("a+b" for a fused group)
+    int block = 0;  // Block index among the blocks of the module
+    std::string steps;  // Post-processing steps, comma separated
+    std::string grid;  // Grid parameters as key=value, semicolon separated
+    long long nbasis = 0;  // From the .fchk header (0 for other formats)
+    long long natoms = 0;
+    int cores = 0;
+    double wall = 0;  // Seconds
+    double cpu = 0;  // User + system seconds of Multiwfn
+    long long peakRssKb = 0;
+    int exitCode = 0;
+    std::string wfnFile;
+};
+
+// Append-only timing history of Multiwfn runs (banewfn.rc: history=). One tab-separated line
+// per run, written in one piece, so several banewfn processes can share the file.
+class TimingHistory {
+public:
+    void setFile(const std::string& path) { file = path; }
+    const std::string& getFile() const { return file; }
+    bool isEnabled() const { return !file.empty(); }
+
+    bool append(const HistoryRecord& record);
+    // Read every well-formed record; false if the file cannot be opened
+    bool load(std::vector<HistoryRecord>& records) const;
+
+    // Table of p50/p95 wall times per module and per module + step list
+    static void printReport(const std::vector<HistoryRecord>& records);
+
+private:
+    std::string file;
+    std::mutex mutex;
+};
+
+// Wall time predictions fitted on the history. For each module (and each module + step list)
+// the successful runs are fitted as wall = a * size^b with size = nbasis^2 * natoms (least
+// squares in log space); with fewer than two sizes, or for non-.fchk files, the median is used.
+class CostModel {
+public:
+    void fit(const std::vector<HistoryRecord>& records);
+    bool empty() const { return fits.empty(); }
+
+    // Predicted seconds of a run; false if the module has no successful history
+    bool predict(const std::string& module, const std::string& steps, long long nbasis, long long natoms,
+                 double& seconds) const;
+
+private:
+    struct Fit {
+        double median = 0;
+        bool sized = false;
+        double logScale = 0;
+        double exponent = 0;
+    };
+    std::map<std::string, Fit> fits;  // By "module" and by "module\tsteps"
+};
+
+#endif // HISTORY_H
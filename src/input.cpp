@@ -1,9 +1,10 @@
 #include "input.h"
 #include "config.h"
+#include "mmapfile.h"
+#include "plan.h"
 #include "utils.h"
+#include <cctype>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 
 // Utility function: split string (deprecated - use Utils::split instead)
 std::vector<std::string> InputParser::split(const std::string& str, char delimiter) {
@@ -14,79 +15,13 @@ std::vector<std::string> InputParser::split(const std::string& str, char delimit
 // Additionally, support ${name} -> read value from file "name" in current directory (trimmed)
 // Also support custom variables from command line or file header
 std::string InputParser::replaceInputPlaceholders(const std::string& text, const std::string& wfnFile, const std::map<std::string, std::string>& customVars) {
-    std::string result = text;
-    
-    // Extract filename without extension from wavefunction file path
-    std::string wfnBaseName = getBaseName(wfnFile);
-    
-    size_t pos = 0;
-    while ((pos = result.find('$', pos)) != std::string::npos) {
-        size_t endPos = pos + 1;
-        std::string varName;
-        bool usedBraces = false;
-        
-        // Check for ${input} syntax
-        if (endPos < result.length() && result[endPos] == '{') {
-            size_t braceStart = endPos + 1;
-            size_t braceEnd = result.find('}', braceStart);
-            if (braceEnd != std::string::npos) {
-                varName = result.substr(braceStart, braceEnd - braceStart);
-                endPos = braceEnd + 1;
-                usedBraces = true;
-            } else {
-                // No closing brace found, treat as regular $variable
-                while (endPos < result.length() && 
-                       (isalnum(result[endPos]) || result[endPos] == '_')) {
-                    endPos++;
-                }
-                varName = result.substr(pos + 1, endPos - pos - 1);
-            }
-        } else {
-            // Regular $variable syntax
-            while (endPos < result.length() && 
-                   (isalnum(result[endPos]) || result[endPos] == '_')) {
-                endPos++;
-            }
-            varName = result.substr(pos + 1, endPos - pos - 1);
-        }
-        
-        std::string replacement;
-        bool found = false;
-        
-        // Priority 1: Check custom variables from command line or file header
-        auto customIt = customVars.find(varName);
-        if (customIt != customVars.end()) {
-            replacement = customIt->second;
-            found = true;
-        }
-        // Priority 2: Check if the variable name is "input"
-        else if (varName == "input") {
-            replacement = wfnBaseName;
-            found = true;
-        }
-        // Priority 3: For ${name} (braced) and name != input, attempt file-based replacement
-        else if (usedBraces) {
-            // Read file named exactly as varName from current working directory
-            if (Utils::fileExists(varName)) {
-                std::ifstream f(varName);
-                if (f.good()) {
-                    std::stringstream buffer;
-                    buffer << f.rdbuf();
-                    replacement = Utils::trim(buffer.str());
-                    found = true;
-                }
-            }
-        }
-        
-        if (found) {
-            result.replace(pos, endPos - pos, replacement);
-            pos += replacement.length();
-        } else {
-            // If no replacement found, skip this placeholder
-            pos = endPos;
-        }
+    if (text.find('$') == std::string::npos) {
+        return text;
     }
-    
+    NamePool pool;
+    PlaceholderText compiled = PlaceholderText::compile(text, pool);
+    std::string result;
+    compiled.render(PlaceholderValues(pool, wfnFile, customVars), result);
     return result;
 }
 
@@ -109,145 +44,223 @@ void InputParser::applyPlaceholderReplacement(std::vector<ModuleTask>& tasks, co
         for (auto& command : task.commands) {
             command = replaceInputPlaceholders(command, wfnFile, customVars);
         }
+        for (auto& op : task.cubeOps) {
+            op = replaceInputPlaceholders(op, wfnFile, customVars);
+        }
+        for (auto& dep : task.after) {
+            dep = replaceInputPlaceholders(dep, wfnFile, customVars);
+        }
     }
 }
 
-// Parse inp file, return all module tasks, optional wfn file, core count, and custom variables
-std::tuple<std::vector<ModuleTask>, std::string, int, std::map<std::string, std::string>> InputParser::parseInpFileWithWfnAndCoresAndVars(const std::string& inpFile) {
-    std::vector<ModuleTask> tasks;
-    std::string wfnFile;
-    int cores = -1;  // -1 means not specified
-    std::map<std::string, std::string> customVars;
-    std::ifstream file(inpFile);
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open inp file: " << inpFile << std::endl;
-        return {tasks, wfnFile, cores, customVars};
+namespace {
+
+std::string_view trimView(std::string_view str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos) return std::string_view();
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, last - first + 1);
+}
+
+bool startsWith(std::string_view str, std::string_view prefix) {
+    return str.substr(0, prefix.size()) == prefix;
+}
+
+// Same result as Utils::removeInlineComment(); the line is only copied into `buffer` when
+// it contains an escaped \#
+std::string_view stripComment(std::string_view line, std::string& buffer) {
+    bool inSingleQuote = false;
+    bool inDoubleQuote = false;
+    bool copied = false;
+    size_t end = line.size();
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (!inSingleQuote && !inDoubleQuote && c == '\\' && i + 1 < line.size() && line[i + 1] == '#') {
+            if (!copied) {
+                buffer.assign(line.data(), i);
+                copied = true;
+            }
+            buffer.push_back('#');
+            ++i;
+            continue;
+        }
+        if (!inDoubleQuote && c == '\'') {
+            inSingleQuote = !inSingleQuote;
+        } else if (!inSingleQuote && c == '"') {
+            inDoubleQuote = !inDoubleQuote;
+        } else if (!inSingleQuote && !inDoubleQuote && c == '#') {
+            end = i;
+            break;
+        }
+        if (copied) {
+            buffer.push_back(c);
+        }
     }
-    
-    std::string line;
+    return trimView(copied ? std::string_view(buffer) : line.substr(0, end));
+}
+
+// Same tokens as Utils::split(): empty fields are kept except a trailing one
+void splitView(std::string_view str, char delimiter, std::vector<std::string_view>& tokens) {
+    tokens.clear();
+    size_t start = 0;
+    while (start < str.size()) {
+        size_t end = str.find(delimiter, start);
+        if (end == std::string_view::npos) {
+            end = str.size();
+        }
+        tokens.push_back(trimView(str.substr(start, end - start)));
+        start = end + 1;
+    }
+}
+
+bool isVariableName(std::string_view name) {
+    for (char c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            return false;
+        }
+    }
+    return !name.empty();
+}
+
+} // namespace
+
+// Parse inp text line by line without copying it; only stored values become strings
+void InputParser::parseInpText(std::string_view text, std::vector<ModuleTask>& tasks, std::string& wfnFile,
+                               int& cores, std::map<std::string, std::string>& customVars) {
     ModuleTask currentTask;
     bool inProcessMode = false;
     bool inCommandMode = false;
+    bool inCubeMode = false;
     std::map<std::string, int> moduleBlockCounters;  // Track block indices for each module name
+    std::string buffer;
+    std::vector<std::string_view> tokens;
+    std::vector<std::string_view> deps;
     
-    while (std::getline(file, line)) {
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos) {
+            lineEnd = text.size();
+        }
+        std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+#ifdef PLATFORM_WINDOWS
+        // The text-mode stream this replaces dropped the CR of CRLF line ends
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+#endif
         // 保留前导空白用于模块行"顶格"判断
-        std::string noComment = Utils::removeInlineComment(line);
-        std::string trimmed = Utils::trim(noComment);
-
-        // In command mode, check for special keywords first (before storing raw line)
-        // Special keywords still need to be detected even in command mode
-        bool isSpecialKeyword = false;
+        std::string_view noComment = stripComment(line, buffer);
+        std::string_view trimmed = noComment;
         
         // Enter command mode
         if (trimmed == "%command") {
-            isSpecialKeyword = true;
             // Allow top-level %command without module definition ("裸command")
-            if (currentTask.moduleName.empty()) {
+            if (currentTask.moduleName.empty() && currentTask.cubeOps.empty()) {
                 currentTask = ModuleTask();
                 currentTask.useWait = false;
                 currentTask.blockIndex = moduleBlockCounters[currentTask.moduleName]++;
             }
             inCommandMode = true;
+            inCubeMode = false;
+            inProcessMode = false;
+            continue;
+        }
+        
+        // Enter cube arithmetic mode (like %command, allowed without module definition)
+        if (trimmed == "%cube") {
+            if (currentTask.moduleName.empty() && currentTask.commands.empty() && currentTask.cubeOps.empty()) {
+                currentTask = ModuleTask();
+                currentTask.useWait = false;
+                currentTask.blockIndex = moduleBlockCounters[currentTask.moduleName]++;
+            }
+            inCubeMode = true;
+            inCommandMode = false;
             inProcessMode = false;
             continue;
         }
         
         // End current module with "end"
         if (trimmed == "end") {
-            isSpecialKeyword = true;
-            if (!currentTask.moduleName.empty() || !currentTask.commands.empty()) {
-                tasks.push_back(currentTask);
+            if (!currentTask.moduleName.empty() || !currentTask.commands.empty() || !currentTask.cubeOps.empty()) {
+                tasks.push_back(std::move(currentTask));
                 currentTask = ModuleTask();
             }
             inProcessMode = false;
             inCommandMode = false;
+            inCubeMode = false;
             continue;
         }
         
         // End current module with "wait" (interactive mode)
         if (trimmed == "wait") {
-            isSpecialKeyword = true;
             if (!currentTask.moduleName.empty()) {
                 currentTask.useWait = true;
-                tasks.push_back(currentTask);
+                tasks.push_back(std::move(currentTask));
                 currentTask = ModuleTask();
             }
             inProcessMode = false;
             inCommandMode = false;
+            inCubeMode = false;
             continue;
         }
         
-        // In command mode, store raw line (including comments and empty lines) if not special keyword
-        if (inCommandMode && !isSpecialKeyword) {
-            // Command mode: store the entire raw line as a command (preserve comments and empty lines)
-            currentTask.commands.push_back(line);
+        // Command mode: store the entire raw line as a command (preserve comments and empty lines)
+        if (inCommandMode) {
+            currentTask.commands.emplace_back(line);
             continue;
         }
 
         // For non-command mode, skip empty lines
         if (trimmed.empty()) continue;
+        
+        // Cube mode: one "<out> = <op> <operands>" statement per line
+        if (inCubeMode && trimmed != "%process") {
+            currentTask.cubeOps.emplace_back(trimmed);
+            continue;
+        }
 
         // Check for wfn=xx format at the beginning of file
-        if (trimmed.find("wfn=") == 0 && currentTask.moduleName.empty()) {
-            wfnFile = Utils::trim(trimmed.substr(4));
+        if (startsWith(trimmed, "wfn=") && currentTask.moduleName.empty()) {
+            wfnFile = std::string(trimView(trimmed.substr(4)));
             continue;
         }
         
         // Check for core=xx format at the beginning of file
-        if (trimmed.find("core=") == 0 && currentTask.moduleName.empty()) {
-            std::string coreStr = Utils::trim(trimmed.substr(5));
-            cores = std::atoi(coreStr.c_str());
+        if (startsWith(trimmed, "core=") && currentTask.moduleName.empty()) {
+            cores = std::atoi(std::string(trimView(trimmed.substr(5))).c_str());
             continue;
         }
         
         // Check for key=value format at the beginning of file (custom variables)
         // This should come before module definitions, so check if no module is active
-        if (currentTask.moduleName.empty() && !inProcessMode && !inCommandMode) {
+        if (currentTask.moduleName.empty() && !inProcessMode) {
             size_t eqPos = trimmed.find('=');
-            // Only treat as variable if:
-            // 1. Contains exactly one '='
-            // 2. Key is not empty
-            // 3. Key contains only alphanumeric and underscore (valid variable name)
-            // 4. Not a special keyword (wfn, core)
-            if (eqPos != std::string::npos && eqPos > 0 && eqPos < trimmed.length() - 1) {
-                std::string key = Utils::trim(trimmed.substr(0, eqPos));
-                std::string value = Utils::trim(trimmed.substr(eqPos + 1));
-                
-                // Validate key name (alphanumeric and underscore only)
-                bool validKey = true;
-                for (char c : key) {
-                    if (!isalnum(c) && c != '_') {
-                        validKey = false;
-                        break;
-                    }
-                }
-                
-                // Only accept if key is valid and not a special keyword
-                if (validKey && !key.empty() && key != "wfn" && key != "core") {
-                    customVars[key] = value;
+            // Only treat as variable if the key is a valid name (alphanumeric and underscore),
+            // the value is not empty and the key is not a special keyword (wfn, core)
+            if (eqPos != std::string_view::npos && eqPos > 0 && eqPos < trimmed.length() - 1) {
+                std::string_view key = trimView(trimmed.substr(0, eqPos));
+                if (isVariableName(key) && key != "wfn" && key != "core") {
+                    customVars[std::string(key)] = std::string(trimView(trimmed.substr(eqPos + 1)));
                     continue;
                 }
             }
         }
         
         // Module start [module_name] 必须顶格
-        if (!noComment.empty() && noComment[0] == '[') {
-            size_t lastNonWS = noComment.find_last_not_of(" \t\r\n");
-            if (lastNonWS != std::string::npos && noComment[lastNonWS] == ']') {
-                // If there is an unfinished task, save it
-                if (!currentTask.moduleName.empty() || !currentTask.commands.empty()) {
-                    tasks.push_back(currentTask);
-                }
-                currentTask = ModuleTask();
-                std::string inside = noComment.substr(1, lastNonWS - 1);
-                currentTask.moduleName = Utils::trim(inside);
-                currentTask.useWait = false;
-                currentTask.blockIndex = moduleBlockCounters[currentTask.moduleName]++;
-                inProcessMode = false;
-                inCommandMode = false;
-                continue;
+        if (noComment[0] == '[' && noComment.back() == ']') {
+            // If there is an unfinished task, save it
+            if (!currentTask.moduleName.empty() || !currentTask.commands.empty() || !currentTask.cubeOps.empty()) {
+                tasks.push_back(std::move(currentTask));
             }
+            currentTask = ModuleTask();
+            currentTask.moduleName = std::string(trimView(noComment.substr(1, noComment.size() - 2)));
+            currentTask.useWait = false;
+            currentTask.blockIndex = moduleBlockCounters[currentTask.moduleName]++;
+            inProcessMode = false;
+            inCubeMode = false;
+            continue;
         }
         
         // Enter post-processing mode
@@ -257,50 +270,61 @@ std::tuple<std::vector<ModuleTask>, std::string, int, std::map<std::string, std:
                 continue;
             }
             inProcessMode = true;
-            inCommandMode = false;
+            inCubeMode = false;
             continue;
         }
         
-        // Parse parameters, post-processing commands, or shell commands
-        if (inCommandMode) {
-            // This should not be reached, as command mode lines are handled above
-            // But keep as fallback
-            currentTask.commands.push_back(line);
-        } else {
-            std::vector<std::string> tokens = split(trimmed, ' ');
-            if (tokens.empty()) continue;
-            
-            if (!inProcessMode) {
-                // Pre-processing parameter setting mode
-                if (tokens.size() >= 2) {
-                    // Store parameter value (placeholder replacement will be done later)
-                    currentTask.params[tokens[0]] = tokens[1];
-                }
-            } else {
-                // Post-processing command mode
-                std::string sectionName = tokens[0];
-                std::map<std::string, std::string> sectionParams;
-                
-                // Parse subsequent parameters
-                for (size_t i = 1; i < tokens.size(); i += 2) {
-                    if (i + 1 < tokens.size()) {
-                        // Store parameter value (placeholder replacement will be done later)
-                        sectionParams[tokens[i]] = tokens[i + 1];
+        // Parse parameters or post-processing commands
+        splitView(trimmed, ' ', tokens);
+        
+        if (!inProcessMode) {
+            // Scheduling attributes: name=<id> and after=<id>[,<id>...]
+            if (tokens.size() == 1 && startsWith(tokens[0], "name=")) {
+                currentTask.name = std::string(tokens[0].substr(5));
+                continue;
+            }
+            if (tokens.size() == 1 && startsWith(tokens[0], "after=")) {
+                splitView(tokens[0].substr(6), ',', deps);
+                for (const auto& dep : deps) {
+                    if (!dep.empty()) {
+                        currentTask.after.emplace_back(dep);
                     }
                 }
-                
-                currentTask.postProcessSteps.push_back({sectionName, sectionParams});
+                continue;
+            }
+            // Pre-processing parameter setting mode (placeholders are resolved per wavefunction)
+            if (tokens.size() >= 2) {
+                currentTask.params[std::string(tokens[0])] = std::string(tokens[1]);
+            }
+        } else {
+            // Post-processing command mode
+            std::map<std::string, std::string> sectionParams;
+            for (size_t i = 1; i + 1 < tokens.size(); i += 2) {
+                sectionParams[std::string(tokens[i])] = std::string(tokens[i + 1]);
             }
+            currentTask.postProcessSteps.push_back({std::string(tokens[0]), std::move(sectionParams)});
         }
     }
     
     // Save the last task (module or command-only)
-    if (!currentTask.moduleName.empty() || !currentTask.commands.empty()) {
-        tasks.push_back(currentTask);
+    if (!currentTask.moduleName.empty() || !currentTask.commands.empty() || !currentTask.cubeOps.empty()) {
+        tasks.push_back(std::move(currentTask));
     }
-    
-    file.close();
-    return {tasks, wfnFile, cores, customVars};
+}
+
+// Parse inp file, return all module tasks, optional wfn file, core count, and custom variables
+std::tuple<std::vector<ModuleTask>, std::string, int, std::map<std::string, std::string>> InputParser::parseInpFileWithWfnAndCoresAndVars(const std::string& inpFile) {
+    std::vector<ModuleTask> tasks;
+    std::string wfnFile;
+    int cores = -1;  // -1 means not specified
+    std::map<std::string, std::string> customVars;
+    MappedFile file;
+    if (!file.open(inpFile)) {
+        std::cerr << "Error: Cannot open inp file: " << inpFile << std::endl;
+        return {tasks, wfnFile, cores, customVars};
+    }
+    parseInpText(std::string_view(file.data(), file.size()), tasks, wfnFile, cores, customVars);
+    return {std::move(tasks), wfnFile, cores, customVars};
 }
 
 // Parse inp file, return all module tasks, optional wfn file, and core count (backward compatibility)
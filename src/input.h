@@ -2,6 +2,7 @@
 #define INPUT_H
 #include <string>
 #include <map>
+#include <string_view>
 #include <vector>
 
 // Single module task information
@@ -10,18 +11,38 @@ struct ModuleTask {
     std::map<std::string, std::string> params;
     std::vector<std::pair<std::string, std::map<std::string, std::string>>> postProcessSteps;
     std::vector<std::string> commands;  // Commands from %command block
+    std::vector<std::string> cubeOps;  // Cube arithmetic statements from %cube block
     bool useWait;  // Whether to use wait mode (interactive mode)
     std::string wfnFile;  // Wavefunction file path (optional, from input file header)
     int blockIndex;  // Unique index for blocks with same module name
+    std::string name;  // Block name from name=... (referenced by after=)
+    std::vector<std::string> after;  // Dependencies from after=...: block names, module names or output files
+    std::string workDir;  // Working directory of the block (empty = current directory)
 };
 
 // Execution options
 struct ExecutionOptions {
     bool dryrun;
     bool screen;
+    bool tee;  // Write output files and mirror them on screen
+    bool fuse;  // Run consecutive module blocks in one Multiwfn session
+    bool wfnCache;  // Use the .mwfn pre-conversion cache (if configured in banewfn.rc)
+    bool resultCache;  // Use the Multiwfn result cache (if configured in banewfn.rc)
+    bool scratch;  // Run Multiwfn in scratch directories (if configured in banewfn.rc)
+    int jobs;  // Number of wavefunction files processed concurrently
+    int blocks;  // Number of independent blocks of one file run concurrently (>1 = dependency scheduling)
+    std::string table;  // Result table collecting [extract] values (empty = none)
+    bool packCubes;  // Pack declared cube outputs into .bcub files
+    double packError;  // Quantization error for packing (0 = lossless float32)
+    std::string emitPlan;  // Write the resolved plan to this file instead of running it (empty = run)
+    std::string enqueue;  // Queue the jobs in this directory for --worker processes instead of running them
+    int leaseSeconds;  // Lease of a claimed queue job without a heartbeat
+    int settleSeconds;  // --watch: time a new file's size and mtime must stay unchanged
+    bool sharedDirectory;  // --worker: other processes write to the working directory too (no result recording)
+    bool ownProcessGroup;  // --watch: start children in their own process group, so Ctrl+C only stops the watch
     std::map<std::string, std::string> customVars;  // Custom variables from command line
     
-    ExecutionOptions() : dryrun(false), screen(false) {}
+    ExecutionOptions() : dryrun(false), screen(false), tee(false), fuse(false), wfnCache(true), resultCache(true), scratch(true), jobs(1), blocks(1), packCubes(false), packError(0), leaseSeconds(60), settleSeconds(2), sharedDirectory(false), ownProcessGroup(false) {}
 };
 
 // Input parser class
@@ -35,15 +56,19 @@ public:
     static std::tuple<std::vector<ModuleTask>, std::string, int> parseInpFileWithWfnAndCores(const std::string& inpFile);
     // Parse inp file, return all module tasks, optional wfn file, core count, and custom variables
     static std::tuple<std::vector<ModuleTask>, std::string, int, std::map<std::string, std::string>> parseInpFileWithWfnAndCoresAndVars(const std::string& inpFile);
+    // Parse the text of an inp file (placeholders are left unresolved)
+    static void parseInpText(std::string_view text, std::vector<ModuleTask>& tasks, std::string& wfnFile,
+                             int& cores, std::map<std::string, std::string>& customVars);
     // Apply placeholder replacement to all tasks using wavefunction filename and custom variables
     static void applyPlaceholderReplacement(std::vector<ModuleTask>& tasks, const std::string& wfnFile, const std::map<std::string, std::string>& customVars = std::map<std::string, std::string>());
+    // Replace input file placeholders ($input and ${input}) with wavefunction filename without extension
+    // Also support custom variables from command line or file header
+    // and the header values of a .fchk wavefunction (${natoms}, ${nbasis}, ${homo}, ...)
+    static std::string replaceInputPlaceholders(const std::string& text, const std::string& wfnFile, const std::map<std::string, std::string>& customVars = std::map<std::string, std::string>());
     
 private:
     // Utility function: split string
     static std::vector<std::string> split(const std::string& str, char delimiter);
-    // Replace input file placeholders ($input and ${input}) with wavefunction filename without extension
-    // Also support custom variables from command line or file header
-    static std::string replaceInputPlaceholders(const std::string& text, const std::string& wfnFile, const std::map<std::string, std::string>& customVars = std::map<std::string, std::string>());
 };
 
 #endif // INPUT_H
@@ -0,0 +1,117 @@
+#include "mmapfile.h"
+#include "config.h"
+#include "utils.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef PLATFORM_LINUX
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+        void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            madvise(addr, length, MADV_SEQUENTIAL);
+            ptr = static_cast<const char*>(addr);
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (length > 0 && !mapped) {
+        length = 0;
+        return false;
+    }
+    opened = true;
+    return true;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    buffer = ss.str();
+    ptr = buffer.data();
+    length = buffer.size();
+    opened = true;
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifdef PLATFORM_LINUX
+    if (mapped) {
+        munmap(const_cast<char*>(ptr), length);
+    }
+#endif
+    buffer.clear();
+    ptr = nullptr;
+    length = 0;
+    opened = false;
+    mapped = false;
+}
+
+uint64_t MappedFile::contentHash(int threads) const {
+    const size_t chunkSize = 4 << 20;
+    size_t chunkCount = (length + chunkSize - 1) / chunkSize;
+    std::vector<uint64_t> chunkHashes(chunkCount, 0);
+
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    size_t workerCount = static_cast<size_t>(threads < 1 ? 1 : threads);
+    if (workerCount > chunkCount) {
+        workerCount = chunkCount;
+    }
+
+    auto hashRange = [&](size_t worker) {
+        for (size_t c = worker; c < chunkCount; c += workerCount) {
+            size_t begin = c * chunkSize;
+            size_t len = (begin + chunkSize > length) ? length - begin : chunkSize;
+            chunkHashes[c] = Utils::fnv1a64(ptr + begin, len);
+        }
+    };
+
+    if (workerCount <= 1) {
+        hashRange(0);
+    } else {
+        std::vector<std::thread> pool;
+        for (size_t w = 0; w < workerCount; w++) {
+            pool.emplace_back(hashRange, w);
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+    }
+
+    // Combine chunk hashes together with the total length
+    uint64_t len64 = static_cast<uint64_t>(length);
+    uint64_t h = Utils::fnv1a64(reinterpret_cast<const char*>(&len64), sizeof(len64));
+    if (!chunkHashes.empty()) {
+        h = Utils::fnv1a64(reinterpret_cast<const char*>(chunkHashes.data()),
+                           chunkHashes.size() * sizeof(uint64_t), h);
+    }
+    return h;
+}
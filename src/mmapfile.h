@@ -0,0 +1,35 @@
+#ifndef MMAPFILE_H
+#define MMAPFILE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory-mapped file (falls back to reading into memory on Windows)
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map the whole file; returns false if it cannot be opened
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return opened; }
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+    // Content hash of the whole file, computed in fixed-size chunks on several threads.
+    // The result does not depend on the thread count.
+    uint64_t contentHash(int threads = 0) const;
+
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+    bool opened = false;
+    bool mapped = false;
+    std::string buffer;  // Fallback storage when mmap is unavailable
+};
+
+#endif // MMAPFILE_H
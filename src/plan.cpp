@@ -0,0 +1,378 @@
+#include "plan.h"
+#include "config.h"
+#include "fchk.h"
+#include "mmapfile.h"
+#include "utils.h"
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+uint32_t NamePool::intern(std::string_view name, bool isBraced) {
+    auto it = ids.find(std::string(name));
+    if (it != ids.end()) {
+        if (isBraced) {
+            braced[it->second] = true;
+        }
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(names.size());
+    names.emplace_back(name);
+    braced.push_back(isBraced);
+    ids.emplace(names.back(), id);
+    return id;
+}
+
+PlaceholderValues::PlaceholderValues(const NamePool& pool, const std::string& wfnFile,
+                                     const std::map<std::string, std::string>& customVars)
+    : values(pool.size()), plain(pool.size(), 0), inBraces(pool.size(), 0) {
+    std::string wfnBaseName = getBaseName(wfnFile);
+    
+    // The .fchk header is only scanned when the text uses one of its variables
+    std::map<std::string, std::string> header;
+    if (FchkFile::isFchkFile(wfnFile)) {
+        for (uint32_t id = 0; id < pool.size(); id++) {
+            if (pool.usedBraced(id) && FchkHeader::isVariable(pool.getName(id)) && !customVars.count(pool.getName(id))) {
+                FchkHeader fchk;
+                if (fchk.scan(wfnFile)) {
+                    header = fchk.variables();
+                }
+                break;
+            }
+        }
+    }
+    
+    for (uint32_t id = 0; id < pool.size(); id++) {
+        const std::string& name = pool.getName(id);
+        auto it = customVars.find(name);
+        auto meta = header.find(name);
+        if (it != customVars.end()) {
+            values[id] = it->second;
+            plain[id] = inBraces[id] = 1;
+        } else if (name == "input") {
+            values[id] = wfnBaseName;
+            plain[id] = inBraces[id] = 1;
+        } else if (meta != header.end()) {
+            // ${name} only: $charge, $mult, ... in a %command script are the shell's own variables
+            values[id] = meta->second;
+            inBraces[id] = 1;
+        } else if (pool.usedBraced(id) && Utils::fileExists(name)) {
+            // ${name}: read the file named exactly as the variable from the current directory
+            std::ifstream f(name);
+            if (f.good()) {
+                std::stringstream buffer;
+                buffer << f.rdbuf();
+                values[id] = Utils::trim(buffer.str());
+                inBraces[id] = 1;
+            }
+        }
+    }
+}
+
+const std::string* PlaceholderValues::get(uint32_t id, bool braced) const {
+    return (braced ? inBraces[id] : plain[id]) ? &values[id] : nullptr;
+}
+
+PlaceholderText PlaceholderText::compile(std::string_view text, NamePool& pool) {
+    PlaceholderText result;
+    result.text = std::string(text);
+    size_t pos = 0;
+    while ((pos = text.find('$', pos)) != std::string_view::npos) {
+        size_t endPos = pos + 1;
+        size_t nameStart = pos + 1;
+        bool braced = false;
+        size_t braceEnd = std::string_view::npos;
+        if (endPos < text.size() && text[endPos] == '{') {
+            braceEnd = text.find('}', endPos + 1);
+        }
+        if (braceEnd != std::string_view::npos) {
+            // ${name}
+            nameStart = endPos + 1;
+            endPos = braceEnd;
+            braced = true;
+        } else {
+            // $name, or ${ without a closing brace (which names nothing)
+            while (endPos < text.size() && (isalnum(static_cast<unsigned char>(text[endPos])) || text[endPos] == '_')) {
+                endPos++;
+            }
+        }
+        uint32_t id = pool.intern(text.substr(nameStart, endPos - nameStart), braced);
+        if (braced) {
+            endPos++;
+        }
+        result.slots.push_back({pos, endPos - pos, id, braced});
+        pos = endPos;
+    }
+    return result;
+}
+
+void PlaceholderText::render(const PlaceholderValues& values, std::string& out) const {
+    size_t last = 0;
+    for (const auto& slot : slots) {
+        out.append(text, last, slot.at - last);
+        const std::string* value = values.get(slot.name, slot.braced);
+        if (value) {
+            out += *value;
+        } else {
+            out.append(text, slot.at, slot.length);
+        }
+        last = slot.at + slot.length;
+    }
+    out.append(text, last, std::string::npos);
+}
+
+bool ExecutionPlan::load(const std::string& path) {
+    inpFile = path;
+    MappedFile file;
+    if (!file.open(inpFile)) {
+        std::cerr << "Error: Cannot open inp file: " << inpFile << std::endl;
+        return false;
+    }
+    InputParser::parseInpText(std::string_view(file.data(), file.size()), blocks, wfnFile, cores, customVars);
+
+    firstField.assign(1, 0);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const ModuleTask& task = blocks[b];
+        for (const auto& param : task.params) {
+            addField(FieldKind::Param, 0, param.first, param.second);
+        }
+        for (size_t s = 0; s < task.postProcessSteps.size(); s++) {
+            for (const auto& param : task.postProcessSteps[s].second) {
+                addField(FieldKind::StepParam, s, param.first, param.second);
+            }
+        }
+        for (size_t i = 0; i < task.commands.size(); i++) {
+            addField(FieldKind::Command, i, "", task.commands[i]);
+        }
+        for (size_t i = 0; i < task.cubeOps.size(); i++) {
+            addField(FieldKind::CubeOp, i, "", task.cubeOps[i]);
+        }
+        for (size_t i = 0; i < task.after.size(); i++) {
+            addField(FieldKind::After, i, "", task.after[i]);
+        }
+        firstField.push_back(fields.size());
+    }
+    return true;
+}
+
+void ExecutionPlan::addField(FieldKind kind, size_t index, const std::string& key, const std::string& value) {
+    if (value.find('$') == std::string::npos) {
+        return;
+    }
+    fields.push_back({kind, index, key, PlaceholderText::compile(value, names)});
+}
+
+std::string& ExecutionPlan::fieldTarget(ModuleTask& task, const Field& field) {
+    switch (field.kind) {
+    case FieldKind::Param:
+        return task.params[field.key];
+    case FieldKind::StepParam:
+        return task.postProcessSteps[field.index].second[field.key];
+    case FieldKind::Command:
+        return task.commands[field.index];
+    case FieldKind::CubeOp:
+        return task.cubeOps[field.index];
+    case FieldKind::After:
+    default:
+        return task.after[field.index];
+    }
+}
+
+PlanInstance ExecutionPlan::instantiate(const std::string& wfn, const std::map<std::string, std::string>& vars) const {
+    PlanInstance instance;
+    PlaceholderValues values(names, wfn, vars);
+
+    size_t copies = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (firstField[b + 1] > firstField[b]) {
+            copies++;
+        }
+    }
+    // Reserved up front: tasks points into it
+    instance.resolved.reserve(copies);
+    instance.tasks.reserve(blocks.size());
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (firstField[b + 1] == firstField[b]) {
+            instance.tasks.push_back(&blocks[b]);
+            continue;
+        }
+        instance.resolved.push_back(blocks[b]);
+        ModuleTask& task = instance.resolved.back();
+        for (size_t f = firstField[b]; f < firstField[b + 1]; f++) {
+            std::string& target = fieldTarget(task, fields[f]);
+            target.clear();
+            fields[f].text.render(values, target);
+        }
+        instance.tasks.push_back(&task);
+    }
+    return instance;
+}
+
+namespace {
+
+const char kPlanMagic[] = "BANEWFN-PLAN";
+const int kPlanVersion = 1;
+
+void putRecord(std::string& out, const char* key, const std::string& value) {
+    out += key;
+    out += ' ';
+    out += std::to_string(value.size());
+    out += ':';
+    out += value;
+    out += '\n';
+}
+
+// Next record of a plan file; returns false at the end or on a malformed record
+bool nextRecord(std::string_view& text, std::string_view& key, std::string_view& value, std::string& error) {
+    size_t space = text.find(' ');
+    size_t colon = text.find(':');
+    if (space == std::string_view::npos || colon == std::string_view::npos || colon < space) {
+        error = "malformed record";
+        return false;
+    }
+    key = text.substr(0, space);
+    size_t length = 0;
+    for (size_t i = space + 1; i < colon; i++) {
+        if (!isdigit(static_cast<unsigned char>(text[i]))) {
+            error = "malformed length of record " + std::string(key);
+            return false;
+        }
+        length = length * 10 + static_cast<size_t>(text[i] - '0');
+    }
+    if (colon == space + 1 || length > text.size() - colon - 1 || colon + 1 + length >= text.size() ||
+        text[colon + 1 + length] != '\n') {
+        error = "truncated record " + std::string(key);
+        return false;
+    }
+    value = text.substr(colon + 1, length);
+    text.remove_prefix(colon + 2 + length);
+    return true;
+}
+
+bool parseCount(std::string_view value, int& out) {
+    if (value.empty() || value.size() > 9) {
+        return false;
+    }
+    out = 0;
+    for (char c : value) {
+        if (!isdigit(static_cast<unsigned char>(c))) {
+            return false;
+        }
+        out = out * 10 + (c - '0');
+    }
+    return true;
+}
+
+} // namespace
+
+bool ResolvedPlan::write(const std::string& path, std::string& error) const {
+    std::string out = std::string(kPlanMagic) + " " + std::to_string(kPlanVersion) + "\n";
+    putRecord(out, "multiwfn", multiwfnExec);
+    putRecord(out, "gitbash", gitbashExec);
+    putRecord(out, "jobs", std::to_string(jobs));
+    for (const auto& file : files) {
+        putRecord(out, "file", file.wfnFile);
+        for (const auto& block : file.blocks) {
+            putRecord(out, "block", block.module);
+            putRecord(out, "index", std::to_string(block.index));
+            putRecord(out, "cores", std::to_string(block.cores));
+            putRecord(out, "mode", block.interactive ? "wait" : "file");
+            putRecord(out, "script", block.script);
+            for (const auto& command : block.commands) {
+                putRecord(out, "command", command);
+            }
+            for (const auto& op : block.cubeOps) {
+                putRecord(out, "cube", op);
+            }
+            for (const auto& output : block.outputs) {
+                putRecord(out, "output", output);
+            }
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        error = "cannot create " + path;
+        return false;
+    }
+    file << out;
+    file.close();
+    if (file.fail()) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool ResolvedPlan::read(const std::string& path, std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string_view text(file.data(), file.size());
+    size_t lineEnd = text.find('\n');
+    std::string_view header = text.substr(0, lineEnd);
+    std::string magic = std::string(kPlanMagic) + " ";
+    if (lineEnd == std::string_view::npos || header.substr(0, magic.size()) != magic) {
+        error = path + " is not a banewfn plan";
+        return false;
+    }
+    if (header.substr(magic.size()) != std::to_string(kPlanVersion)) {
+        error = "unsupported plan version " + std::string(header.substr(magic.size())) + " in " + path;
+        return false;
+    }
+    text.remove_prefix(lineEnd + 1);
+
+    *this = ResolvedPlan();
+    std::string_view key, value;
+    while (!text.empty()) {
+        if (!nextRecord(text, key, value, error)) {
+            error += " in " + path;
+            return false;
+        }
+        ResolvedBlock* block = (!files.empty() && !files.back().blocks.empty()) ? &files.back().blocks.back() : nullptr;
+        bool ok = true;
+        if (key == "multiwfn") {
+            multiwfnExec = std::string(value);
+        } else if (key == "gitbash") {
+            gitbashExec = std::string(value);
+        } else if (key == "jobs") {
+            ok = parseCount(value, jobs);
+        } else if (key == "file") {
+            files.push_back({std::string(value), {}});
+        } else if (key == "block") {
+            ok = !files.empty();
+            if (ok) {
+                files.back().blocks.emplace_back();
+                files.back().blocks.back().module = std::string(value);
+            }
+        } else if (!block) {
+            ok = false;
+        } else if (key == "index") {
+            ok = parseCount(value, block->index);
+        } else if (key == "cores") {
+            ok = parseCount(value, block->cores);
+        } else if (key == "mode") {
+            ok = value == "file" || value == "wait";
+            block->interactive = value == "wait";
+        } else if (key == "script") {
+            block->script = std::string(value);
+        } else if (key == "command") {
+            block->commands.emplace_back(value);
+        } else if (key == "cube") {
+            block->cubeOps.emplace_back(value);
+        } else if (key == "output") {
+            block->outputs.emplace_back(value);
+        } else {
+            error = "unknown record " + std::string(key) + " in " + path;
+            return false;
+        }
+        if (!ok) {
+            error = "invalid record " + std::string(key) + " in " + path;
+            return false;
+        }
+    }
+    return true;
+}
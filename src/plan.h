@@ -0,0 +1,157 @@
+#ifndef PLAN_H
+#define PLAN_H
+#include "input.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Placeholder names of an inp file, interned so that each one is resolved once per wavefunction
+class NamePool {
+public:
+    uint32_t intern(std::string_view name, bool braced);
+    size_t size() const { return names.size(); }
+    const std::string& getName(uint32_t id) const { return names[id]; }
+    bool usedBraced(uint32_t id) const { return braced[id]; }
+
+private:
+    std::vector<std::string> names;
+    std::vector<bool> braced;  // Whether the name appears as ${name} (enables the file lookup)
+    std::unordered_map<std::string, uint32_t> ids;
+};
+
+// Values of the pooled names for one wavefunction. Priority: custom variables, then "input"
+// (wavefunction name without extension), then for ${name} only the header values of a .fchk
+// (natoms, nbasis, homo, ...; see FchkHeader) and the trimmed content of the file "name" in the
+// current directory.
+class PlaceholderValues {
+public:
+    PlaceholderValues(const NamePool& pool, const std::string& wfnFile,
+                      const std::map<std::string, std::string>& customVars);
+
+    // Replacement of a placeholder, or nullptr if it stays as written
+    const std::string* get(uint32_t id, bool braced) const;
+
+private:
+    std::vector<std::string> values;
+    std::vector<char> plain;   // Resolved as $name
+    std::vector<char> inBraces;  // Resolved as ${name}
+};
+
+// Text with the positions of its $name / ${name} placeholders located once
+class PlaceholderText {
+public:
+    static PlaceholderText compile(std::string_view text, NamePool& pool);
+
+    bool hasPlaceholders() const { return !slots.empty(); }
+
+    // Append the text with its placeholders replaced
+    void render(const PlaceholderValues& values, std::string& out) const;
+
+private:
+    struct Slot {
+        size_t at;
+        size_t length;
+        uint32_t name;
+        bool braced;
+    };
+    std::string text;
+    std::vector<Slot> slots;
+};
+
+class ExecutionPlan;
+
+// Blocks of an inp file for one wavefunction. Blocks without placeholders are the plan's own
+// objects; only the blocks that contain placeholders are copied and resolved.
+class PlanInstance {
+public:
+    PlanInstance(PlanInstance&&) = default;
+    PlanInstance& operator=(PlanInstance&&) = default;
+    PlanInstance(const PlanInstance&) = delete;
+    PlanInstance& operator=(const PlanInstance&) = delete;
+
+    const std::vector<const ModuleTask*>& getTasks() const { return tasks; }
+
+private:
+    friend class ExecutionPlan;
+    PlanInstance() = default;
+
+    std::vector<ModuleTask> resolved;
+    std::vector<const ModuleTask*> tasks;
+};
+
+// An inp file parsed once and shared by main() and every wavefunction of a batch. The blocks
+// keep their placeholders unresolved and are never modified; the fields that contain
+// placeholders are compiled at load time, so instantiating a wavefunction only renders those.
+class ExecutionPlan {
+public:
+    // Map and parse the inp file; returns false if it cannot be opened
+    bool load(const std::string& inpFile);
+
+    const std::string& getInpFile() const { return inpFile; }
+    const std::vector<ModuleTask>& getBlocks() const { return blocks; }
+    const std::string& getWfnFile() const { return wfnFile; }
+    int getCores() const { return cores; }
+    const std::map<std::string, std::string>& getVars() const { return customVars; }
+
+    // Blocks with the placeholders of one wavefunction resolved
+    PlanInstance instantiate(const std::string& wfn, const std::map<std::string, std::string>& vars) const;
+
+private:
+    enum class FieldKind { Param, StepParam, Command, CubeOp, After };
+    struct Field {
+        FieldKind kind;
+        size_t index;  // Step, command, cube statement or dependency index
+        std::string key;  // Parameter name
+        PlaceholderText text;
+    };
+
+    void addField(FieldKind kind, size_t index, const std::string& key, const std::string& value);
+    static std::string& fieldTarget(ModuleTask& task, const Field& field);
+
+    std::string inpFile;
+    std::vector<ModuleTask> blocks;
+    std::string wfnFile;
+    int cores = -1;
+    std::map<std::string, std::string> customVars;
+    NamePool names;
+    std::vector<Field> fields;  // Fields with placeholders, grouped by block
+    std::vector<size_t> firstField;  // Fields of block i: [firstField[i], firstField[i + 1])
+};
+
+// One block of a resolved plan, with everything needed to run it
+struct ResolvedBlock {
+    std::string module;  // Empty for bare %command/%cube blocks
+    int index = 0;  // Block index among the blocks of the same module
+    int cores = 0;
+    bool interactive = false;  // wait block: the script is fed, then stdin goes to the user
+    std::string script;  // Rendered Multiwfn stdin
+    std::vector<std::string> commands;  // %command lines
+    std::vector<std::string> cubeOps;  // %cube statements
+    std::vector<std::string> outputs;  // Files the block is expected to produce
+};
+
+struct ResolvedFile {
+    std::string wfnFile;
+    std::vector<ResolvedBlock> blocks;
+};
+
+// A batch with every wavefunction x block rendered (banewfn --emit-plan). Running it
+// (--run-plan) needs neither banewfn.rc nor the .inp nor any conf.
+// File format: the line "BANEWFN-PLAN <version>", then records "<key> <length>:<bytes>\n".
+// Header records: multiwfn, gitbash, jobs. "file" starts a wavefunction, "block" (the module
+// name) starts a block, followed by index, cores, mode (file|wait), script and any number of
+// command, cube and output records.
+struct ResolvedPlan {
+    std::string multiwfnExec;
+    std::string gitbashExec;
+    int jobs = 1;
+    std::vector<ResolvedFile> files;
+
+    bool write(const std::string& path, std::string& error) const;
+    bool read(const std::string& path, std::string& error);
+};
+
+#endif // PLAN_H
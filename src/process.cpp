@@ -0,0 +1,575 @@
+#include "process.h"
+#include "config.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace {
+
+// Our environment with the NAME=value entries of `extra` added; an entry replaces the
+// variable of the same name
+std::vector<std::string> mergeEnvironment(const std::vector<std::string>& extra) {
+    std::vector<std::string> merged;
+#ifdef PLATFORM_WINDOWS
+    char* block = GetEnvironmentStringsA();
+    for (const char* p = block; p && *p; p += strlen(p) + 1) {
+        merged.emplace_back(p);
+    }
+    if (block) FreeEnvironmentStringsA(block);
+#else
+    for (char** p = environ; *p; p++) {
+        merged.emplace_back(*p);
+    }
+#endif
+    for (const auto& entry : extra) {
+        std::string prefix = entry.substr(0, entry.find('=') + 1);
+        merged.erase(std::remove_if(merged.begin(), merged.end(), [&](const std::string& var) {
+            return var.compare(0, prefix.size(), prefix) == 0;
+        }), merged.end());
+        merged.push_back(entry);
+    }
+    return merged;
+}
+
+} // namespace
+
+std::vector<std::string> ProcessLauncher::environment(const std::vector<std::string>& extra) {
+    return mergeEnvironment(extra);
+}
+
+std::string ProcessLauncher::describe(const ProcessSpec& spec) {
+    std::stringstream ss;
+    for (const auto& entry : spec.env) {
+        ss << entry << " ";
+    }
+    for (size_t i = 0; i < spec.args.size(); i++) {
+        if (i > 0) ss << " ";
+        // Long inline scripts (bash -c) are summarized
+        if (spec.args[i].find('\n') != std::string::npos) {
+            ss << "<script>";
+        } else if (spec.args[i].find(' ') != std::string::npos) {
+            ss << "\"" << spec.args[i] << "\"";
+        } else {
+            ss << spec.args[i];
+        }
+    }
+    if (!spec.inheritStdin) {
+        size_t lines = 0;
+        for (char c : spec.input) {
+            if (c == '\n') lines++;
+        }
+        ss << " <<< (" << lines << " lines" << (spec.forwardStdin ? ", then terminal" : "") << ")";
+    }
+    if (!spec.outputFile.empty()) {
+        ss << " >> " << spec.outputFile;
+    }
+    if (!spec.workDir.empty()) {
+        ss << " (in " << spec.workDir << ")";
+    }
+    return ss.str();
+}
+
+ProcessResult ProcessLauncher::run(const ProcessSpec& spec) {
+    if (!Trace::enabled()) {
+        return launch(spec);
+    }
+    std::string program = spec.args.empty() ? "" : spec.args[0];
+    program = program.substr(program.find_last_of("/\\") + 1);
+    TraceSpan span("process", program);
+    span.arg("command", describe(spec));
+    ProcessResult result = launch(spec);
+    span.arg("exit_code", result.exitCode);
+    span.arg("user_s", result.userSeconds);
+    span.arg("sys_s", result.systemSeconds);
+    span.arg("max_rss_kb", static_cast<double>(result.peakRssKb));
+    span.arg("in_blocks", static_cast<double>(result.inputBlocks));
+    span.arg("out_blocks", static_cast<double>(result.outputBlocks));
+    span.arg("voluntary_cs", static_cast<double>(result.voluntarySwitches));
+    span.arg("involuntary_cs", static_cast<double>(result.involuntarySwitches));
+    return result;
+}
+
+#ifdef PLATFORM_WINDOWS
+
+ProcessResult ProcessLauncher::launch(const ProcessSpec& spec) {
+    ProcessResult result;
+    if (spec.args.empty()) {
+        result.error = "empty command";
+        return result;
+    }
+
+    // Build the command line, quoting arguments that contain spaces
+    std::string cmdLine;
+    for (size_t i = 0; i < spec.args.size(); i++) {
+        if (i > 0) cmdLine += " ";
+        if (spec.args[i].find(' ') != std::string::npos) {
+            cmdLine += "\"" + spec.args[i] + "\"";
+        } else {
+            cmdLine += spec.args[i];
+        }
+    }
+
+    SECURITY_ATTRIBUTES sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nLength = sizeof(sa);
+    sa.bInheritHandle = TRUE;
+
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    memset(&si, 0, sizeof(si));
+    memset(&pi, 0, sizeof(pi));
+    si.cb = sizeof(si);
+    si.dwFlags |= STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    // stdin: anonymous pipe written after the child starts
+    HANDLE inRead = NULL, inWrite = NULL;
+    if (!spec.inheritStdin) {
+        if (!CreatePipe(&inRead, &inWrite, &sa, 0)) {
+            result.error = "cannot create stdin pipe";
+            return result;
+        }
+        SetHandleInformation(inWrite, HANDLE_FLAG_INHERIT, 0);
+        si.hStdInput = inRead;
+    }
+
+    HANDLE outHandle = NULL;
+    if (!spec.outputFile.empty()) {
+        outHandle = CreateFileA(spec.outputFile.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                &sa, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (outHandle == INVALID_HANDLE_VALUE) {
+            result.error = "cannot open " + spec.outputFile;
+            if (inRead) CloseHandle(inRead);
+            if (inWrite) CloseHandle(inWrite);
+            return result;
+        }
+        si.hStdOutput = outHandle;
+        si.hStdError = outHandle;
+    }
+
+    // Output captured through a pipe when there are sinks
+    HANDLE capRead = NULL, capWrite = NULL;
+    bool capture = !spec.sinks.empty();
+    if (capture) {
+        if (!CreatePipe(&capRead, &capWrite, &sa, 0)) {
+            result.error = "cannot create output pipe";
+            if (inRead) CloseHandle(inRead);
+            if (inWrite) CloseHandle(inWrite);
+            if (outHandle) CloseHandle(outHandle);
+            return result;
+        }
+        SetHandleInformation(capRead, HANDLE_FLAG_INHERIT, 0);
+        si.hStdOutput = capWrite;
+        si.hStdError = capWrite;
+    }
+
+    std::vector<char> cmdLineBuf(cmdLine.begin(), cmdLine.end());
+    cmdLineBuf.push_back('\0');
+    // Environment block: NUL-separated entries ending with an empty one
+    std::vector<char> envBlock;
+    if (!spec.env.empty()) {
+        for (const auto& entry : mergeEnvironment(spec.env)) {
+            envBlock.insert(envBlock.end(), entry.begin(), entry.end());
+            envBlock.push_back('\0');
+        }
+        envBlock.push_back('\0');
+    }
+    auto launched = std::chrono::steady_clock::now();
+    DWORD flags = spec.ownProcessGroup ? CREATE_NEW_PROCESS_GROUP : 0;
+    BOOL success = CreateProcessA(nullptr, cmdLineBuf.data(), nullptr, nullptr, TRUE, flags,
+                                  envBlock.empty() ? nullptr : envBlock.data(),
+                                  spec.workDir.empty() ? nullptr : spec.workDir.c_str(), &si, &pi);
+    if (inRead) CloseHandle(inRead);
+    if (capWrite) CloseHandle(capWrite);
+    if (!capture && outHandle) {
+        CloseHandle(outHandle);
+        outHandle = NULL;
+    }
+
+    if (!success) {
+        result.error = "CreateProcess failed with error " + std::to_string(GetLastError());
+        if (inWrite) CloseHandle(inWrite);
+        if (capRead) CloseHandle(capRead);
+        if (outHandle) CloseHandle(outHandle);
+        return result;
+    }
+    result.started = true;
+
+    // Feed stdin from a helper thread so that full stdin/output pipes can't deadlock
+    std::thread feeder;
+    if (inWrite) {
+        feeder = std::thread([inWrite, &spec] {
+            DWORD written = 0;
+            size_t offset = 0;
+            while (offset < spec.input.size() &&
+                   WriteFile(inWrite, spec.input.data() + offset, static_cast<DWORD>(spec.input.size() - offset), &written, NULL) &&
+                   written > 0) {
+                offset += written;
+            }
+            CloseHandle(inWrite);
+        });
+    }
+
+    if (capture) {
+        std::string logBuffer;
+        std::vector<char> buf(1 << 16);
+        DWORD n = 0;
+        while (ReadFile(capRead, buf.data(), static_cast<DWORD>(buf.size()), &n, NULL) && n > 0) {
+            if (outHandle) {
+                logBuffer.append(buf.data(), n);
+            }
+            for (OutputSink* sink : spec.sinks) {
+                sink->write(buf.data(), n);
+            }
+            if (logBuffer.size() >= (1 << 20)) {
+                DWORD written = 0;
+                WriteFile(outHandle, logBuffer.data(), static_cast<DWORD>(logBuffer.size()), &written, NULL);
+                logBuffer.clear();
+            }
+        }
+        if (outHandle && !logBuffer.empty()) {
+            DWORD written = 0;
+            WriteFile(outHandle, logBuffer.data(), static_cast<DWORD>(logBuffer.size()), &written, NULL);
+        }
+        for (OutputSink* sink : spec.sinks) {
+            sink->close();
+        }
+        CloseHandle(capRead);
+        if (outHandle) CloseHandle(outHandle);
+    }
+    if (feeder.joinable()) {
+        feeder.join();
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+    result.exitCode = static_cast<int>(exitCode);
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - launched).count();
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(pi.hProcess, &created, &exited, &kernel, &user)) {
+        // 100 ns units
+        auto seconds = [](const FILETIME& t) {
+            return ((static_cast<unsigned long long>(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+        };
+        result.userSeconds = seconds(user);
+        result.systemSeconds = seconds(kernel);
+        result.cpuSeconds = result.userSeconds + result.systemSeconds;
+    }
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return result;
+}
+
+#else
+
+namespace {
+
+// Write all data to fd; returns false on error (e.g. the child closed its stdin)
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Anonymous in-memory file holding the stdin data; -1 if unsupported
+int createInputMemfd(const std::string& input) {
+#ifdef MFD_CLOEXEC
+    int fd = memfd_create("banewfn-stdin", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!writeAll(fd, input.data(), input.size()) || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    (void)input;
+    return -1;
+#endif
+}
+
+// Append buffer for the log file, written in large blocks
+class LogWriter {
+public:
+    explicit LogWriter(int fd) : fd(fd) { buffer.reserve(kBlock); }
+    void append(const char* data, size_t len) {
+        if (fd < 0) return;
+        buffer.append(data, len);
+        if (buffer.size() >= kBlock) flush();
+    }
+    void flush() {
+        if (fd >= 0 && !buffer.empty()) {
+            writeAll(fd, buffer.data(), buffer.size());
+        }
+        buffer.clear();
+    }
+private:
+    static const size_t kBlock = 1 << 20;
+    int fd;
+    std::string buffer;
+};
+
+int decodeStatus(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return -1;
+}
+
+} // namespace
+
+ProcessResult ProcessLauncher::launch(const ProcessSpec& spec) {
+    ProcessResult result;
+    if (spec.args.empty()) {
+        result.error = "empty command";
+        return result;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    // stdin: memfd when the whole input is known, pipe otherwise (or as a fallback)
+    int inputFd = -1;
+    int pipeWrite = -1;
+    if (!spec.inheritStdin) {
+        if (!spec.forwardStdin) {
+            inputFd = createInputMemfd(spec.input);
+        }
+        if (inputFd < 0) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                result.error = std::string("cannot create stdin pipe: ") + strerror(errno);
+                posix_spawn_file_actions_destroy(&actions);
+                return result;
+            }
+            inputFd = fds[0];
+            pipeWrite = fds[1];
+        }
+        posix_spawn_file_actions_adddup2(&actions, inputFd, STDIN_FILENO);
+    }
+
+    int outFd = -1;
+    if (!spec.outputFile.empty()) {
+        outFd = open(spec.outputFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (outFd < 0) {
+            result.error = "cannot open " + spec.outputFile + ": " + strerror(errno);
+            if (inputFd >= 0) close(inputFd);
+            if (pipeWrite >= 0) close(pipeWrite);
+            posix_spawn_file_actions_destroy(&actions);
+            return result;
+        }
+    }
+
+    // Output: captured through a pipe when someone else wants to see it, otherwise the
+    // child appends to the log itself and we never touch the data
+    int captureRead = -1;
+    int captureWrite = -1;
+    bool capture = !spec.sinks.empty();
+    if (capture) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            result.error = std::string("cannot create output pipe: ") + strerror(errno);
+            if (inputFd >= 0) close(inputFd);
+            if (pipeWrite >= 0) close(pipeWrite);
+            if (outFd >= 0) close(outFd);
+            posix_spawn_file_actions_destroy(&actions);
+            return result;
+        }
+        captureRead = fds[0];
+        captureWrite = fds[1];
+        posix_spawn_file_actions_adddup2(&actions, captureWrite, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, captureWrite, STDERR_FILENO);
+    } else if (outFd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, outFd, STDERR_FILENO);
+    }
+
+    // The log is already open, so only the child changes directory
+    if (!spec.workDir.empty()) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        posix_spawn_file_actions_addchdir_np(&actions, spec.workDir.c_str());
+#else
+        result.error = "a working directory is not supported on this platform";
+        if (inputFd >= 0) close(inputFd);
+        if (pipeWrite >= 0) close(pipeWrite);
+        if (captureRead >= 0) close(captureRead);
+        if (captureWrite >= 0) close(captureWrite);
+        if (outFd >= 0) close(outFd);
+        posix_spawn_file_actions_destroy(&actions);
+        return result;
+#endif
+    }
+
+    std::vector<char*> argv;
+    for (const auto& arg : spec.args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    std::vector<std::string> envStrings;
+    std::vector<char*> envp;
+    if (!spec.env.empty()) {
+        envStrings = mergeEnvironment(spec.env);
+        for (auto& entry : envStrings) {
+            envp.push_back(&entry[0]);
+        }
+        envp.push_back(nullptr);
+    }
+
+    // banewfn ignores SIGPIPE (see main); the child gets the default back
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if (spec.ownProcessGroup) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid = -1;
+    auto launched = std::chrono::steady_clock::now();
+    int rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), envp.empty() ? environ : envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (inputFd >= 0) close(inputFd);
+    if (captureWrite >= 0) close(captureWrite);
+    if (!capture && outFd >= 0) {
+        close(outFd);
+        outFd = -1;
+    }
+
+    if (rc != 0) {
+        result.error = "cannot start " + spec.args[0] + ": " + strerror(rc);
+        if (pipeWrite >= 0) close(pipeWrite);
+        if (captureRead >= 0) close(captureRead);
+        if (outFd >= 0) close(outFd);
+        return result;
+    }
+    result.started = true;
+
+    if (capture) {
+        // Without a memfd, stdin is fed from a helper thread so that a full stdin pipe and a
+        // full output pipe can't deadlock. Sinks must be cheap (queueing, line scanning), since the
+        // child blocks once the output pipe is full.
+        std::thread feeder;
+        if (pipeWrite >= 0) {
+            int fd = pipeWrite;
+            pipeWrite = -1;
+            feeder = std::thread([fd, &spec] {
+                writeAll(fd, spec.input.data(), spec.input.size());
+                close(fd);
+            });
+        }
+        LogWriter log(outFd);
+        std::vector<char> buf(1 << 16);
+        while (true) {
+            ssize_t n = read(captureRead, buf.data(), buf.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            log.append(buf.data(), static_cast<size_t>(n));
+            for (OutputSink* sink : spec.sinks) {
+                sink->write(buf.data(), static_cast<size_t>(n));
+            }
+        }
+        log.flush();
+        for (OutputSink* sink : spec.sinks) {
+            sink->close();
+        }
+        close(captureRead);
+        if (outFd >= 0) close(outFd);
+        if (feeder.joinable()) {
+            feeder.join();
+        }
+    }
+
+    // wait4 also reports the child's resource usage
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    bool reaped = false;
+    if (pipeWrite >= 0) {
+        bool open = writeAll(pipeWrite, spec.input.data(), spec.input.size());
+
+        // Interactive mode: keep forwarding the terminal until the child exits
+        while (open && spec.forwardStdin) {
+            pid_t done = wait4(pid, &status, WNOHANG, &usage);
+            if (done == pid) {
+                reaped = true;
+                break;
+            }
+            struct pollfd pfd;
+            pfd.fd = STDIN_FILENO;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 200) <= 0) {
+                continue;
+            }
+            char buf[4096];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0 || !writeAll(pipeWrite, buf, static_cast<size_t>(n))) {
+                break;
+            }
+        }
+        close(pipeWrite);
+    }
+
+    while (!reaped) {
+        if (wait4(pid, &status, 0, &usage) == pid) {
+            reaped = true;
+        } else if (errno != EINTR) {
+            result.error = std::string("wait4 failed: ") + strerror(errno);
+            return result;
+        }
+    }
+    result.exitCode = decodeStatus(status);
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - launched).count();
+    result.userSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+    result.systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    result.cpuSeconds = result.userSeconds + result.systemSeconds;
+    result.peakRssKb = usage.ru_maxrss;  // Kilobytes on Linux
+    result.inputBlocks = usage.ru_inblock;
+    result.outputBlocks = usage.ru_oublock;
+    result.voluntarySwitches = usage.ru_nvcsw;
+    result.involuntarySwitches = usage.ru_nivcsw;
+    return result;
+}
+
+#endif
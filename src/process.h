@@ -0,0 +1,64 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Consumer of captured child output (called on the launching thread)
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+    virtual void write(const char* data, size_t len) = 0;
+    virtual void close() {}
+};
+
+// Description of a child process to launch (no shell involved)
+struct ProcessSpec {
+    std::vector<std::string> args;  // args[0] is looked up in PATH
+    std::string input;              // Data fed to the child's stdin
+    bool inheritStdin = false;      // Leave stdin attached to ours instead of feeding `input`
+    bool forwardStdin = false;      // After `input`, forward our own stdin (interactive mode)
+    std::string outputFile;         // Append the child's stdout and stderr to this file (empty = inherit)
+    std::string workDir;            // Working directory of the child (empty = ours); outputFile is opened by us
+    std::vector<std::string> env;   // NAME=value entries added to (or replacing) our environment
+    bool ownProcessGroup = false;   // Start in a new process group: Ctrl+C on our terminal does not reach it
+    // Extra consumers of the output. When set, stdout/stderr are captured through a pipe and
+    // the log file is written by us in large blocks; otherwise the child appends to it directly.
+    std::vector<OutputSink*> sinks;
+};
+
+// Outcome of a child process
+struct ProcessResult {
+    bool started = false;
+    int exitCode = -1;  // Exit status, or 128 + signal number if the child was killed
+    std::string error;  // Launch error message
+    double wallSeconds = 0;  // From launch until the child exited
+    double cpuSeconds = 0;  // User + system time of the child
+    double userSeconds = 0;
+    double systemSeconds = 0;
+    long long peakRssKb = 0;  // Peak resident set size of the child (0 if unknown)
+    // Linux only (wait4): block I/O operations and context switches of the child
+    long long inputBlocks = 0;
+    long long outputBlocks = 0;
+    long long voluntarySwitches = 0;
+    long long involuntarySwitches = 0;
+};
+
+// Launches child processes directly (posix_spawn on Linux, CreateProcess on Windows)
+// and feeds their stdin from memory. With --trace each child is a span carrying its rusage.
+class ProcessLauncher {
+public:
+    // Run the process to completion
+    static ProcessResult run(const ProcessSpec& spec);
+
+    // Printable command line for log messages
+    static std::string describe(const ProcessSpec& spec);
+
+    // Our environment with NAME=value entries added (or replacing variables of the same name)
+    static std::vector<std::string> environment(const std::vector<std::string>& extra);
+
+private:
+    static ProcessResult launch(const ProcessSpec& spec);
+};
+
+#endif // PROCESS_H
@@ -0,0 +1,289 @@
+#include "resultcache.h"
+#include "config.h"
+#include "mmapfile.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <utime.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#define rmdir _rmdir
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char* const kManifestHeader = "banewfn-result 1";
+
+bool statFile(const std::string& path, long long& size, long long& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = static_cast<long long>(st.st_size);
+    mtime = static_cast<long long>(st.st_mtime);
+    return true;
+}
+
+// Modification time in nanoseconds where the platform has it, so that a rewrite within the
+// same second is still seen
+long long modifiedNs(const struct stat& st) {
+#ifdef PLATFORM_LINUX
+    return static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    return static_cast<long long>(st.st_mtime) * 1000000000LL;
+#endif
+}
+
+// Remove a cache entry directory (entries are flat, no subdirectories)
+void removeEntryDir(const std::string& dir) {
+    for (const auto& name : Utils::listDirectory(dir)) {
+        remove((dir + "/" + name).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+std::string uniqueSuffix() {
+    static std::atomic<unsigned> counter(0);
+    return std::to_string(getpid()) + "." + std::to_string(counter.fetch_add(1));
+}
+
+} // namespace
+
+std::string ResultCache::binaryIdentity(const std::string& multiwfnExec) {
+    std::string path = multiwfnExec;
+    long long size = 0, mtime = 0;
+
+    // Bare command name: look it up in PATH like the shell would
+    if (path.find_first_of("/\\") == std::string::npos) {
+        const char* envPath = getenv("PATH");
+#ifdef PLATFORM_WINDOWS
+        const char sep = ';';
+#else
+        const char sep = ':';
+#endif
+        if (envPath) {
+            std::stringstream ss(envPath);
+            std::string dir;
+            while (std::getline(ss, dir, sep)) {
+                std::string candidate = dir + "/" + multiwfnExec;
+                if (statFile(candidate, size, mtime)) {
+                    path = candidate;
+                    break;
+                }
+            }
+        }
+    } else {
+        statFile(path, size, mtime);
+    }
+
+    return path + ":" + std::to_string(size) + ":" + std::to_string(mtime);
+}
+
+std::string ResultCache::makeKey(const std::string& wfnFile, const std::string& script, const std::string& multiwfnExec) {
+    // A file rewritten in place (--watch) has a new size or mtime and is hashed again
+    WfnHash stamp;
+    struct stat st;
+    bool stamped = stat(wfnFile.c_str(), &st) == 0;
+    if (stamped) {
+        stamp.size = static_cast<long long>(st.st_size);
+        stamp.mtime = modifiedNs(st);
+    }
+    uint64_t wfnHash = 0;
+    if (stamped) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = wfnHashes.find(wfnFile);
+        if (it != wfnHashes.end() && it->second.size == stamp.size && it->second.mtime == stamp.mtime) {
+            wfnHash = it->second.hash;
+        }
+    }
+    if (wfnHash == 0) {
+        MappedFile file;
+        if (file.open(wfnFile)) {
+            wfnHash = file.contentHash();
+        }
+        if (stamped) {
+            stamp.hash = wfnHash;
+            std::lock_guard<std::mutex> lock(mutex);
+            wfnHashes[wfnFile] = stamp;
+        }
+    }
+
+    std::string identity = binaryIdentity(multiwfnExec);
+
+    // Two differently seeded passes give a 128-bit key
+    uint64_t keys[2];
+    const uint64_t seeds[2] = {14695981039346656037ULL, 0x9e3779b97f4a7c15ULL};
+    for (int i = 0; i < 2; i++) {
+        uint64_t h = Utils::fnv1a64(reinterpret_cast<const char*>(&wfnHash), sizeof(wfnHash), seeds[i]);
+        h = Utils::fnv1a64(script.data(), script.size(), h);
+        h = Utils::fnv1a64(identity.data(), identity.size(), h);
+        keys[i] = h;
+    }
+    return Utils::toHex(keys[0]) + Utils::toHex(keys[1]);
+}
+
+bool ResultCache::restore(const std::string& key, const std::string& outFile, const std::string& workDir) {
+    std::string entry = directory + "/" + key;
+    std::ifstream manifest(entry + "/manifest");
+    if (!manifest.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(manifest, line) || line != kManifestHeader) {
+        return false;
+    }
+
+    std::vector<std::string> files;
+    while (std::getline(manifest, line)) {
+        // file <size> <name>
+        std::stringstream ss(line);
+        std::string tag, name;
+        long long size = 0;
+        ss >> tag >> size;
+        std::getline(ss >> std::ws, name);
+        if (tag == "file" && !name.empty()) {
+            files.push_back(name);
+        }
+    }
+    manifest.close();
+
+    for (const auto& name : files) {
+        if (!Utils::copyFile(entry + "/f." + name, workDir + "/" + name)) {
+            return false;
+        }
+    }
+    if (!outFile.empty() && !Utils::copyFile(entry + "/log", outFile)) {
+        return false;
+    }
+
+    // Mark as recently used for the eviction policy
+    utime((entry + "/manifest").c_str(), nullptr);
+    return true;
+}
+
+bool ResultCache::store(const std::string& key, const std::string& outFile, const Snapshot& before,
+                        const std::vector<std::string>& exclude, const std::string& workDir) {
+    std::string entry = directory + "/" + key;
+    if (Utils::fileExists(entry + "/manifest")) {
+        return true;
+    }
+
+    std::string tmp = directory + "/.tmp." + key + "." + uniqueSuffix();
+    if (!Utils::makeDirs(tmp)) {
+        std::cerr << "Warning: Cannot create result cache entry in " << directory << std::endl;
+        return false;
+    }
+
+    bool ok = Utils::copyFile(outFile, tmp + "/log");
+    std::stringstream manifest;
+    manifest << kManifestHeader << "\n";
+
+    Snapshot after = snapshot(workDir);
+    for (const auto& file : after) {
+        if (std::find(exclude.begin(), exclude.end(), file.first) != exclude.end()) {
+            continue;
+        }
+        auto it = before.find(file.first);
+        if (it != before.end() && it->second == file.second) {
+            continue;  // Unchanged by this run
+        }
+        ok = ok && Utils::copyFile(workDir + "/" + file.first, tmp + "/f." + file.first);
+        manifest << "file " << file.second.first << " " << file.first << "\n";
+    }
+
+    // The manifest is written last: an entry without it is never considered valid
+    if (ok) {
+        std::ofstream out(tmp + "/manifest");
+        out << manifest.str();
+        out.close();
+        ok = !out.fail();
+    }
+
+    if (!ok || rename(tmp.c_str(), entry.c_str()) != 0) {
+        // Either a copy failed or another process published the same key first
+        removeEntryDir(tmp);
+        return ok;
+    }
+
+    evict();
+    return true;
+}
+
+ResultCache::Snapshot ResultCache::snapshot(const std::string& dir) {
+    Snapshot result;
+    for (const auto& name : Utils::listDirectory(dir)) {
+        struct stat st;
+        if (stat((dir + "/" + name).c_str(), &st) == 0 && (st.st_mode & S_IFREG)) {
+            result[name] = {static_cast<long long>(st.st_size), modifiedNs(st)};
+        }
+    }
+    return result;
+}
+
+void ResultCache::evict() {
+    struct EntryInfo {
+        std::string name;
+        long long lastUse;
+        uint64_t bytes;
+    };
+    std::vector<EntryInfo> entries;
+    uint64_t total = 0;
+    long long now = static_cast<long long>(time(nullptr));
+
+    for (const auto& name : Utils::listDirectory(directory)) {
+        std::string path = directory + "/" + name;
+        if (name[0] == '.') {
+            // Leftovers of crashed writers or evictors
+            long long size = 0, mtime = 0;
+            if (statFile(path, size, mtime) && now - mtime > 86400) {
+                removeEntryDir(path);
+            }
+            continue;
+        }
+        EntryInfo info{name, 0, 0};
+        long long size = 0, mtime = 0;
+        if (!statFile(path + "/manifest", size, info.lastUse)) {
+            continue;
+        }
+        for (const auto& file : Utils::listDirectory(path)) {
+            if (statFile(path + "/" + file, size, mtime)) {
+                info.bytes += static_cast<uint64_t>(size);
+            }
+        }
+        total += info.bytes;
+        entries.push_back(info);
+    }
+
+    if (total <= maxBytes) {
+        return;
+    }
+
+    // Least recently used first
+    std::sort(entries.begin(), entries.end(), [](const EntryInfo& a, const EntryInfo& b) {
+        return a.lastUse < b.lastUse;
+    });
+    for (const auto& info : entries) {
+        if (total <= maxBytes) {
+            break;
+        }
+        // Rename out of the way first so that concurrent readers see a clean miss
+        std::string victim = directory + "/.evict." + info.name + "." + uniqueSuffix();
+        if (rename((directory + "/" + info.name).c_str(), victim.c_str()) == 0) {
+            removeEntryDir(victim);
+            total -= info.bytes;
+        }
+    }
+}
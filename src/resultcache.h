@@ -0,0 +1,55 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Content-addressed cache of finished Multiwfn runs.
+// Key = hash(wavefunction contents, generated stdin script, Multiwfn binary identity).
+// Each entry holds the .out log and the files the run created in the working directory.
+// Entries are built in a private temporary directory and published with an atomic
+// rename(), so several banewfn processes may share one cache on a shared filesystem.
+class ResultCache {
+public:
+    // File name -> (size, mtime in nanoseconds) of the regular files in a directory
+    using Snapshot = std::map<std::string, std::pair<long long, long long>>;
+
+    void setDirectory(const std::string& dir) { directory = dir; }
+    void setMaxBytes(uint64_t bytes) { maxBytes = bytes; }
+    const std::string& getDirectory() const { return directory; }
+    bool isEnabled() const { return !directory.empty(); }
+
+    // Compute the cache key of a run
+    std::string makeKey(const std::string& wfnFile, const std::string& script, const std::string& multiwfnExec);
+
+    // Restore a cached run: the log goes to outFile and recorded outputs into workDir.
+    // Returns false on a miss (or if the entry disappeared while being read).
+    bool restore(const std::string& key, const std::string& outFile, const std::string& workDir = ".");
+
+    // Record a finished run: outFile is the log, outputs are the files of workDir that are
+    // new or changed with respect to `before` (names in `exclude` are skipped)
+    bool store(const std::string& key, const std::string& outFile, const Snapshot& before,
+               const std::vector<std::string>& exclude, const std::string& workDir = ".");
+
+    static Snapshot snapshot(const std::string& dir);
+
+    // Path, size and mtime of the Multiwfn binary (a bare command name is looked up in PATH)
+    static std::string binaryIdentity(const std::string& multiwfnExec);
+
+private:
+    std::string directory;
+    uint64_t maxBytes = 10ULL << 30;
+    std::mutex mutex;
+    struct WfnHash {
+        long long size = 0;
+        long long mtime = 0;
+        uint64_t hash = 0;
+    };
+    std::map<std::string, WfnHash> wfnHashes;  // Memoized content hashes per wavefunction path, valid while size and mtime match
+
+    void evict();
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,130 @@
+#include "scheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+BatchScheduler::BatchScheduler(int jobs) : jobs(jobs < 1 ? 1 : jobs) {}
+
+std::vector<bool> BatchScheduler::run(size_t count, const ItemFunc& fn, const std::vector<size_t>& order) {
+    // std::vector<bool> is bit-packed and not safe for concurrent writes
+    std::vector<char> results(count, 0);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&](int workerId) {
+        size_t idx;
+        while ((idx = next.fetch_add(1)) < count) {
+            if (order.size() == count) {
+                idx = order[idx];
+            }
+            results[idx] = fn(idx, workerId) ? 1 : 0;
+        }
+    };
+
+    size_t workerCount = static_cast<size_t>(jobs);
+    if (workerCount > count) {
+        workerCount = count;
+    }
+
+    if (workerCount <= 1) {
+        // Run inline, no thread needed
+        worker(0);
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(workerCount);
+        for (size_t i = 0; i < workerCount; i++) {
+            threads.emplace_back(worker, static_cast<int>(i));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    return std::vector<bool>(results.begin(), results.end());
+}
+
+std::vector<bool> BatchScheduler::runGraph(const std::vector<std::vector<size_t>>& deps, const ItemFunc& fn) {
+    size_t count = deps.size();
+    std::vector<char> results(count, 0);
+    std::vector<char> settled(count, 0);
+    std::vector<size_t> pending(count, 0);
+    std::vector<std::vector<size_t>> dependents(count);
+    std::set<size_t> ready;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t dep : deps[i]) {
+            dependents[dep].push_back(i);
+        }
+        pending[i] = deps[i].size();
+        if (pending[i] == 0) {
+            ready.insert(i);
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t running = 0;
+
+    // Record an outcome and release (or fail) the dependents; called with the lock held
+    std::function<void(size_t, bool)> settle = [&](size_t idx, bool ok) {
+        settled[idx] = 1;
+        results[idx] = ok ? 1 : 0;
+        for (size_t next : dependents[idx]) {
+            if (settled[next]) {
+                continue;
+            }
+            if (!ok) {
+                settle(next, false);
+            } else if (--pending[next] == 0) {
+                ready.insert(next);
+            }
+        }
+    };
+
+    auto worker = [&](int workerId) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [&]() { return !ready.empty() || running == 0; });
+            if (ready.empty()) {
+                break;  // Nothing running that could release more items
+            }
+            size_t idx = *ready.begin();
+            ready.erase(ready.begin());
+            running++;
+            lock.unlock();
+            bool ok = fn(idx, workerId);
+            lock.lock();
+            running--;
+            settle(idx, ok);
+            changed.notify_all();
+        }
+    };
+
+    size_t workerCount = static_cast<size_t>(jobs);
+    if (workerCount > count) {
+        workerCount = count;
+    }
+
+    if (workerCount <= 1) {
+        worker(0);
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(workerCount);
+        for (size_t i = 0; i < workerCount; i++) {
+            threads.emplace_back(worker, static_cast<int>(i));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    return std::vector<bool>(results.begin(), results.end());
+}
+
+int BatchScheduler::splitCores(int totalCores, int jobs) {
+    if (totalCores <= 0 || jobs <= 1) {
+        return totalCores;
+    }
+    int perJob = totalCores / jobs;
+    return perJob < 1 ? 1 : perJob;
+}
@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Work-queue scheduler running batch items on a fixed number of worker threads
+class BatchScheduler {
+public:
+    // Item callback: (item index, worker id) -> success
+    using ItemFunc = std::function<bool(size_t, int)>;
+
+    explicit BatchScheduler(int jobs);
+
+    // Run fn for every index in [0, count); items are claimed in ascending order, or in the
+    // order given (a permutation of the indices). Returns the success flag of each item,
+    // indexed like the input.
+    std::vector<bool> run(size_t count, const ItemFunc& fn, const std::vector<size_t>& order = {});
+
+    // Run fn for every item once all of its dependencies (deps[i] = items that i waits for)
+    // have succeeded; among ready items the lowest index goes first. Items with a failed
+    // dependency are not run and reported as failed, as are items left on a cycle.
+    std::vector<bool> runGraph(const std::vector<std::vector<size_t>>& deps, const ItemFunc& fn);
+
+    int getJobs() const { return jobs; }
+
+    // Split a total core budget among concurrent jobs (at least 1 core per job).
+    // A non-positive budget means "not specified" and is passed through unchanged.
+    static int splitCores(int totalCores, int jobs);
+
+private:
+    int jobs;
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,158 @@
+#include "scratch.h"
+#include "config.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#define rmdir _rmdir
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<unsigned> counter(0);
+
+bool isDirectory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+std::string parentDir(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+} // namespace
+
+std::string ScratchArea::create(const std::string& stem) {
+    if (!Utils::makeDirs(directory)) {
+        return "";
+    }
+    // Unique per process and run; stale directories of crashed runs never collide
+    while (true) {
+        std::string dir = directory + "/" + stem + "." + std::to_string(getpid()) + "_" +
+                          std::to_string(counter.fetch_add(1));
+#ifdef PLATFORM_WINDOWS
+        int rc = _mkdir(dir.c_str());
+#else
+        int rc = mkdir(dir.c_str(), 0700);
+#endif
+        if (rc == 0) {
+            return dir;
+        }
+        if (errno != EEXIST) {
+            return "";
+        }
+    }
+}
+
+std::string ScratchArea::finalName(const std::string& output,
+                                   const std::map<std::string, std::string>& vars) const {
+    std::map<std::string, std::string> all = vars;
+    all["output"] = output;
+    std::string result = replacePlaceholders(name, all);
+    return result.empty() ? output : result;
+}
+
+bool ScratchArea::moveFile(const std::string& src, const std::string& dst, std::string& error) {
+#ifdef PLATFORM_WINDOWS
+    if (MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        return true;
+    }
+    if (GetLastError() != ERROR_NOT_SAME_DEVICE) {
+        error = "MoveFileEx failed with error " + std::to_string(GetLastError());
+        return false;
+    }
+#else
+    if (rename(src.c_str(), dst.c_str()) == 0) {
+        return true;
+    }
+    if (errno != EXDEV) {
+        error = strerror(errno);
+        return false;
+    }
+#endif
+
+    // Different filesystem: one copy into a hidden name beside the target, then rename over it
+    std::string dir = parentDir(dst);
+    std::string base = dir.empty() ? dst : dst.substr(dir.size() + 1);
+    std::string tmp = (dir.empty() ? "" : dir + "/") + "." + base + "." + std::to_string(getpid()) + "_" +
+                      std::to_string(counter.fetch_add(1)) + ".tmp";
+    if (!Utils::copyFile(src, tmp)) {
+        remove(tmp.c_str());
+        error = "cannot copy to " + tmp;
+        return false;
+    }
+#ifdef PLATFORM_WINDOWS
+    bool renamed = MoveFileExA(tmp.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = rename(tmp.c_str(), dst.c_str()) == 0;
+#endif
+    if (!renamed) {
+        remove(tmp.c_str());
+        error = "cannot rename " + tmp;
+        return false;
+    }
+    remove(src.c_str());
+    return true;
+}
+
+bool ScratchArea::promote(const std::string& scratchDir, const std::string& destDir,
+                          const std::map<std::string, std::string>& vars,
+                          const std::vector<std::string>& declared, bool reportMissing) {
+    std::vector<std::string> entries = Utils::listDirectory(scratchDir);
+    bool ok = true;
+    bool keep = false;
+
+    for (const auto& entry : entries) {
+        std::string src = scratchDir + "/" + entry;
+        if (isDirectory(src)) {
+            std::cerr << "Warning: Directory " << entry << " left in scratch: " << scratchDir << std::endl;
+            keep = true;
+            continue;
+        }
+        std::string target = finalName(entry, vars);
+        std::string dst = (destDir.empty() || destDir == ".") ? target : destDir + "/" + target;
+        std::string dir = parentDir(dst);
+        if (!dir.empty() && !Utils::makeDirs(dir)) {
+            std::cerr << "Error: Cannot create directory " << dir << " for " << entry << std::endl;
+            ok = false;
+            continue;
+        }
+        std::string error;
+        if (!moveFile(src, dst, error)) {
+            std::cerr << "Error: Cannot move " << src << " to " << dst << ": " << error << std::endl;
+            ok = false;
+            continue;
+        }
+        if (target != entry) {
+            std::cout << "Output " << entry << " -> " << dst << std::endl;
+        }
+    }
+
+    if (reportMissing) {
+        for (const auto& output : declared) {
+            if (std::find(entries.begin(), entries.end(), output) == entries.end()) {
+                std::cerr << "Warning: Expected output " << output << " was not produced" << std::endl;
+            }
+        }
+    }
+
+    if (ok && !keep) {
+        rmdir(scratchDir.c_str());
+    } else if (!ok) {
+        std::cerr << "Warning: Keeping scratch directory " << scratchDir << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,44 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+#include <map>
+#include <string>
+#include <vector>
+
+// Private scratch directories for Multiwfn runs (banewfn.rc: scratch=<dir>).
+// Multiwfn writes its fixed output names (hole.cub, totesp.cub, ...) into a fresh
+// directory; afterwards the files are promoted into the project directory under
+// templated names. On the same filesystem a promotion is a rename(); across filesystems
+// the file is copied once to a hidden name next to its destination and then renamed,
+// so nobody ever sees a partially written output.
+class ScratchArea {
+public:
+    void setDirectory(const std::string& dir) { directory = dir; }
+    const std::string& getDirectory() const { return directory; }
+    bool isEnabled() const { return !directory.empty(); }
+
+    // Final name template; ${output} is the file name Multiwfn wrote, other ${name}s are
+    // taken from the variables passed to finalName() (default: keep the name)
+    void setNameTemplate(const std::string& nameTemplate) { name = nameTemplate; }
+
+    // Create a new, empty directory for one run; returns an empty string on failure
+    std::string create(const std::string& stem);
+
+    // Final name of an output file
+    std::string finalName(const std::string& output, const std::map<std::string, std::string>& vars) const;
+
+    // Move the files of a scratch directory into destDir under their final names and remove
+    // it. Declared outputs that were not produced are reported when `reportMissing` is set.
+    // Returns false if a file could not be moved (the scratch directory is then kept).
+    bool promote(const std::string& scratchDir, const std::string& destDir,
+                 const std::map<std::string, std::string>& vars,
+                 const std::vector<std::string>& declared, bool reportMissing);
+
+    // Atomically replace dst by src (rename, or copy to a temporary name + rename)
+    static bool moveFile(const std::string& src, const std::string& dst, std::string& error);
+
+private:
+    std::string directory;
+    std::string name = "${output}";
+};
+
+#endif // SCRATCH_H
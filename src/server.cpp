@@ -0,0 +1,611 @@
+#include "server.h"
+#include "config.h"
+#include "cpuset.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef PLATFORM_LINUX
+const size_t kMaxRequest = 1 << 16;
+
+volatile std::sig_atomic_t stopRequested = 0;
+int childWakeFd = -1;
+
+void requestStop(int) {
+    stopRequested = 1;
+}
+
+void childExited(int) {
+    int saved = errno;
+    char byte = 0;
+    if (write(childWakeFd, &byte, 1) < 0) {
+        // The pipe is full: the loop is awake anyway
+    }
+    errno = saved;
+}
+
+// Write everything; false once the peer is gone
+bool sendAll(int fd, const std::string& text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = ::send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool socketAddress(const std::string& path, struct sockaddr_un& addr, std::string& error) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        error = "socket path too long: " + path;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+bool validValue(const std::string& value) {
+    return value.find('\n') == std::string::npos && value.find('\r') == std::string::npos;
+}
+
+void addWatched(const JobServer::Handlers& handlers, std::vector<struct pollfd>& fds) {
+    if (handlers.watch) {
+        for (int fd : handlers.watch()) {
+            fds.push_back({fd, POLLIN, 0});
+        }
+    }
+}
+
+// Pass the readable descriptors from index `first` on to the handlers
+void callReadable(const JobServer::Handlers& handlers, const std::vector<struct pollfd>& fds, size_t first) {
+    for (size_t i = first; i < fds.size(); i++) {
+        if (fds[i].revents != 0 && handlers.readable) {
+            handlers.readable(fds[i].fd);
+        }
+    }
+}
+#endif
+
+} // namespace
+
+std::string ServeJob::format() const {
+    std::ostringstream out;
+    out << "cwd " << cwd << "\n";
+    out << "inp " << inpFile << "\n";
+    if (!wfn.empty()) {
+        out << "wfn " << wfn << "\n";
+    }
+    out << "cores " << cores << "\n";
+    out << "jobs " << jobs << "\n";
+    out << "blocks " << blocks << "\n";
+    out << "priority " << priority << "\n";
+    if (fuse) {
+        out << "fuse 1\n";
+    }
+    if (dryrun) {
+        out << "dryrun 1\n";
+    }
+    if (screen) {
+        out << "screen 1\n";
+    }
+    if (tee) {
+        out << "tee 1\n";
+    }
+    if (!table.empty()) {
+        out << "table " << table << "\n";
+    }
+    if (pack) {
+        out << "pack " << packError << "\n";
+    }
+    if (!wfnCache) {
+        out << "wfncache 0\n";
+    }
+    if (!resultCache) {
+        out << "cache 0\n";
+    }
+    if (!scratch) {
+        out << "scratch 0\n";
+    }
+    for (const auto& var : vars) {
+        out << "var " << var.first << "=" << var.second << "\n";
+    }
+    out << "end\n";
+    return out.str();
+}
+
+bool ServeJob::parse(const std::string& text, ServeJob& job, std::string& error) {
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line == "end") {
+            break;
+        }
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+        if (key == "cwd") {
+            job.cwd = value;
+        } else if (key == "inp") {
+            job.inpFile = value;
+        } else if (key == "wfn") {
+            job.wfn = value;
+        } else if (key == "cores") {
+            job.cores = std::max(0, std::atoi(value.c_str()));
+        } else if (key == "jobs") {
+            job.jobs = std::max(1, std::atoi(value.c_str()));
+        } else if (key == "blocks") {
+            job.blocks = std::max(1, std::atoi(value.c_str()));
+        } else if (key == "priority") {
+            job.priority = std::atoi(value.c_str());
+        } else if (key == "fuse") {
+            job.fuse = value == "1";
+        } else if (key == "dryrun") {
+            job.dryrun = value == "1";
+        } else if (key == "screen") {
+            job.screen = value == "1";
+        } else if (key == "tee") {
+            job.tee = value == "1";
+        } else if (key == "table") {
+            job.table = value;
+        } else if (key == "pack") {
+            job.pack = true;
+            job.packError = std::atof(value.c_str());
+        } else if (key == "wfncache") {
+            job.wfnCache = value == "1";
+        } else if (key == "cache") {
+            job.resultCache = value == "1";
+        } else if (key == "scratch") {
+            job.scratch = value == "1";
+        } else if (key == "var") {
+            size_t eq = value.find('=');
+            if (eq == std::string::npos || eq == 0) {
+                error = "bad variable: " + value;
+                return false;
+            }
+            job.vars[value.substr(0, eq)] = value.substr(eq + 1);
+        } else {
+            error = "unknown request field: " + key;
+            return false;
+        }
+    }
+    if (job.cwd.empty() || job.inpFile.empty()) {
+        error = "request needs cwd and inp";
+        return false;
+    }
+    return true;
+}
+
+std::string JobServer::defaultSocket() {
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) {
+        return std::string(runtimeDir) + "/banewfn.sock";
+    }
+#ifdef PLATFORM_LINUX
+    return "/tmp/banewfn-" + std::to_string(getuid()) + ".sock";
+#else
+    return "banewfn.sock";
+#endif
+}
+
+#ifdef PLATFORM_LINUX
+
+JobServer::~JobServer() {
+    for (size_t i = clients.size(); i-- > 0;) {
+        closeClient(i);
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+    for (int fd : wakeFd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool JobServer::listen(const std::string& socketPath, int totalCores, std::string& error) {
+    path = socketPath;
+    total = std::max(1, totalCores);
+    struct sockaddr_un addr;
+    if (!socketAddress(path, addr, error)) {
+        return false;
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listenFd < 0) {
+        error = std::string("socket failed: ") + strerror(errno);
+        return false;
+    }
+    if (bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (errno != EADDRINUSE) {
+            error = "cannot bind " + path + ": " + strerror(errno);
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        // Left over from a server that did not exit cleanly, unless one still answers
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool alive = probe >= 0 && connect(probe, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (alive || unlink(path.c_str()) != 0 ||
+            bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            error = alive ? "a server is already listening on " + path : "cannot bind " + path + ": " + strerror(errno);
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+    }
+    CpuSet cpuSet = CpuSet::detect();
+    if (total <= static_cast<int>(cpuSet.getCpus().size())) {
+        freeCpus.assign(cpuSet.getCpus().begin(), cpuSet.getCpus().begin() + total);
+    }
+    // Jobs run as the server's user: only that user may submit them
+    chmod(path.c_str(), S_IRUSR | S_IWUSR);
+    if (::listen(listenFd, 128) != 0 || pipe2(wakeFd, O_CLOEXEC | O_NONBLOCK) != 0) {
+        error = std::string("cannot listen: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void JobServer::accept() {
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            return;
+        }
+        Client client;
+        client.fd = fd;
+        clients.push_back(std::move(client));
+    }
+}
+
+void JobServer::closeClient(size_t index) {
+    close(clients[index].fd);
+    clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(index));
+}
+
+// Jobs ahead of this one in the queue, plus one
+size_t JobServer::queuePosition(const ServeJob& job) const {
+    size_t position = 1;
+    for (const auto& client : clients) {
+        if (client.queued && (client.job.priority > job.priority ||
+                              (client.job.priority == job.priority && client.job.id < job.id))) {
+            position++;
+        }
+    }
+    return position;
+}
+
+void JobServer::readRequest(size_t index, const Handlers& handlers) {
+    Client& client = clients[index];
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(client.fd, buffer, sizeof(buffer))) > 0) {
+        if (!client.queued) {
+            client.request.append(buffer, static_cast<size_t>(n));
+        }
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        // Client went away; a queued job is dropped with it
+        if (client.queued) {
+            std::cout << "[serve] job " << client.job.id << " cancelled (client disconnected)" << std::endl;
+            handlers.done(client.job, -1);
+        }
+        closeClient(index);
+        return;
+    }
+    if (client.queued) {
+        return;
+    }
+    bool complete = client.request.find("\nend\n") != std::string::npos || client.request.compare(0, 4, "end\n") == 0;
+    if (!complete && client.request.size() < kMaxRequest) {
+        return;
+    }
+
+    std::string error;
+    ServeJob job;
+    bool ok = complete || (error = "request too large", false);
+    ok = ok && ServeJob::parse(client.request, job, error);
+    job.id = nextId++;
+    ok = ok && handlers.prepare(job, error);
+    if (!ok) {
+        std::cout << "[serve] job " << job.id << " rejected: " << error << std::endl;
+        sendAll(client.fd, "@@ error " + error + "\n@@ exit 1\n");
+        closeClient(index);
+        return;
+    }
+    job.cores = std::min(std::max(job.cores, 1), total);
+    client.request.clear();
+    client.queued = true;
+    client.job = job;
+    size_t position = queuePosition(job);
+    std::cout << "[serve] job " << job.id << " queued: " << job.inpFile << " in " << job.cwd
+              << " (priority " << job.priority << ", " << job.cores << " cores)" << std::endl;
+    sendAll(client.fd, "@@ queued " + std::to_string(job.id) + " " + std::to_string(position) + "\n");
+}
+
+void JobServer::startJobs(const Handlers& handlers) {
+    while (true) {
+        // Highest priority first, then submission order
+        int best = -1;
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (!clients[i].queued) {
+                continue;
+            }
+            const ServeJob& job = clients[i].job;
+            if (best < 0 || job.priority > clients[best].job.priority ||
+                (job.priority == clients[best].job.priority && job.id < clients[best].job.id)) {
+                best = static_cast<int>(i);
+            }
+        }
+        if (best < 0 || (used + clients[best].job.cores > total && !running.empty())) {
+            return;
+        }
+
+        Client client = clients[best];
+        clients.erase(clients.begin() + best);
+        // Back to blocking: the child writes its whole output to this socket
+        fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) & ~O_NONBLOCK);
+        sendAll(client.fd, "@@ started " + std::to_string(client.job.id) + " " + std::to_string(client.job.cores) + "\n");
+        std::cout << "[serve] job " << client.job.id << " started with " << client.job.cores << " cores" << std::endl;
+        std::cout.flush();
+        std::cerr.flush();
+        std::vector<int> cpus;
+        if (static_cast<int>(freeCpus.size()) >= client.job.cores) {
+            cpus.assign(freeCpus.begin(), freeCpus.begin() + client.job.cores);
+            freeCpus.erase(freeCpus.begin(), freeCpus.begin() + client.job.cores);
+        }
+        handlers.start(client.job);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            close(listenFd);
+            for (const auto& other : clients) {
+                close(other.fd);
+            }
+            for (const auto& job : running) {
+                close(job.second.fd);
+            }
+            if (!cpus.empty()) {
+                // Threads and processes of the job inherit the mask
+                CpuSet::pinThread(cpus);
+            }
+            int devNull = open("/dev/null", O_RDONLY);
+            if (devNull >= 0) {
+                dup2(devNull, STDIN_FILENO);
+                close(devNull);
+            }
+            dup2(client.fd, STDOUT_FILENO);
+            dup2(client.fd, STDERR_FILENO);
+            close(client.fd);
+            int status = 1;
+            if (chdir(client.job.cwd.c_str()) != 0) {
+                std::cerr << "Error: Cannot enter the job's working directory: " << client.job.cwd << std::endl;
+            } else {
+                status = handlers.run(client.job);
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(status);
+        }
+        if (pid < 0) {
+            std::cerr << "Error: fork failed: " << strerror(errno) << std::endl;
+            sendAll(client.fd, "@@ error cannot start job\n@@ exit 1\n");
+            close(client.fd);
+            freeCpus.insert(freeCpus.end(), cpus.begin(), cpus.end());
+            handlers.done(client.job, -1);
+            return;
+        }
+        used += client.job.cores;
+        running[pid] = {client.fd, client.job, cpus};
+    }
+}
+
+void JobServer::reapJobs(const Handlers& handlers) {
+    char drain[64];
+    while (read(wakeFd[0], drain, sizeof(drain)) > 0) {
+    }
+    // Only our jobs: the handlers may have children of their own
+    for (auto it = running.begin(); it != running.end();) {
+        int status;
+        if (waitpid(it->first, &status, WNOHANG) != it->first) {
+            ++it;
+            continue;
+        }
+        Running& job = it->second;
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        std::cout << "[serve] job " << job.job.id << " finished with exit code " << code << std::endl;
+        sendAll(job.fd, "@@ exit " + std::to_string(code) + "\n");
+        close(job.fd);
+        used -= job.job.cores;
+        freeCpus.insert(freeCpus.end(), job.cpus.begin(), job.cpus.end());
+        std::sort(freeCpus.begin(), freeCpus.end());
+        handlers.done(job.job, code);
+        it = running.erase(it);
+    }
+}
+
+bool JobServer::serve(const Handlers& handlers) {
+    childWakeFd = wakeFd[1];
+    stopRequested = 0;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = childExited;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, nullptr);
+    action.sa_handler = requestStop;
+    action.sa_flags = 0;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::cout << "[serve] listening on " << path << " with a budget of " << total << " cores (Ctrl+C to stop)" << std::endl;
+    while (!stopRequested) {
+        std::vector<struct pollfd> fds;
+        fds.push_back({listenFd, POLLIN, 0});
+        fds.push_back({wakeFd[0], POLLIN, 0});
+        for (const auto& client : clients) {
+            fds.push_back({client.fd, POLLIN, 0});
+        }
+        size_t own = fds.size();
+        addWatched(handlers, fds);
+        if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+            std::cerr << "Error: poll failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        // Before reaping, which may close the handlers' descriptors
+        callReadable(handlers, fds, own);
+        reapJobs(handlers);
+        // Indices shift as clients leave: walk backwards over the ones polled
+        for (size_t i = own; i-- > 2;) {
+            if (fds[i].revents != 0) {
+                readRequest(i - 2, handlers);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept();
+        }
+        startJobs(handlers);
+        handlers.idle();
+    }
+
+    std::cout << "\n[serve] stopping: " << running.size() << " running job(s) will finish" << std::endl;
+    close(listenFd);
+    listenFd = -1;
+    unlink(path.c_str());
+    for (size_t i = clients.size(); i-- > 0;) {
+        if (clients[i].queued) {
+            sendAll(clients[i].fd, "@@ error server stopped\n@@ exit 1\n");
+            handlers.done(clients[i].job, -1);
+        }
+        closeClient(i);
+    }
+    while (!running.empty()) {
+        std::vector<struct pollfd> fds = {{wakeFd[0], POLLIN, 0}};
+        addWatched(handlers, fds);
+        poll(fds.data(), fds.size(), 1000);
+        callReadable(handlers, fds, 1);
+        reapJobs(handlers);
+    }
+    return true;
+}
+
+int JobServer::submit(const std::string& socketPath, const ServeJob& job) {
+    struct sockaddr_un addr;
+    std::string error;
+    if (!socketAddress(socketPath, addr, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Error: Cannot connect to a banewfn server on " << socketPath << " (start one with: banewfn serve)"
+                  << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    if (!validValue(job.cwd) || !validValue(job.inpFile) || !validValue(job.wfn) || !sendAll(fd, job.format())) {
+        std::cerr << "Error: Cannot send the job to the server" << std::endl;
+        close(fd);
+        return 1;
+    }
+
+    // Status lines are handled here, everything else is the job's output
+    int exitCode = -1;
+    std::string pending;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        pending.append(buffer, static_cast<size_t>(n));
+        size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            std::string line = pending.substr(start, end - start);
+            start = end + 1;
+            if (line.compare(0, 3, "@@ ") != 0) {
+                std::cout << line << '\n';
+                continue;
+            }
+            std::vector<std::string> fields = Utils::split(line.substr(3), ' ');
+            if (fields.empty()) {
+                continue;
+            }
+            if (fields[0] == "exit" && fields.size() >= 2) {
+                exitCode = std::atoi(fields[1].c_str());
+            } else if (fields[0] == "queued" && fields.size() >= 3) {
+                std::cout << "Job " << fields[1] << " queued at position " << fields[2] << std::endl;
+            } else if (fields[0] == "started" && fields.size() >= 3) {
+                std::cout << "Job " << fields[1] << " started with " << fields[2] << " cores" << std::endl;
+            } else if (fields[0] == "error") {
+                std::cerr << "Error: " << line.substr(9) << std::endl;
+            }
+        }
+        pending.erase(0, start);
+        std::cout.flush();
+    }
+    if (!pending.empty()) {
+        std::cout << pending << std::endl;
+    }
+    close(fd);
+    if (exitCode < 0) {
+        std::cerr << "Error: Lost the connection to the banewfn server" << std::endl;
+        return 1;
+    }
+    return exitCode;
+}
+
+#else
+
+JobServer::~JobServer() {}
+
+bool JobServer::listen(const std::string&, int, std::string& error) {
+    error = "banewfn serve is only available on Linux";
+    return false;
+}
+
+bool JobServer::serve(const Handlers&) {
+    return false;
+}
+
+int JobServer::submit(const std::string&, const ServeJob&) {
+    std::cerr << "Error: --submit is only available on Linux" << std::endl;
+    return 1;
+}
+
+#endif
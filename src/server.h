@@ -0,0 +1,108 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// An input file submitted to `banewfn serve`. The client sends it as "key value" lines ended
+// by "end"; paths are resolved in `cwd`, where the job runs.
+struct ServeJob {
+    int id = 0;               // Assigned by the server
+    std::string cwd;
+    std::string inpFile;
+    std::string wfn;          // Empty: the input file's wfn=
+    int cores = 0;            // 0: the input file's core=, else banewfn.rc
+    int jobs = 1;
+    int blocks = 1;
+    int priority = 0;         // Higher runs first; equal priorities in submission order
+    bool fuse = false;
+    bool dryrun = false;
+    bool screen = false;
+    bool tee = false;
+    std::string table;        // --table file, resolved in cwd
+    bool pack = false;
+    double packError = 0;
+    bool wfnCache = true;     // false: --no-wfncache
+    bool resultCache = true;  // false: --no-cache
+    bool scratch = true;      // false: --no-scratch
+    std::map<std::string, std::string> vars;
+
+    std::string format() const;
+    static bool parse(const std::string& text, ServeJob& job, std::string& error);
+};
+
+// Job server behind `banewfn serve` (Linux). One thread polls the listening socket and the
+// clients; each job runs in a forked child, which inherits the warm state of the server
+// (banewfn.rc, loaded confs, parsed input) and writes its output straight to the client.
+// Jobs start by priority while their cores fit in the budget; a job that does not fit
+// holds back the ones after it, so large jobs are not starved. When the budget fits in the
+// usable CPUs, each job is pinned to CPUs of its own.
+// Status lines sent to the client start with "@@ ":
+//   @@ queued <id> <position>    @@ started <id> <cores>    @@ error <message>    @@ exit <code>
+class JobServer {
+public:
+    struct Handlers {
+        // Parent: check the job and load what it needs; may set job.cores
+        std::function<bool(ServeJob& job, std::string& error)> prepare;
+        // Parent, just before the job's child is forked
+        std::function<void(const ServeJob& job)> start;
+        // Child, in job.cwd with stdout/stderr going to the client: returns the exit code
+        std::function<int(const ServeJob& job)> run;
+        // Parent: a job left the server with its exit code (-1 if it never started)
+        std::function<void(const ServeJob& job, int exitCode)> done;
+        // Parent, about once a second and after each event
+        std::function<void()> idle;
+        // Parent (optional): descriptors of the handlers' own to poll, and the call for a readable one
+        std::function<std::vector<int>()> watch;
+        std::function<void(int fd)> readable;
+    };
+
+    JobServer() = default;
+    JobServer(const JobServer&) = delete;
+    JobServer& operator=(const JobServer&) = delete;
+    ~JobServer();
+
+    // Listen on a Unix domain socket; fails if another server answers there
+    bool listen(const std::string& socketPath, int totalCores, std::string& error);
+    // Serve until SIGINT/SIGTERM, then let running jobs finish; returns false on socket errors
+    bool serve(const Handlers& handlers);
+
+    // $XDG_RUNTIME_DIR/banewfn.sock, else /tmp/banewfn-<uid>.sock
+    static std::string defaultSocket();
+    // Client: submit a job, copy its output to stdout and return its exit code
+    static int submit(const std::string& socketPath, const ServeJob& job);
+
+private:
+    struct Client {
+        int fd = -1;
+        std::string request;  // Received text until the "end" line
+        bool queued = false;
+        ServeJob job;
+    };
+
+    struct Running {
+        int fd;
+        ServeJob job;
+        std::vector<int> cpus;  // Pinned CPUs, empty if not pinned
+    };
+
+    void accept();
+    void readRequest(size_t index, const Handlers& handlers);
+    void startJobs(const Handlers& handlers);
+    void reapJobs(const Handlers& handlers);
+    void closeClient(size_t index);
+    size_t queuePosition(const ServeJob& job) const;
+
+    std::string path;
+    int listenFd = -1;
+    int wakeFd[2] = {-1, -1};  // SIGCHLD self-pipe
+    int total = 1;
+    int used = 0;
+    int nextId = 1;
+    std::vector<Client> clients;  // Connected clients whose jobs have not started
+    std::map<int, Running> running;  // By child pid
+    std::vector<int> freeCpus;  // CPUs for pinning jobs (empty: no pinning)
+};
+
+#endif // SERVER_H
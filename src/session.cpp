@@ -0,0 +1,406 @@
+#include "session.h"
+#include "config.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#ifdef PLATFORM_LINUX
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Output kept for finding the prompt; the prompt must lie within the last kPromptWindow bytes
+const size_t kTailBytes = 1 << 14;
+const size_t kPromptWindow = 4096;
+
+#ifdef PLATFORM_LINUX
+// Whether the process is blocked reading its stdin: 1 yes, 0 no, -1 unknown
+int readingStdin(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/syscall");
+    std::string number, fd;
+    if (!(in >> number)) {
+        return -1;
+    }
+    if (number == "running") {
+        return 0;
+    }
+    in >> fd;
+    return number == std::to_string(SYS_read) && fd == "0x0" ? 1 : 0;
+}
+#endif
+
+} // namespace
+
+MultiwfnSession::~MultiwfnSession() {
+    stop();
+}
+
+#ifdef PLATFORM_LINUX
+
+bool MultiwfnSession::start(const std::vector<std::string>& args, const std::vector<std::string>& env,
+                            const std::string& workDir, std::string& error) {
+    int input[2], output[2];
+    if (pipe2(input, O_CLOEXEC) != 0) {
+        error = std::string("pipe failed: ") + strerror(errno);
+        return false;
+    }
+    if (pipe2(output, O_CLOEXEC) != 0) {
+        error = std::string("pipe failed: ") + strerror(errno);
+        close(input[0]);
+        close(input[1]);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output[1], STDERR_FILENO);
+    if (!workDir.empty()) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        posix_spawn_file_actions_addchdir_np(&actions, workDir.c_str());
+#endif
+    }
+    // Own process group: Ctrl+C on the server's terminal must not kill the warm sessions
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::vector<std::string> envStrings = ProcessLauncher::environment(env);
+    std::vector<char*> envp;
+    for (auto& entry : envStrings) {
+        envp.push_back(&entry[0]);
+    }
+    envp.push_back(nullptr);
+
+    pid_t child = -1;
+    int rc = posix_spawnp(&child, argv[0], &actions, &attr, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(input[0]);
+    close(output[1]);
+    if (rc != 0) {
+        error = "cannot start " + args[0] + ": " + strerror(rc);
+        close(input[1]);
+        close(output[0]);
+        return false;
+    }
+    pid = child;
+    inFd = input[1];
+    outFd = output[0];
+    fcntl(inFd, F_SETFL, fcntl(inFd, F_GETFL) | O_NONBLOCK);
+    // Without the socket pair the job reads /proc itself
+    int probe[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, probe) == 0) {
+        probeFd = probe[0];
+        answerFd = probe[1];
+    }
+    return true;
+}
+
+int MultiwfnSession::waitingForInput() {
+    if (probeFd < 0) {
+        return readingStdin(pid);
+    }
+    char question = static_cast<char>(++probeSeq);
+    if (send(probeFd, &question, 1, MSG_NOSIGNAL) != 1) {
+        return readingStdin(pid);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        struct pollfd fd = {probeFd, POLLIN, 0};
+        if (left.count() <= 0 || poll(&fd, 1, static_cast<int>(left.count())) == 0) {
+            return -1;
+        }
+        char reply[2];
+        ssize_t n = recv(probeFd, reply, sizeof(reply), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+            return -1;
+        }
+        if (n == 2 && reply[0] == question) {
+            return reply[1];
+        }
+    }
+}
+
+void MultiwfnSession::answer() {
+    char question;
+    if (recv(answerFd, &question, 1, MSG_DONTWAIT) != 1) {
+        return;
+    }
+    char reply[2] = {question, static_cast<char>(readingStdin(pid))};
+    send(answerFd, reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+void MultiwfnSession::closeFds() {
+    for (int fd : {inFd, outFd, probeFd, answerFd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    pid = inFd = outFd = probeFd = answerFd = -1;
+}
+
+bool MultiwfnSession::run(const std::string& script, const std::string& prompt, const std::vector<OutputSink*>& sinks,
+                          std::string& error) {
+    if (pid < 0) {
+        error = "session is not running";
+        return false;
+    }
+    std::string tail;
+    size_t written = 0;
+    bool warned = false;
+    auto lastOutput = std::chrono::steady_clock::now();
+    char buffer[65536];
+    // Pass on what Multiwfn printed: false once its output is closed
+    auto take = [&]() {
+        ssize_t n = read(outFd, buffer, sizeof(buffer));
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+            error = "Multiwfn exited";
+            return false;
+        }
+        if (n > 0) {
+            for (OutputSink* sink : sinks) {
+                sink->write(buffer, static_cast<size_t>(n));
+            }
+            tail.append(buffer, static_cast<size_t>(n));
+            if (tail.size() > kTailBytes) {
+                tail.erase(0, tail.size() - kTailBytes);
+            }
+            lastOutput = std::chrono::steady_clock::now();
+        }
+        return true;
+    };
+    auto atPrompt = [&]() {
+        size_t at = tail.rfind(prompt);
+        return at != std::string::npos && tail.size() - at <= kPromptWindow;
+    };
+    while (true) {
+        struct pollfd fds[2] = {{outFd, POLLIN, 0}, {inFd, POLLOUT, 0}};
+        int count = written < script.size() ? 2 : 1;
+        int ready = poll(fds, count, 20);
+        if (ready < 0 && errno != EINTR) {
+            error = std::string("poll failed: ") + strerror(errno);
+            return false;
+        }
+        if (ready > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && !take()) {
+            return false;
+        }
+        if (count == 2 && (fds[1].revents & (POLLERR | POLLHUP))) {
+            error = "Multiwfn closed its input";
+            return false;
+        }
+        if (count == 2 && (fds[1].revents & POLLOUT)) {
+            ssize_t n = write(inFd, script.data() + written, script.size() - written);
+            if (n > 0) {
+                written += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                error = "Multiwfn closed its input";
+                return false;
+            }
+        }
+        if (written < script.size() || !atPrompt()) {
+            continue;
+        }
+
+        // Whole script sent and a prompt seen: done once Multiwfn has read all of the script
+        // and waits for input, with the prompt among the last of what it printed
+        int reading = waitingForInput();
+        if (reading < 0) {
+            if (!warned) {
+                std::cerr << "Warning: Cannot read /proc/" << pid << "/syscall; taking a second without output"
+                          << " after the prompt as the end of the script" << std::endl;
+                warned = true;
+            }
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - lastOutput).count() >= 1.0) {
+                return true;
+            }
+            continue;
+        }
+        int unread = 0;
+        if (reading == 0 || ioctl(inFd, FIONREAD, &unread) != 0 || unread > 0) {
+            continue;
+        }
+        // Blocked in the read: everything it printed before is in the pipe already
+        struct pollfd pending = {outFd, POLLIN, 0};
+        while (poll(&pending, 1, 0) > 0) {
+            if (!take()) {
+                return false;
+            }
+        }
+        if (atPrompt()) {
+            return true;
+        }
+    }
+}
+
+void MultiwfnSession::stop() {
+    if (pid < 0) {
+        return;
+    }
+    if (write(inFd, "q\n", 2) < 0) {
+        // Already gone
+    }
+    int child = pid;
+    closeFds();
+    int status;
+    bool exited = false;
+    for (int i = 0; i < 20 && !exited; i++) {
+        exited = waitpid(child, &status, WNOHANG) != 0;
+        if (!exited) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    if (!exited) {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+    }
+}
+
+bool MultiwfnSession::isAlive() {
+    if (pid < 0) {
+        return false;
+    }
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == 0) {
+        return true;
+    }
+    closeFds();
+    return false;
+}
+
+#else
+
+bool MultiwfnSession::start(const std::vector<std::string>&, const std::vector<std::string>&, const std::string&,
+                            std::string& error) {
+    error = "warm Multiwfn sessions are only available on Linux";
+    return false;
+}
+
+bool MultiwfnSession::run(const std::string&, const std::string&, const std::vector<OutputSink*>&, std::string& error) {
+    error = "warm Multiwfn sessions are only available on Linux";
+    return false;
+}
+
+void MultiwfnSession::stop() {}
+
+bool MultiwfnSession::isAlive() {
+    return false;
+}
+
+void MultiwfnSession::answer() {}
+
+#endif
+
+void SessionPool::setLimits(size_t sessions, int idle) {
+    maxSessions = sessions;
+    idleSeconds = idle;
+    while (entries.size() > maxSessions) {
+        auto lru = std::min_element(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.busy != b.busy ? !a.busy : a.lastUsed < b.lastUsed;
+        });
+        if (lru->busy) {
+            break;  // Busy ones leave when released
+        }
+        entries.erase(lru);
+    }
+}
+
+MultiwfnSession* SessionPool::acquire(const std::string& key, const std::function<bool(MultiwfnSession&)>& start) {
+    if (maxSessions == 0) {
+        return nullptr;
+    }
+    evictIdle();
+    for (auto& entry : entries) {
+        if (!entry.busy && entry.key == key) {
+            entry.busy = true;
+            return entry.session.get();
+        }
+    }
+    if (entries.size() >= maxSessions) {
+        auto lru = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (!it->busy && (lru == entries.end() || it->lastUsed < lru->lastUsed)) {
+                lru = it;
+            }
+        }
+        if (lru == entries.end()) {
+            return nullptr;
+        }
+        entries.erase(lru);
+    }
+    Entry entry;
+    entry.key = key;
+    entry.session.reset(new MultiwfnSession());
+    entry.busy = true;
+    if (!start(*entry.session)) {
+        return nullptr;
+    }
+    entries.push_back(std::move(entry));
+    return entries.back().session.get();
+}
+
+void SessionPool::release(MultiwfnSession* session, bool healthy) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->session.get() != session) {
+            continue;
+        }
+        if (!healthy || entries.size() > maxSessions) {
+            entries.erase(it);
+        } else {
+            it->busy = false;
+            it->lastUsed = time(nullptr);
+        }
+        return;
+    }
+}
+
+void SessionPool::evictIdle() {
+    time_t now = time(nullptr);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](Entry& entry) {
+        return !entry.busy && (now - entry.lastUsed > idleSeconds || !entry.session->isAlive());
+    }), entries.end());
+}
+
+std::vector<int> SessionPool::answerFds() const {
+    std::vector<int> fds;
+    for (const auto& entry : entries) {
+        if (entry.session->getAnswerFd() >= 0) {
+            fds.push_back(entry.session->getAnswerFd());
+        }
+    }
+    return fds;
+}
+
+void SessionPool::answer(int fd) {
+    for (auto& entry : entries) {
+        if (entry.session->getAnswerFd() == fd) {
+            entry.session->answer();
+            return;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef SESSION_H
+#define SESSION_H
+#include "process.h"
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A Multiwfn process kept at its main menu with one wavefunction loaded (banewfn serve,
+// Linux). Scripts are fed through a pipe; a script is done once the main-menu prompt has
+// been printed and Multiwfn waits for more input (blocked in a read of its stdin, or
+// silent for a second where /proc/<pid>/syscall cannot be read). The session is started
+// by the server and driven by a forked job, a sibling that may not read the /proc file of
+// Multiwfn (Yama ptrace_scope=1): the job asks the server through a socket pair instead.
+class MultiwfnSession {
+public:
+    MultiwfnSession() = default;
+    MultiwfnSession(const MultiwfnSession&) = delete;
+    MultiwfnSession& operator=(const MultiwfnSession&) = delete;
+    ~MultiwfnSession();
+
+    // Launch Multiwfn; loading the wavefunction is waited for by the first run()
+    bool start(const std::vector<std::string>& args, const std::vector<std::string>& env,
+               const std::string& workDir, std::string& error);
+    // Feed a script that ends back at the main menu, passing the output to the sinks until
+    // Multiwfn waits at `prompt` again. False if Multiwfn exits or its pipes break.
+    bool run(const std::string& script, const std::string& prompt, const std::vector<OutputSink*>& sinks,
+             std::string& error);
+    // Quit Multiwfn (killed if it does not exit within two seconds)
+    void stop();
+    // False once the process has exited (it is reaped here)
+    bool isAlive();
+    // Server: answer a job's question whether Multiwfn waits for input (answerFd is readable)
+    void answer();
+
+    int getPid() const { return pid; }
+    int getAnswerFd() const { return answerFd; }
+
+private:
+    // 1 if Multiwfn is blocked reading its stdin, 0 if not, -1 if that cannot be told
+    int waitingForInput();
+    void closeFds();
+
+    int pid = -1;
+    int inFd = -1;      // Multiwfn's stdin
+    int outFd = -1;     // Multiwfn's stdout and stderr
+    int probeFd = -1;   // Job end of the socket pair to the server
+    int answerFd = -1;  // Server end
+    unsigned char probeSeq = 0;  // Matches answers to questions (a late answer is skipped)
+};
+
+// Warm sessions by key (working directory, wavefunction and cores). A session serves one
+// job at a time; the least recently used idle session makes room for a new one, and
+// sessions idle for too long are stopped.
+class SessionPool {
+public:
+    void setLimits(size_t maxSessions, int idleSeconds);
+    bool isEnabled() const { return maxSessions > 0; }
+
+    // An idle session for the key, else a new one launched by `start`; null if the pool is
+    // full of busy sessions or the launch fails
+    MultiwfnSession* acquire(const std::string& key, const std::function<bool(MultiwfnSession&)>& start);
+    // Done with a session; a session left in an unknown state is stopped
+    void release(MultiwfnSession* session, bool healthy);
+    // Stop sessions idle for longer than the limit, and forget ones that exited
+    void evictIdle();
+    // Server: the answer ends of the sessions' socket pairs to poll, and the call for a readable one
+    std::vector<int> answerFds() const;
+    void answer(int fd);
+
+private:
+    struct Entry {
+        std::string key;
+        std::unique_ptr<MultiwfnSession> session;
+        bool busy = false;
+        time_t lastUsed = 0;
+    };
+
+    std::vector<Entry> entries;
+    size_t maxSessions = 0;
+    int idleSeconds = 600;
+};
+
+// Output sink appending to a stream (the .out log of a session run)
+class StreamSink : public OutputSink {
+public:
+    explicit StreamSink(std::ostream& out) : out(out) {}
+    void write(const char* data, size_t len) override { out.write(data, static_cast<std::streamsize>(len)); }
+
+private:
+    std::ostream& out;
+};
+
+#endif // SESSION_H
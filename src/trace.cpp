@@ -0,0 +1,134 @@
+#include "trace.h"
+#include "config.h"
+#include "utils.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef PLATFORM_WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+std::atomic<bool> Trace::active(false);
+
+namespace {
+
+struct TraceState {
+    std::mutex mutex;
+    std::string path;
+    std::chrono::steady_clock::time_point origin;
+    std::vector<std::string> events;
+    std::map<std::thread::id, int> threads;  // Small track numbers, 1 = first recording thread
+};
+
+TraceState& state() {
+    static TraceState instance;
+    return instance;
+}
+
+} // namespace
+
+void Trace::start(const std::string& path) {
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.path = path;
+    s.origin = std::chrono::steady_clock::now();
+    s.events.clear();
+    s.threads.clear();
+    s.threads[std::this_thread::get_id()] = 1;
+    active.store(true);
+}
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state().origin)
+        .count();
+}
+
+void Trace::record(const std::string& category, const std::string& name, int64_t begin, int64_t end,
+                   const std::string& args) {
+    if (!enabled()) {
+        return;
+    }
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.threads.find(std::this_thread::get_id());
+    if (it == s.threads.end()) {
+        it = s.threads.emplace(std::this_thread::get_id(), static_cast<int>(s.threads.size()) + 1).first;
+    }
+    std::string event = "{\"name\":" + Utils::jsonString(name) + ",\"cat\":" + Utils::jsonString(category) +
+                        ",\"ph\":\"X\",\"ts\":" + std::to_string(begin) + ",\"dur\":" +
+                        std::to_string(end > begin ? end - begin : 0) + ",\"pid\":" + std::to_string(getpid()) +
+                        ",\"tid\":" + std::to_string(it->second);
+    if (!args.empty()) {
+        event += ",\"args\":{" + args + "}";
+    }
+    s.events.push_back(event + "}");
+}
+
+bool Trace::finish() {
+    if (!enabled()) {
+        return true;
+    }
+    active.store(false);
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::ofstream out(s.path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    // Track names: the thread that started tracing is main(), the others are workers
+    std::vector<std::string> lines;
+    for (const auto& thread : s.threads) {
+        std::string name = thread.second == 1 ? "main" : "worker " + std::to_string(thread.second - 1);
+        lines.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + std::to_string(getpid()) +
+                        ",\"tid\":" + std::to_string(thread.second) + ",\"args\":{\"name\":\"" + name + "\"}}");
+    }
+    lines.insert(lines.end(), s.events.begin(), s.events.end());
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < lines.size(); i++) {
+        out << lines[i] << (i + 1 < lines.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    out.close();
+    return !out.fail();
+}
+
+TraceSpan::TraceSpan(const char* category, std::string_view name)
+    : active(Trace::enabled()), category(category) {
+    if (active) {
+        this->name = name;
+        begin = Trace::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    finish();
+}
+
+void TraceSpan::finish() {
+    if (active) {
+        Trace::record(category, name, begin, Trace::now(), args);
+        active = false;
+    }
+}
+
+void TraceSpan::arg(const char* key, const std::string& value) {
+    if (active) {
+        args += (args.empty() ? "" : ",") + Utils::jsonString(key) + ":" + Utils::jsonString(value);
+    }
+}
+
+void TraceSpan::arg(const char* key, double value) {
+    if (active) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.6g", value);
+        args += (args.empty() ? "" : ",") + Utils::jsonString(key) + ":" + buf;
+    }
+}
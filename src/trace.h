@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Chrome trace-event recorder (--trace out.json, viewable in Perfetto or chrome://tracing).
+// Spans are recorded as complete events with the recording thread as track. While tracing
+// is off a span costs one relaxed atomic load and nothing is allocated.
+class Trace {
+public:
+    // Start recording; the events are written by finish()
+    static void start(const std::string& path);
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    // Write the recorded events; false if the file cannot be written
+    static bool finish();
+
+    // Microseconds since tracing started
+    static int64_t now();
+    // Record a span; `args` holds the members of the JSON args object (may be empty)
+    static void record(const std::string& category, const std::string& name, int64_t begin, int64_t end,
+                       const std::string& args);
+
+private:
+    static std::atomic<bool> active;
+};
+
+// Span from construction to destruction
+class TraceSpan {
+public:
+    TraceSpan(const char* category, std::string_view name);
+    ~TraceSpan();
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool isActive() const { return active; }
+    // Attach a value shown with the span (ignored while tracing is off)
+    void arg(const char* key, const std::string& value);
+    void arg(const char* key, double value);
+    // End the span before the end of its scope
+    void finish();
+
+private:
+    bool active;
+    const char* category;
+    std::string name;
+    std::string args;
+    int64_t begin = 0;
+};
+
+#endif // TRACE_H
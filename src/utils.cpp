@@ -1,13 +1,17 @@
 #include "utils.h"
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
+#include <sys/stat.h>
 #else
+#include <dirent.h>
 #include <glob.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 std::string Utils::trim(const std::string& str) {
@@ -164,3 +168,168 @@ std::vector<std::string> Utils::expandWildcard(const std::string& pattern) {
     
     return result;
 }
+
+bool Utils::makeDirs(const std::string& path) {
+    if (path.empty()) {
+        return false;
+    }
+    
+    // 逐级创建路径中的每一层目录
+    for (size_t pos = 1; pos <= path.size(); pos++) {
+        if (pos != path.size() && path[pos] != '/' && path[pos] != '\\') {
+            continue;
+        }
+        std::string dir = path.substr(0, pos);
+        // 已存在的层级（包括盘符等无法创建的前缀）直接忽略错误，最后统一检查
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
+    
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+std::vector<std::string> Utils::listDirectory(const std::string& path) {
+    std::vector<std::string> result;
+#ifdef _WIN32
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile((path + "\\*").c_str(), &findData);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            std::string name = findData.cFileName;
+            if (name != "." && name != "..") {
+                result.push_back(name);
+            }
+        } while (FindNextFile(hFind, &findData));
+        FindClose(hFind);
+    }
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                result.push_back(name);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool Utils::copyFile(const std::string& src, const std::string& dst) {
+    std::ifstream in(src, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    // 空文件时 operator<< 会置 failbit，需单独处理
+    if (in.peek() != std::ifstream::traits_type::eof()) {
+        out << in.rdbuf();
+    }
+    out.close();
+    return !out.fail();
+}
+
+bool Utils::linkOrCopyFile(const std::string& src, const std::string& dst) {
+    remove(dst.c_str());
+#ifdef _WIN32
+    if (CreateHardLinkA(dst.c_str(), src.c_str(), NULL)) {
+        return true;
+    }
+#else
+    if (link(src.c_str(), dst.c_str()) == 0) {
+        return true;
+    }
+#endif
+    return copyFile(src, dst);
+}
+
+bool Utils::isAbsolutePath(const std::string& path) {
+    if (path.empty()) {
+        return false;
+    }
+    if (path[0] == '/' || path[0] == '\\') {
+        return true;
+    }
+    // 盘符形式，如 C:\dir
+    return path.size() >= 2 && path[1] == ':';
+}
+
+std::string Utils::absolutePath(const std::string& path) {
+    if (path.empty() || isAbsolutePath(path)) {
+        return path;
+    }
+#ifdef _WIN32
+    char buffer[MAX_PATH];
+    DWORD len = GetFullPathNameA(path.c_str(), MAX_PATH, buffer, nullptr);
+    if (len > 0 && len < MAX_PATH) {
+        return buffer;
+    }
+    return path;
+#else
+    char buffer[4096];
+    if (!getcwd(buffer, sizeof(buffer))) {
+        return path;
+    }
+    std::string result = buffer;
+    std::string rest = path;
+    while (rest.compare(0, 2, "./") == 0) {
+        rest = rest.substr(2);
+    }
+    if (rest == ".") {
+        return result;
+    }
+    return result + "/" + rest;
+#endif
+}
+
+uint64_t Utils::fnv1a64(const char* data, size_t len, uint64_t seed) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::string Utils::toHex(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    std::string result(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        result[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+    return result;
+}
+
+std::string Utils::jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\t': out += "\\t"; break;
+        case '\r': out += "\\r"; break;
+        case '\n': out += "\\n"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
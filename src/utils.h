@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -60,6 +62,73 @@ public:
      * @return 匹配的文件路径列表（按字母顺序排序）
      */
     static std::vector<std::string> expandWildcard(const std::string& pattern);
+    
+    /**
+     * @brief 递归创建目录（类似 mkdir -p）
+     * @param path 目录路径
+     * @return 目录已存在或创建成功返回true
+     */
+    static bool makeDirs(const std::string& path);
+    
+    /**
+     * @brief 列出目录中的条目（不含 . 与 ..，不递归）
+     * @param path 目录路径
+     * @return 条目名称列表（按字母顺序排序）
+     */
+    static std::vector<std::string> listDirectory(const std::string& path);
+    
+    /**
+     * @brief 复制文件（二进制方式）
+     * @param src 源文件路径
+     * @param dst 目标文件路径（已存在则覆盖）
+     * @return 成功返回true
+     */
+    static bool copyFile(const std::string& src, const std::string& dst);
+    
+    /**
+     * @brief 为文件建立硬链接，无法链接时（跨文件系统等）退回为复制
+     * @param src 源文件路径
+     * @param dst 目标文件路径（已存在则替换）
+     * @return 成功返回true
+     */
+    static bool linkOrCopyFile(const std::string& src, const std::string& dst);
+    
+    /**
+     * @brief 将相对路径转换为基于当前工作目录的绝对路径（不要求文件存在）
+     * @param path 文件路径
+     * @return 绝对路径；已是绝对路径时原样返回
+     */
+    static std::string absolutePath(const std::string& path);
+    
+    /**
+     * @brief 判断路径是否为绝对路径
+     * @param path 文件路径
+     * @return 以 / 或 \ 开头，或带盘符时返回true
+     */
+    static bool isAbsolutePath(const std::string& path);
+    
+    /**
+     * @brief 计算 64 位 FNV-1a 哈希
+     * @param data 数据指针
+     * @param len 数据长度（字节）
+     * @param seed 初始哈希值，可用于串联多段数据
+     * @return 哈希值
+     */
+    static uint64_t fnv1a64(const char* data, size_t len, uint64_t seed = 14695981039346656037ULL);
+    
+    /**
+     * @brief 将 64 位整数格式化为 16 位十六进制字符串
+     * @param value 输入值
+     * @return 十六进制字符串（小写，补零）
+     */
+    static std::string toHex(uint64_t value);
+    
+    /**
+     * @brief 将字符串转换为带引号的 JSON 字符串字面量
+     * @param s 输入字符串
+     * @return 转义了引号、反斜杠和控制字符的 JSON 字符串
+     */
+    static std::string jsonString(const std::string& s);
 };
 
 #endif // UTILS_H
@@ -0,0 +1,228 @@
+#include "watch.h"
+#include "config.h"
+#include "utils.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <thread>
+
+#ifdef PLATFORM_LINUX
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+bool FileStamp::of(const std::string& path, FileStamp& stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) {
+        return false;
+    }
+    stamp.size = static_cast<long long>(st.st_size);
+    stamp.mtime = static_cast<long long>(st.st_mtime);
+    return true;
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+#ifdef PLATFORM_LINUX
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+}
+
+bool DirectoryWatcher::matchName(const std::string& pattern, const std::string& name) {
+    // Iterative glob match with backtracking to the last '*'
+    size_t p = 0, n = 0, star = std::string::npos, mark = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = n;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+void DirectoryWatcher::scanInto(const std::string& dir, std::vector<std::string>& files) const {
+    for (const auto& entry : Utils::listDirectory(dir)) {
+        std::string path = dir + "/" + entry;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if ((st.st_mode & S_IFMT) == S_IFDIR) {
+            scanInto(path, files);
+        } else if (matchName(pattern, entry)) {
+            files.push_back(path);
+        }
+    }
+}
+
+std::vector<std::string> DirectoryWatcher::scan() const {
+    std::vector<std::string> files;
+    scanInto(root, files);
+    return files;
+}
+
+// Watch a directory and its subdirectories; matching files already there are added to `found`
+// (they may have been written before the watch existed)
+void DirectoryWatcher::addWatches(const std::string& dir, std::vector<std::string>& found) {
+#ifdef PLATFORM_LINUX
+    int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd < 0) {
+        return;
+    }
+    watchDirs[wd] = dir;
+#endif
+    for (const auto& entry : Utils::listDirectory(dir)) {
+        std::string path = dir + "/" + entry;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if ((st.st_mode & S_IFMT) == S_IFDIR) {
+            addWatches(path, found);
+        } else if (matchName(pattern, entry)) {
+            found.push_back(path);
+        }
+    }
+}
+
+bool DirectoryWatcher::open(const std::string& dir, const std::string& namePattern, std::string& error) {
+    root = dir;
+    while (root.size() > 1 && (root.back() == '/' || root.back() == '\\')) {
+        root.pop_back();
+    }
+    pattern = namePattern;
+    struct stat st;
+    if (stat(root.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFDIR) {
+        error = "not a directory: " + root;
+        return false;
+    }
+#ifdef PLATFORM_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        error = std::string("inotify_init1 failed: ") + strerror(errno);
+        return false;
+    }
+    std::vector<std::string> existing;
+    addWatches(root, existing);
+    if (watchDirs.empty()) {
+        error = "cannot watch " + root;
+        return false;
+    }
+#else
+    for (const auto& path : scan()) {
+        FileStamp::of(path, polled[path]);
+    }
+#endif
+    return true;
+}
+
+std::vector<std::string> DirectoryWatcher::wait(int timeoutMs) {
+    std::vector<std::string> files;
+#ifdef PLATFORM_LINUX
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) {
+        return files;
+    }
+    alignas(struct inotify_event) char buffer[16384];
+    while (true) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost: report everything, the caller skips what it already knows
+                std::vector<std::string> all = scan();
+                files.insert(files.end(), all.begin(), all.end());
+                continue;
+            }
+            auto it = watchDirs.find(event->wd);
+            if (it == watchDirs.end() || event->len == 0) {
+                continue;
+            }
+            std::string path = it->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    addWatches(path, files);
+                }
+            } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && matchName(pattern, event->name)) {
+                files.push_back(path);
+            }
+        }
+    }
+#else
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    std::map<std::string, FileStamp> current;
+    for (const auto& path : scan()) {
+        FileStamp stamp;
+        if (FileStamp::of(path, stamp)) {
+            current[path] = stamp;
+            auto it = polled.find(path);
+            if (it == polled.end() || it->second != stamp) {
+                files.push_back(path);
+            }
+        }
+    }
+    polled.swap(current);
+#endif
+    return files;
+}
+
+bool DoneSet::load(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    file = path;
+    done.clear();
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields = Utils::split(line, '\t');
+        if (fields.size() != 3 || fields[2].empty()) {
+            continue;  // Partial line of an interrupted write
+        }
+        FileStamp stamp;
+        stamp.size = std::atoll(fields[0].c_str());
+        stamp.mtime = std::atoll(fields[1].c_str());
+        done[fields[2]] = stamp;
+    }
+    return true;
+}
+
+bool DoneSet::contains(const std::string& path, const FileStamp& stamp) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = done.find(path);
+    return it != done.end() && it->second == stamp;
+}
+
+bool DoneSet::add(const std::string& path, const FileStamp& stamp) {
+    std::lock_guard<std::mutex> lock(mutex);
+    done[path] = stamp;
+    std::ofstream out(file, std::ios::app | std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    std::string line = std::to_string(stamp.size) + "\t" + std::to_string(stamp.mtime) + "\t" + path + "\n";
+    out.write(line.data(), static_cast<std::streamsize>(line.size()));
+    out.close();
+    return !out.fail();
+}
@@ -0,0 +1,69 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Size and modification time of a file; a file is settled once two looks give the same stamp
+struct FileStamp {
+    long long size = -1;
+    long long mtime = 0;
+
+    bool operator==(const FileStamp& other) const { return size == other.size && mtime == other.mtime; }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+
+    // False if the path is not a regular file
+    static bool of(const std::string& path, FileStamp& stamp);
+};
+
+// Files written under a directory tree (banewfn --watch). On Linux inotify reports files when
+// they are closed after writing (IN_CLOSE_WRITE) or moved in (IN_MOVED_TO); subdirectories are
+// watched as they appear. Elsewhere the tree is rescanned and changed files are reported.
+// Only file names matching the pattern (* and ?) are reported.
+class DirectoryWatcher {
+public:
+    DirectoryWatcher() = default;
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+    ~DirectoryWatcher();
+
+    bool open(const std::string& root, const std::string& namePattern, std::string& error);
+
+    // Every matching file currently in the tree
+    std::vector<std::string> scan() const;
+    // Matching files written since the last call; waits up to timeoutMs when there are none
+    std::vector<std::string> wait(int timeoutMs);
+
+    static bool matchName(const std::string& pattern, const std::string& name);
+
+private:
+    void scanInto(const std::string& dir, std::vector<std::string>& files) const;
+    void addWatches(const std::string& dir, std::vector<std::string>& found);
+
+    std::string root;
+    std::string pattern;
+    int fd = -1;
+    std::map<int, std::string> watchDirs;  // inotify watch descriptor -> directory
+    std::map<std::string, FileStamp> polled;  // Polling fallback: stamps of the last scan
+};
+
+// Wavefunctions already analysed by --watch: one "size<TAB>mtime<TAB>path" line per file,
+// appended when the file's analysis succeeds, so that a restarted watch skips them. A file
+// rewritten since then (other size or mtime) is analysed again.
+class DoneSet {
+public:
+    bool load(const std::string& path);
+    const std::string& getFile() const { return file; }
+
+    bool contains(const std::string& path, const FileStamp& stamp) const;
+    bool add(const std::string& path, const FileStamp& stamp);
+    size_t size() const { return done.size(); }
+
+private:
+    std::string file;
+    std::map<std::string, FileStamp> done;
+    mutable std::mutex mutex;
+};
+
+#endif // WATCH_H
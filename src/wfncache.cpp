@@ -0,0 +1,92 @@
+#include "wfncache.h"
+#include "config.h"
+#include "fchk.h"
+#include "utils.h"
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+
+#ifdef PLATFORM_WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+std::string WfnCache::prepare(const std::string& wfnFile, const Converter& convert, int threads) {
+    if (!isEnabled()) {
+        return wfnFile;
+    }
+
+    // Already in the target format
+    size_t dot = wfnFile.find_last_of('.');
+    if (dot != std::string::npos && wfnFile.substr(dot) == ".mwfn") {
+        return wfnFile;
+    }
+
+    // Content key; formatted checkpoints are indexed natively so that a truncated file is
+    // rejected before hashing, and fully decoded before conversion (see below)
+    uint64_t hash = 0;
+    FchkFile fchk;
+    bool isFchk = FchkFile::isFchkFile(wfnFile);
+    if (isFchk) {
+        if (!fchk.open(wfnFile)) {
+            std::cerr << "Warning: Not caching " << wfnFile << " (" << fchk.getError() << ")" << std::endl;
+            return wfnFile;
+        }
+        hash = fchk.contentHash(threads);
+    } else {
+        MappedFile file;
+        if (!file.open(wfnFile)) {
+            return wfnFile;
+        }
+        hash = file.contentHash(threads);
+    }
+    hash = Utils::fnv1a64(converter.data(), converter.size(), hash);
+
+    std::string cached = directory + "/" + Utils::toHex(hash) + ".mwfn";
+
+    if (!Utils::fileExists(cached)) {
+        // Never cache a corrupt or still-being-written checkpoint
+        std::string message;
+        if (isFchk && !fchk.validate(message, threads)) {
+            std::cerr << "Warning: Not caching " << wfnFile << " (invalid fchk: " << message << ")" << std::endl;
+            return wfnFile;
+        }
+        if (!Utils::makeDirs(directory)) {
+            std::cerr << "Warning: Cannot create wavefunction cache directory: " << directory << std::endl;
+            return wfnFile;
+        }
+
+        // Convert into a private temporary name, then publish with an atomic rename
+        static std::atomic<unsigned> counter(0);
+        std::string tmp = directory + "/" + Utils::toHex(hash) + "." + std::to_string(getpid()) + "_" +
+                          std::to_string(counter.fetch_add(1)) + ".tmp.mwfn";
+
+        std::cout << "Converting " << wfnFile << " -> " << cached << std::endl;
+        if (!convert(wfnFile, tmp) || !Utils::fileExists(tmp)) {
+            std::cerr << "Warning: Conversion of " << wfnFile << " failed, using original file" << std::endl;
+            remove(tmp.c_str());
+            return wfnFile;
+        }
+        if (rename(tmp.c_str(), cached.c_str()) != 0) {
+            // On Windows rename() fails if another process already published the same key
+            remove(tmp.c_str());
+            if (!Utils::fileExists(cached)) {
+                return wfnFile;
+            }
+        }
+    } else {
+        std::cout << "Using cached wavefunction for " << wfnFile << ": " << cached << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    resolved[wfnFile] = cached;
+    return cached;
+}
+
+std::string WfnCache::resolve(const std::string& wfnFile) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = resolved.find(wfnFile);
+    return it == resolved.end() ? wfnFile : it->second;
+}
@@ -0,0 +1,36 @@
+#ifndef WFNCACHE_H
+#define WFNCACHE_H
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Content-keyed cache of wavefunctions pre-converted to .mwfn.
+// Each input is converted once; later runs load <cachedir>/<hash>.mwfn instead. The key also
+// covers the conversion itself, so a new Multiwfn or an edited mwfn.conf converts again.
+class WfnCache {
+public:
+    // Converter callback: convert src into dst, return success
+    using Converter = std::function<bool(const std::string&, const std::string&)>;
+
+    void setDirectory(const std::string& dir) { directory = dir; }
+    const std::string& getDirectory() const { return directory; }
+    bool isEnabled() const { return !directory.empty(); }
+    // Identity of the conversion (Multiwfn binary and conversion script), hashed into the key
+    void setConverter(const std::string& identity) { converter = identity; }
+
+    // Make sure a converted copy of wfnFile exists in the cache and remember it.
+    // Returns the path Multiwfn should load (the original file if conversion is not possible).
+    std::string prepare(const std::string& wfnFile, const Converter& convert, int threads = 0);
+
+    // Path Multiwfn should load for wfnFile (the original unless prepare() found a cached copy)
+    std::string resolve(const std::string& wfnFile) const;
+
+private:
+    std::string directory;
+    std::string converter;
+    mutable std::mutex mutex;
+    std::map<std::string, std::string> resolved;
+};
+
+#endif // WFNCACHE_H
@@ -0,0 +1,283 @@
+#include "workqueue.h"
+#include "config.h"
+#include "utils.h"
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#ifdef PLATFORM_WINDOWS
+#include <process.h>
+#include <sys/utime.h>
+#define getpid _getpid
+#define utime _utime
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace {
+
+bool modificationTime(const std::string& path, long long& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    mtime = static_cast<long long>(st.st_mtime);
+    return true;
+}
+
+std::string hostName() {
+#ifdef PLATFORM_WINDOWS
+    const char* name = getenv("COMPUTERNAME");
+    return name ? name : "localhost";
+#else
+    char name[256] = {0};
+    if (gethostname(name, sizeof(name) - 1) != 0 || name[0] == '\0') {
+        return "localhost";
+    }
+    return name;
+#endif
+}
+
+// Split "<job>@<worker>" of a claimed entry
+bool splitClaim(const std::string& entry, std::string& job, std::string& worker) {
+    size_t at = entry.find('@');
+    if (at == std::string::npos) {
+        return false;
+    }
+    job = entry.substr(0, at);
+    worker = entry.substr(at + 1);
+    return true;
+}
+
+bool parseJobName(const std::string& name, size_t& file, size_t& block) {
+    size_t dash = name.find('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == name.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < name.size(); i++) {
+        if (i != dash && !isdigit(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+    file = std::strtoul(name.c_str(), nullptr, 10);
+    block = std::strtoul(name.c_str() + dash + 1, nullptr, 10);
+    return true;
+}
+
+} // namespace
+
+std::string WorkQueue::jobName(size_t file, size_t block) {
+    char name[64];
+    snprintf(name, sizeof(name), "%06zu-%03zu", file, block);
+    return name;
+}
+
+bool WorkQueue::writeFile(const std::string& path, const std::string& content, std::string& error) const {
+    // Written beside the queue and renamed into place, so nobody reads a partial file
+    static std::atomic<unsigned> counter(0);
+    std::string tmp = directory + "/.tmp." + std::to_string(getpid()) + "_" + std::to_string(counter.fetch_add(1));
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        error = "cannot create " + tmp;
+        return false;
+    }
+    file << content;
+    file.close();
+    if (file.fail() || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool WorkQueue::create(const std::string& dir, const std::string& inp, const std::string& work,
+                       const std::map<std::string, std::string>& variables, int lease, std::string& error) {
+    directory = dir;
+    workDir = work;
+    vars = variables;
+    leaseSeconds = lease;
+    inpFile = dir + "/job.inp";
+    if (Utils::fileExists(dir + "/queue.info")) {
+        error = dir + " already contains a queue";
+        return false;
+    }
+    for (const char* sub : {"pending", "claimed", "done", "failed", "workers"}) {
+        if (!Utils::makeDirs(dir + "/" + sub)) {
+            error = "cannot create " + dir + "/" + sub;
+            return false;
+        }
+    }
+    if (!Utils::copyFile(inp, inpFile)) {
+        error = "cannot copy " + inp + " to " + inpFile;
+        return false;
+    }
+    std::string info = "workdir=" + workDir + "\nlease=" + std::to_string(leaseSeconds) + "\n";
+    for (const auto& var : vars) {
+        info += "var=" + var.first + "=" + var.second + "\n";
+    }
+    return writeFile(dir + "/queue.info", info, error);
+}
+
+bool WorkQueue::addJob(const QueueJob& job, std::string& error) {
+    std::string content = "wfn=" + job.wfnFile + "\nfile=" + std::to_string(job.file) +
+                          "\nblock=" + std::to_string(job.block) +
+                          "\ntask=" + std::to_string(job.task) + "\ncores=" + std::to_string(job.cores) + "\n";
+    return writeFile(directory + "/pending/" + jobName(job.file, job.block), content, error);
+}
+
+bool WorkQueue::open(const std::string& dir, std::string& error) {
+    directory = dir;
+    inpFile = dir + "/job.inp";
+    std::ifstream info(dir + "/queue.info");
+    if (!info.is_open()) {
+        error = dir + " is not a banewfn queue (no queue.info)";
+        return false;
+    }
+    std::string line;
+    while (std::getline(info, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+        if (key == "workdir") {
+            workDir = value;
+        } else if (key == "lease") {
+            leaseSeconds = std::atoi(value.c_str());
+        } else if (key == "var") {
+            size_t varEq = value.find('=');
+            if (varEq != std::string::npos) {
+                vars[value.substr(0, varEq)] = value.substr(varEq + 1);
+            }
+        }
+    }
+    if (leaseSeconds <= 0) {
+        leaseSeconds = 60;
+    }
+    workerId = hostName() + "-" + std::to_string(getpid());
+    return true;
+}
+
+bool WorkQueue::heartbeat() {
+    std::string path = directory + "/workers/" + workerId;
+    if (utime(path.c_str(), nullptr) != 0) {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+    }
+    return modificationTime(path, lastBeat);
+}
+
+size_t WorkQueue::requeueExpired() {
+    size_t requeued = 0;
+    for (const auto& entry : Utils::listDirectory(directory + "/claimed")) {
+        std::string job, worker;
+        if (!splitClaim(entry, job, worker) || worker == workerId) {
+            continue;
+        }
+        long long beat = 0;
+        if (modificationTime(directory + "/workers/" + worker, beat) && beat + leaseSeconds >= lastBeat) {
+            continue;
+        }
+        std::string src = directory + "/claimed/" + entry;
+        std::string dst = directory + "/pending/" + job;
+        if (rename(src.c_str(), dst.c_str()) == 0) {
+            std::cout << "Requeued job " << job << ": worker " << worker << " lost its lease" << std::endl;
+            requeued++;
+        }
+    }
+    // Forget heartbeats of workers that are gone
+    for (const auto& worker : Utils::listDirectory(directory + "/workers")) {
+        long long beat = 0;
+        if (worker != workerId && modificationTime(directory + "/workers/" + worker, beat) &&
+            beat + leaseSeconds < lastBeat) {
+            remove((directory + "/workers/" + worker).c_str());
+        }
+    }
+    return requeued;
+}
+
+bool WorkQueue::readJob(const std::string& path, QueueJob& job) const {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+        if (key == "wfn") {
+            job.wfnFile = value;
+        } else if (key == "file") {
+            job.file = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "block") {
+            job.block = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "task") {
+            job.task = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "cores") {
+            job.cores = std::atoi(value.c_str());
+        }
+    }
+    return !job.wfnFile.empty();
+}
+
+WorkQueue::ClaimResult WorkQueue::claim(QueueJob& job) {
+    std::vector<std::string> pending = Utils::listDirectory(directory + "/pending");
+    for (const auto& name : pending) {
+        size_t file = 0, block = 0;
+        if (!parseJobName(name, file, block)) {
+            continue;
+        }
+        std::string src = directory + "/pending/" + name;
+        if (block > 0) {
+            std::string previous = jobName(file, block - 1);
+            if (Utils::fileExists(directory + "/failed/" + previous)) {
+                if (rename(src.c_str(), (directory + "/failed/" + name).c_str()) == 0) {
+                    std::cerr << "Skipped job " << name << ": job " << previous << " failed" << std::endl;
+                }
+                continue;
+            }
+            if (!Utils::fileExists(directory + "/done/" + previous)) {
+                continue;
+            }
+        }
+        std::string dst = directory + "/claimed/" + name + "@" + workerId;
+        if (rename(src.c_str(), dst.c_str()) != 0) {
+            continue;  // Another worker was faster
+        }
+        job = QueueJob();
+        job.name = name;
+        if (!readJob(dst, job)) {
+            std::cerr << "Error: Unreadable job " << name << std::endl;
+            rename(dst.c_str(), (directory + "/failed/" + name).c_str());
+            continue;
+        }
+        return Claimed;
+    }
+    if (pending.empty() && Utils::listDirectory(directory + "/claimed").empty()) {
+        return Empty;
+    }
+    return Waiting;
+}
+
+bool WorkQueue::finish(const QueueJob& job, bool success) {
+    std::string src = directory + "/claimed/" + job.name + "@" + workerId;
+    std::string dst = directory + (success ? "/done/" : "/failed/") + job.name;
+    return rename(src.c_str(), dst.c_str()) == 0;
+}
+
+void WorkQueue::leave() {
+    remove((directory + "/workers/" + workerId).c_str());
+}
@@ -0,0 +1,72 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+#include <map>
+#include <string>
+#include <vector>
+
+// One block of one wavefunction, run by whichever worker claims it
+struct QueueJob {
+    std::string name;  // <file>-<block>, e.g. 000012-003
+    std::string wfnFile;
+    size_t file = 0;
+    size_t block = 0;  // Position among the queued jobs of the file (they run in this order)
+    size_t task = 0;  // Index of the block in the input file
+    int cores = 0;
+};
+
+// Job queue in a shared directory (banewfn --enqueue / --worker). It needs no server,
+// only a filesystem with atomic rename() visible to every node:
+//   job.inp, queue.info   the input file and the batch settings (working directory, variables, lease)
+//   pending/<job>         jobs waiting for a worker
+//   claimed/<job>@<id>    jobs being run; claimed by renaming them out of pending/
+//   done/, failed/        finished jobs
+//   workers/<id>          heartbeat of each worker, touched while it runs
+// A claimed job whose worker has not touched its heartbeat for a lease period is renamed
+// back into pending/. Times are compared with the filesystem's own clock (the mtime of a
+// freshly touched heartbeat), so clock skew between nodes doesn't matter. Blocks of the
+// same wavefunction run in order: a job is only claimed after its predecessor is done.
+class WorkQueue {
+public:
+    enum ClaimResult { Claimed, Waiting, Empty };
+
+    // Create a new queue (the directory must not contain one yet)
+    bool create(const std::string& dir, const std::string& inpFile, const std::string& workDir,
+                const std::map<std::string, std::string>& vars, int leaseSeconds, std::string& error);
+    bool addJob(const QueueJob& job, std::string& error);
+
+    // Open an existing queue as a worker
+    bool open(const std::string& dir, std::string& error);
+
+    const std::string& getInpFile() const { return inpFile; }
+    const std::string& getWorkDir() const { return workDir; }
+    const std::map<std::string, std::string>& getVars() const { return vars; }
+    int getLeaseSeconds() const { return leaseSeconds; }
+    const std::string& getWorkerId() const { return workerId; }
+
+    // Renew this worker's lease
+    bool heartbeat();
+    // Return jobs of workers whose lease expired to pending/; returns how many were requeued
+    size_t requeueExpired();
+    // Claim the next job that is ready to run. Jobs whose predecessor failed are failed too.
+    ClaimResult claim(QueueJob& job);
+    // Move a claimed job to done/ or failed/; false if the lease was lost meanwhile
+    bool finish(const QueueJob& job, bool success);
+    // Remove this worker's heartbeat
+    void leave();
+
+    static std::string jobName(size_t file, size_t block);
+
+private:
+    bool readJob(const std::string& path, QueueJob& job) const;
+    bool writeFile(const std::string& path, const std::string& content, std::string& error) const;
+
+    std::string directory;
+    std::string inpFile;
+    std::string workDir;
+    std::map<std::string, std::string> vars;
+    int leaseSeconds = 60;
+    std::string workerId;
+    long long lastBeat = 0;  // Filesystem time of the last heartbeat
+};
+
+#endif // WORKQUEUE_H
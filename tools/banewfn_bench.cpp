@@ -0,0 +1,381 @@
+// Driver overhead benchmark: runs banewfn on synthetic batches with fake_multiwfn standing in
+// for Multiwfn, and reports throughput, per-job overhead and peak memory.
+//   banewfn_bench [options]
+// Each batch runs in a fresh directory with its own banewfn.rc, a bench.conf and N small .fchk
+// files. Results are appended to a tab-separated file and compared with the previous run of
+// the same batch, so that numbers can be tracked across commits.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct BenchOptions {
+    std::string banewfn;  // Default: next to this executable
+    std::string fake;
+    std::vector<long> sizes = {10, 1000, 100000};
+    int jobs = 4;
+    long latencyMs = 0;
+    long cpuMs = 0;
+    long logKb = 4;
+    long cubeKb = 0;
+    std::string results = "banewfn_bench.tsv";
+    std::string label = "-";
+    std::string workRoot;  // Default: $TMPDIR or /tmp
+    bool keep = false;
+};
+
+struct BenchResult {
+    long files = 0;
+    int jobs = 0;
+    double wall = 0;
+    long long peakRssKb = 0;
+    int exitCode = 0;
+    double jobsPerSecond() const { return wall > 0 ? files / wall : 0; }
+};
+
+// Module conf of the benchmark: a [main] section with placeholders, two post-processing steps,
+// and the [return]/[quit] sequences, so that the stub checks every part of the generated script
+const char* kBenchConf =
+    "[main]\n"
+    "7\n"
+    "${method:-1}\n"
+    "\n"
+    "[charges]\n"
+    "1\n"
+    "${pop:-1}\n"
+    "y\n"
+    "-default-\n"
+    "pop=2\n"
+    "\n"
+    "[grid]\n"
+    "5\n"
+    "1\n"
+    "${grid:-2}\n"
+    "0\n"
+    "\n"
+    "[extract]\n"
+    "charge[] = Atom\\s+\\d+\\([A-Za-z ]+\\):\\s*(-?\\d+\\.\\d+)\n"
+    "\n"
+    "[return]\n"
+    "0\n"
+    "\n"
+    "[quit]\n"
+    "0\n"
+    "q\n";
+
+const char* kBenchInp =
+    "wfn=*.fchk\n"
+    "[bench]\n"
+    "method 1\n"
+    "%process\n"
+    "  charges pop 3\n"
+    "  grid grid 1\n"
+    "end\n";
+
+std::string directoryOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+std::string absolute(const std::string& path) {
+    if (!path.empty() && path[0] == '/') {
+        return path;
+    }
+    char buf[4096];
+    return getcwd(buf, sizeof(buf)) ? std::string(buf) + "/" + path : path;
+}
+
+bool writeFile(const std::string& path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << text;
+    return out.good();
+}
+
+// Header of a formatted checkpoint file; enough for banewfn's header scan and placeholders
+std::string fchkText(long index) {
+    long natoms = 3 + index % 60;
+    long nbasis = natoms * 14;
+    long electrons = natoms * 6;
+    std::ostringstream out;
+    out << "bench molecule " << index << "\n";
+    out << "SP        RB3LYP                                                      6-31G(d)\n";
+    auto integer = [&](const char* key, long value) {
+        out << std::left << std::setw(43) << key << "I" << std::right << std::setw(17) << value << "\n";
+    };
+    integer("Number of atoms", natoms);
+    integer("Charge", 0);
+    integer("Multiplicity", 1);
+    integer("Number of electrons", electrons);
+    integer("Number of alpha electrons", electrons / 2);
+    integer("Number of beta electrons", electrons / 2);
+    integer("Number of basis functions", nbasis);
+    integer("Number of independent functions", nbasis);
+    out << std::left << std::setw(43) << "Atomic numbers" << "I   N=" << std::right << std::setw(12) << natoms << "\n";
+    for (long i = 0; i < natoms; i++) {
+        out << std::setw(12) << 6 << ((i % 6 == 5 || i + 1 == natoms) ? "\n" : "");
+    }
+    return out.str();
+}
+
+bool prepareBatch(const std::string& dir, long files, const BenchOptions& options) {
+    if (mkdir(dir.c_str(), 0755) != 0 || mkdir((dir + "/conf").c_str(), 0755) != 0) {
+        std::cerr << "Error: Cannot create " << dir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::string rc = "Multiwfn_exec=" + options.fake + "\nconfpath=" + dir + "/conf\ncores=1\n";
+    if (!writeFile(dir + "/banewfn.rc", rc) || !writeFile(dir + "/conf/bench.conf", kBenchConf) ||
+        !writeFile(dir + "/job.inp", kBenchInp)) {
+        std::cerr << "Error: Cannot write the batch setup in " << dir << std::endl;
+        return false;
+    }
+    char name[32];
+    for (long i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "/m%07ld.fchk", i);
+        if (!writeFile(dir + name, fchkText(i))) {
+            std::cerr << "Error: Cannot write " << dir << name << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run banewfn in the batch directory; its output goes to banewfn.log there
+bool runBatch(const std::string& dir, const BenchOptions& options, BenchResult& result) {
+    std::string jobs = std::to_string(result.jobs);
+    std::vector<std::string> args = {options.banewfn, "job.inp", "-j", jobs, "-c", jobs};
+    std::vector<std::string> env = {
+        "FAKE_MULTIWFN_CONF=" + dir + "/conf/bench.conf",
+        "FAKE_MULTIWFN_LATENCY_MS=" + std::to_string(options.latencyMs),
+        "FAKE_MULTIWFN_CPU_MS=" + std::to_string(options.cpuMs),
+        "FAKE_MULTIWFN_LOG_KB=" + std::to_string(options.logKb),
+        "FAKE_MULTIWFN_CUBE_KB=" + std::to_string(options.cubeKb),
+    };
+
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Error: fork failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (pid == 0) {
+        int log = open((dir + "/banewfn.log").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int null = open("/dev/null", O_RDONLY);
+        if (log < 0 || null < 0 || chdir(dir.c_str()) != 0) {
+            _exit(127);
+        }
+        dup2(null, STDIN_FILENO);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        for (const auto& entry : env) {
+            putenv(const_cast<char*>(entry.c_str()));
+        }
+        std::vector<char*> argv;
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        std::cerr << "Error: wait4 failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    result.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    // Largest process of the tree: banewfn itself, the stub stays far smaller
+    result.peakRssKb = usage.ru_maxrss;
+    result.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return true;
+}
+
+// Last recorded result of the same batch (files, jobs, simulated load), if any
+bool previousResult(const std::string& path, const std::string& key, double& jobsPerSecond, std::string& label) {
+    std::ifstream in(path);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() >= 7 && fields[2] == key) {
+            label = fields[1];
+            jobsPerSecond = std::atof(fields[4].c_str());
+            found = true;
+        }
+    }
+    return found;
+}
+
+void removeTree(const std::string& dir) {
+    std::string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()) != 0) {
+        std::cerr << "Warning: Cannot remove " << dir << std::endl;
+    }
+}
+
+void printUsage(const char* progName) {
+    std::cout << "Usage: " << progName << " [options]\n";
+    std::cout << "\nOptions:\n";
+    std::cout << "  --sizes <n,n,...>   Batch sizes in files (default: 10,1000,100000)\n";
+    std::cout << "  -j, --jobs <num>    Concurrent files, passed to banewfn as -j and -c (default: 4)\n";
+    std::cout << "  --latency <ms>      Idle time of each stub Multiwfn run (default: 0)\n";
+    std::cout << "  --cpu <ms>          Busy CPU time of each stub Multiwfn run (default: 0)\n";
+    std::cout << "  --log-kb <kb>       Output written by each stub run (default: 4)\n";
+    std::cout << "  --cube-kb <kb>      Write a cube of this size per run (default: 0, none)\n";
+    std::cout << "  --results <file>    Append results to <file> (default: banewfn_bench.tsv)\n";
+    std::cout << "  --label <text>      Label of this run in the results, e.g. a commit id\n";
+    std::cout << "  --banewfn <path>    banewfn binary (default: next to this program)\n";
+    std::cout << "  --fake <path>       Stub Multiwfn (default: fake_multiwfn next to this program)\n";
+    std::cout << "  --workdir <dir>     Where the batch directories are created (default: $TMPDIR or /tmp)\n";
+    std::cout << "  --keep              Keep the batch directories\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else if (!hasValue) {
+            std::cerr << "Error: Unknown option or missing argument: " << arg << std::endl;
+            return 1;
+        } else if (arg == "--sizes") {
+            options.sizes.clear();
+            std::stringstream ss(argv[++i]);
+            std::string size;
+            while (std::getline(ss, size, ',')) {
+                if (std::atol(size.c_str()) > 0) {
+                    options.sizes.push_back(std::atol(size.c_str()));
+                }
+            }
+        } else if (arg == "-j" || arg == "--jobs") {
+            options.jobs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--latency") {
+            options.latencyMs = std::atol(argv[++i]);
+        } else if (arg == "--cpu") {
+            options.cpuMs = std::atol(argv[++i]);
+        } else if (arg == "--log-kb") {
+            options.logKb = std::atol(argv[++i]);
+        } else if (arg == "--cube-kb") {
+            options.cubeKb = std::atol(argv[++i]);
+        } else if (arg == "--results") {
+            options.results = argv[++i];
+        } else if (arg == "--label") {
+            options.label = argv[++i];
+        } else if (arg == "--banewfn") {
+            options.banewfn = argv[++i];
+        } else if (arg == "--fake") {
+            options.fake = argv[++i];
+        } else if (arg == "--workdir") {
+            options.workRoot = argv[++i];
+        } else {
+            std::cerr << "Error: Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    std::string selfDir = directoryOf(absolute(argv[0]));
+    options.banewfn = absolute(options.banewfn.empty() ? selfDir + "/banewfn" : options.banewfn);
+    options.fake = absolute(options.fake.empty() ? selfDir + "/fake_multiwfn" : options.fake);
+    for (const std::string& tool : {options.banewfn, options.fake}) {
+        if (access(tool.c_str(), X_OK) != 0) {
+            std::cerr << "Error: Not executable: " << tool << std::endl;
+            return 1;
+        }
+    }
+    if (options.workRoot.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        options.workRoot = tmp && *tmp ? tmp : "/tmp";
+    }
+    options.workRoot = absolute(options.workRoot);
+
+    // Each run gets one core (-c equals -j), so the stub burns its CPU time on one thread
+    double simulated = (options.latencyMs + options.cpuMs) / 1000.0;
+    std::cout << "banewfn:  " << options.banewfn << "\nstub:     " << options.fake << "\n";
+    std::cout << "per run:  " << options.latencyMs << " ms idle, " << options.cpuMs << " ms CPU, "
+              << options.logKb << " KB log, " << options.cubeKb << " KB cube\n\n";
+    std::cout << std::right << std::setw(9) << "Files" << std::setw(6) << "Jobs" << std::setw(11) << "Wall (s)"
+              << std::setw(11) << "Jobs/s" << std::setw(15) << "Overhead (ms)" << std::setw(11) << "RSS (MB)"
+              << std::setw(6) << "Exit" << "  vs. previous\n";
+
+    bool allOk = true;
+    for (long files : options.sizes) {
+        BenchResult result;
+        result.files = files;
+        result.jobs = static_cast<int>(std::min<long>(options.jobs, files));
+        std::string dir = options.workRoot + "/banewfn_bench_" + std::to_string(getpid()) + "_" + std::to_string(files);
+        if (!prepareBatch(dir, files, options) || !runBatch(dir, options, result)) {
+            removeTree(dir);
+            return 1;
+        }
+        if (result.exitCode != 0) {
+            allOk = false;
+        }
+
+        // Overhead: time a job slot spends per file beyond the simulated Multiwfn work
+        double overheadMs = (result.wall * result.jobs / files - simulated) * 1000.0;
+        std::ostringstream keyText;
+        keyText << files << "x" << result.jobs << "/" << options.latencyMs << "ms+" << options.cpuMs << "cpu/"
+                << options.logKb << "kb/" << options.cubeKb << "cube";
+        std::string key = keyText.str();
+        double previousRate = 0;
+        std::string previousLabel;
+        bool hasPrevious = previousResult(options.results, key, previousRate, previousLabel);
+
+        std::cout << std::fixed << std::setw(9) << files << std::setw(6) << result.jobs << std::setprecision(2)
+                  << std::setw(11) << result.wall << std::setprecision(1) << std::setw(11) << result.jobsPerSecond()
+                  << std::setprecision(2) << std::setw(15) << overheadMs << std::setprecision(1) << std::setw(11)
+                  << result.peakRssKb / 1024.0 << std::setw(6) << result.exitCode;
+        if (hasPrevious && previousRate > 0) {
+            std::cout << "  " << std::showpos << std::setprecision(1)
+                      << (result.jobsPerSecond() / previousRate - 1) * 100 << std::noshowpos << "% jobs/s vs. "
+                      << previousLabel;
+        }
+        std::cout << std::defaultfloat << std::endl;
+        if (result.exitCode != 0) {
+            std::cout << "          banewfn failed, see " << dir << "/banewfn.log" << std::endl;
+        }
+
+        // time label batch wall jobs/s overhead_ms rss_kb exit
+        std::ofstream out(options.results, std::ios::app);
+        out << std::time(nullptr) << "\t" << options.label << "\t" << key << "\t" << std::fixed
+            << std::setprecision(3) << result.wall << "\t" << result.jobsPerSecond() << "\t" << overheadMs << "\t"
+            << result.peakRssKb << "\t" << result.exitCode << "\n";
+        if (!out.good()) {
+            std::cerr << "Warning: Cannot append to " << options.results << std::endl;
+        }
+
+        if (!options.keep && result.exitCode == 0) {
+            removeTree(dir);
+        }
+    }
+    std::cout << "\nResults appended to " << options.results << std::endl;
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+// Build-time generator: compiles conf/*.conf into a C++ source with a constant table
+// (sorted by module name) that is linked into banewfn as the embedded module library.
+//   embed_confs <conf dir> <output.cpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace {
+
+struct Entry {
+    std::string name;
+    std::string text;
+    long long mtime;
+};
+
+std::vector<std::string> listConfs(const std::string& dir) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    HANDLE hFind = FindFirstFileA((dir + "\\*.conf").c_str(), &findData);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            names.push_back(findData.cFileName);
+        } while (FindNextFileA(hFind, &findData));
+        FindClose(hFind);
+    }
+#else
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name.size() > 5 && name.compare(name.size() - 5, 5, ".conf") == 0) {
+                names.push_back(name);
+            }
+        }
+        closedir(d);
+    }
+#endif
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// C string literal, split after each newline; bytes outside printable ASCII as octal escapes
+std::string literal(const std::string& text) {
+    std::string out = "\"";
+    char buf[8];
+    for (unsigned char c : text) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c == '\n') {
+            out += "\\n\"\n    \"";
+        } else if (c < 0x20 || c >= 0x7f || c == '?') {
+            snprintf(buf, sizeof(buf), "\\%03o", c);
+            out += buf;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <conf dir> <output.cpp>" << std::endl;
+        return 1;
+    }
+    std::string dir = argv[1];
+
+    std::vector<Entry> entries;
+    for (const auto& file : listConfs(dir)) {
+        std::string path = dir + "/" + file;
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) {
+            std::cerr << "Error: Cannot read " << path << std::endl;
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        struct stat st;
+        long long mtime = stat(path.c_str(), &st) == 0 ? static_cast<long long>(st.st_mtime) : 0;
+        entries.push_back({file.substr(0, file.size() - 5), buffer.str(), mtime});
+    }
+
+    std::ostringstream out;
+    out << "// Generated by embed_confs from " << dir << "/*.conf - do not edit\n";
+    out << "#include \"confstore.h\"\n\n";
+    for (size_t i = 0; i < entries.size(); i++) {
+        out << "static const char kConf" << i << "[] =\n    " << literal(entries[i].text) << ";\n\n";
+    }
+    out << "const EmbeddedConf kEmbeddedConfs[] = {\n";
+    for (size_t i = 0; i < entries.size(); i++) {
+        out << "    {\"" << entries[i].name << "\", kConf" << i << ", sizeof(kConf" << i << ") - 1, "
+            << entries[i].mtime << "LL},\n";
+    }
+    if (entries.empty()) {
+        out << "    {\"\", \"\", 0, 0LL},\n";
+    }
+    out << "};\n";
+    out << "const size_t kEmbeddedConfCount = " << entries.size() << ";\n";
+
+    // Only touch the output when it changes, so that rebuilds stay incremental
+    std::string path = argv[2];
+    std::string generated = out.str();
+    std::ifstream previous(path, std::ios::binary);
+    if (previous.is_open()) {
+        std::stringstream old;
+        old << previous.rdbuf();
+        if (old.str() == generated) {
+            return 0;
+        }
+        previous.close();
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Cannot write " << path << std::endl;
+        return 1;
+    }
+    file << generated;
+    return file.good() ? 0 : 1;
+}
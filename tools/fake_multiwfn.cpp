@@ -0,0 +1,346 @@
+// Stand-in for Multiwfn used by banewfn_bench: no chemistry, only the behaviour banewfn sees.
+//   fake_multiwfn <wavefunction> [-np <cores>]  < menu script
+// The script read from stdin is checked against the section structure of a .conf: it must be
+// the [main] commands, any other sections, and [quit], with [return] leading back to [main]
+// (fused sessions). Placeholders in the conf match any text. Settings come from the environment:
+//   FAKE_MULTIWFN_CONF        .conf to check the script against (no check if unset)
+//   FAKE_MULTIWFN_LATENCY_MS  idle time per run (waiting for I/O, loading)
+//   FAKE_MULTIWFN_CPU_MS      busy CPU time per run, split over the -np threads
+//   FAKE_MULTIWFN_LOG_KB      size of the log written to stdout
+//   FAKE_MULTIWFN_CUBE_KB     size of the Gaussian cube written as <wavefunction stem>.cub
+//   FAKE_MULTIWFN_SESSION     if set, stay at the main menu like a warm session: the menu is
+//                             printed after loading and after every [return] sequence (each
+//                             script since the last menu is checked up to it), "q" quits
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+long envNumber(const char* name) {
+    const char* value = std::getenv(name);
+    return value ? std::atol(value) : 0;
+}
+
+std::string trim(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+// Command lines of each section, as banewfn reads them (comments, -default- and -output- blocks dropped)
+bool readConf(const std::string& path, std::map<std::string, std::vector<std::string>>& sections) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line, current;
+    bool inBlock = false;
+    while (std::getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) {
+            line = line.substr(0, hash);
+        }
+        line = trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        if (line.front() == '[' && line.back() == ']') {
+            current = line.substr(1, line.size() - 2);
+            sections[current];
+            inBlock = false;
+        } else if (line == "-default-" || line == "-output-") {
+            inBlock = current != "quit" && current != "return" && current != "extract";
+        } else if (!current.empty() && !inBlock && current != "extract") {
+            sections[current].push_back(line);
+        }
+    }
+    return sections.count("main") > 0;
+}
+
+// Whether a script line is a rendering of a conf line: placeholders ($name, ${...}) match any text
+bool matchLine(const std::string& pattern, const std::string& text) {
+    std::vector<std::string> literals(1);
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] == '$' && i + 1 < pattern.size() && pattern[i + 1] == '{') {
+            size_t close = pattern.find('}', i);
+            if (close != std::string::npos) {
+                literals.emplace_back();
+                i = close;
+                continue;
+            }
+        } else if (pattern[i] == '$' && i + 1 < pattern.size() &&
+                   (std::isalpha(static_cast<unsigned char>(pattern[i + 1])) || pattern[i + 1] == '_')) {
+            while (i + 1 < pattern.size() &&
+                   (std::isalnum(static_cast<unsigned char>(pattern[i + 1])) || pattern[i + 1] == '_')) {
+                i++;
+            }
+            literals.emplace_back();
+            continue;
+        }
+        literals.back() += pattern[i];
+    }
+    if (literals.size() == 1) {
+        return trim(text) == trim(pattern);
+    }
+    // Glob match: first literal anchored at the start, last at the end, the others in order.
+    // Lines are rendered verbatim, so empty placeholders may leave spaces at either end.
+    std::string line = text;
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    const std::string& head = literals.front();
+    const std::string& tail = literals.back();
+    if (line.compare(0, head.size(), head) != 0 || line.size() < head.size() + tail.size() ||
+        line.compare(line.size() - tail.size(), tail.size(), tail) != 0) {
+        return false;
+    }
+    size_t pos = head.size();
+    for (size_t i = 1; i + 1 < literals.size(); i++) {
+        pos = line.find(literals[i], pos);
+        if (pos == std::string::npos || pos + literals[i].size() > line.size() - tail.size()) {
+            return false;
+        }
+        pos += literals[i].size();
+    }
+    return true;
+}
+
+// Whether the script is [main] (other sections)* ([return] [main] (other sections)*)* [quit].
+// Returns the index of the first line that cannot be explained, or -1 if the script is valid.
+long checkScript(const std::vector<std::string>& script, const std::map<std::string, std::vector<std::string>>& sections) {
+    // States: (line index, whether the next section must be [main])
+    std::set<std::pair<size_t, bool>> seen;
+    std::vector<std::pair<size_t, bool>> pending = {{0, true}};
+    size_t furthest = 0;
+    while (!pending.empty()) {
+        auto state = pending.back();
+        pending.pop_back();
+        if (!seen.insert(state).second) {
+            continue;
+        }
+        furthest = std::max(furthest, state.first);
+        for (const auto& section : sections) {
+            const std::string& name = section.first;
+            const std::vector<std::string>& lines = section.second;
+            if (name == "extract" || state.second != (name == "main")) {
+                continue;
+            }
+            if (lines.size() > script.size() - state.first) {
+                continue;
+            }
+            bool ok = true;
+            for (size_t i = 0; i < lines.size() && ok; i++) {
+                ok = matchLine(lines[i], script[state.first + i]);
+            }
+            if (!ok) {
+                continue;
+            }
+            size_t next = state.first + lines.size();
+            if (name == "quit") {
+                if (next == script.size()) {
+                    return -1;
+                }
+                continue;
+            }
+            if (lines.empty() && name != "main" && name != "return") {
+                continue;  // Empty sections would loop without consuming anything
+            }
+            pending.push_back({next, name == "return"});
+        }
+    }
+    return static_cast<long>(furthest);
+}
+
+// Gaussian cube of about `kb` kilobytes: one atom, an n x n x n grid
+bool writeCube(const std::string& path, long kb) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+    int n = std::max(2, static_cast<int>(std::cbrt(kb * 1024.0 / 13.5)));
+    fprintf(out, "fake_multiwfn cube\nElectron density\n");
+    fprintf(out, "%5d %11.6f %11.6f %11.6f\n", 1, -5.0, -5.0, -5.0);
+    double step = 10.0 / (n - 1);
+    fprintf(out, "%5d %11.6f %11.6f %11.6f\n", n, step, 0.0, 0.0);
+    fprintf(out, "%5d %11.6f %11.6f %11.6f\n", n, 0.0, step, 0.0);
+    fprintf(out, "%5d %11.6f %11.6f %11.6f\n", n, 0.0, 0.0, step);
+    fprintf(out, "%5d %11.6f %11.6f %11.6f %11.6f\n", 6, 6.0, 0.0, 0.0, 0.0);
+    long points = 0;
+    for (int x = 0; x < n; x++) {
+        for (int y = 0; y < n; y++) {
+            for (int z = 0; z < n; z++) {
+                double r2 = std::pow(-5.0 + x * step, 2) + std::pow(-5.0 + y * step, 2) + std::pow(-5.0 + z * step, 2);
+                fprintf(out, " %12.5E", std::exp(-r2));
+                if (++points % 6 == 0 || z == n - 1) {
+                    fprintf(out, "\n");
+                    points = 0;
+                }
+            }
+        }
+    }
+    return fclose(out) == 0;
+}
+
+void burnCpu(long ms) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    volatile double sink = 0;
+    while (std::chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 10000; i++) {
+            sink = sink + std::sqrt(static_cast<double>(i));
+        }
+    }
+}
+
+void printMainMenu() {
+    std::cout << " ************ Main function menu ************\n"
+              << " 0 Show molecular structure and view orbitals\n"
+              << " 1 Output all properties at a point       1000 Set parameters\n"
+              << " 100 Other functions (Part 1)             q Exit program\n" << std::flush;
+}
+
+// Warm-session mode: read the menu input line by line and answer each [return] with the main menu
+int runSession(const std::string& wfn, int cores, const std::map<std::string, std::vector<std::string>>& sections) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(envNumber("FAKE_MULTIWFN_LATENCY_MS")));
+    std::cout << " Multiwfn (fake) -- loading " << wfn << " with " << cores << " threads\n";
+    printMainMenu();
+
+    // A script ends at [return] instead of [quit]
+    std::map<std::string, std::vector<std::string>> check = sections;
+    std::vector<std::string> back = {"0"};
+    if (check.count("return")) {
+        back = check["return"];
+        check["quit"] = back;
+        check.erase("return");
+    }
+    std::vector<std::string> script;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (script.empty() && trim(line) == "q") {
+            return 0;
+        }
+        script.push_back(line);
+        std::cout << " Input: " << line << "\n";
+        if (script.size() < back.size()) {
+            continue;
+        }
+        bool returned = true;
+        for (size_t i = 0; i < back.size() && returned; i++) {
+            returned = matchLine(back[i], script[script.size() - back.size() + i]);
+        }
+        if (!returned) {
+            continue;
+        }
+        if (!sections.empty()) {
+            long bad = checkScript(script, check);
+            if (bad >= 0) {
+                std::cout << "fake_multiwfn: session script does not follow the conf from line " << bad + 1 << std::endl;
+                return 3;
+            }
+        }
+        burnCpu(envNumber("FAKE_MULTIWFN_CPU_MS"));
+        std::cout << " Analysis done (" << script.size() << " input lines)\n";
+        printMainMenu();
+        script.clear();
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <wavefunction> [-np <cores>] < script" << std::endl;
+        return 1;
+    }
+    std::string wfn = argv[1];
+    int cores = 1;
+    for (int i = 2; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "-np") {
+            cores = std::max(1, std::atoi(argv[i + 1]));
+        }
+    }
+    auto started = std::chrono::steady_clock::now();
+
+    if (std::getenv("FAKE_MULTIWFN_SESSION")) {
+        std::map<std::string, std::vector<std::string>> sections;
+        const char* confPath = std::getenv("FAKE_MULTIWFN_CONF");
+        if (confPath && *confPath && !readConf(confPath, sections)) {
+            std::cerr << "fake_multiwfn: cannot read conf (or no [main] section): " << confPath << std::endl;
+            return 2;
+        }
+        return runSession(wfn, cores, sections);
+    }
+
+    std::vector<std::string> script;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        script.push_back(line);
+    }
+
+    const char* confPath = std::getenv("FAKE_MULTIWFN_CONF");
+    if (confPath && *confPath) {
+        std::map<std::string, std::vector<std::string>> sections;
+        if (!readConf(confPath, sections)) {
+            std::cerr << "fake_multiwfn: cannot read conf (or no [main] section): " << confPath << std::endl;
+            return 2;
+        }
+        long bad = checkScript(script, sections);
+        if (bad >= 0) {
+            std::cerr << "fake_multiwfn: script does not follow " << confPath << " from line " << bad + 1 << ": "
+                      << (static_cast<size_t>(bad) < script.size() ? script[bad] : "<end of input>") << std::endl;
+            return 3;
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(envNumber("FAKE_MULTIWFN_LATENCY_MS")));
+    long cpuMs = envNumber("FAKE_MULTIWFN_CPU_MS");
+    if (cpuMs > 0) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < cores; i++) {
+            threads.emplace_back(burnCpu, cpuMs / cores);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    std::string stem = wfn.substr(wfn.find_last_of("/\\") + 1);
+    stem = stem.substr(0, stem.rfind('.'));
+    long cubeKb = envNumber("FAKE_MULTIWFN_CUBE_KB");
+    if (cubeKb > 0 && !writeCube(stem + ".cub", cubeKb)) {
+        std::cerr << "fake_multiwfn: cannot write " << stem << ".cub" << std::endl;
+        return 4;
+    }
+
+    // Log: a header, the echoed menu input, and filler lines up to the requested size
+    std::ostringstream log;
+    log << " Multiwfn (fake) -- loading " << wfn << " with " << cores << " threads\n";
+    for (size_t i = 0; i < script.size(); i++) {
+        log << " Input " << i + 1 << ": " << script[i] << "\n";
+    }
+    long logBytes = envNumber("FAKE_MULTIWFN_LOG_KB") * 1024;
+    for (long atom = 1; static_cast<long>(log.tellp()) < logBytes; atom++) {
+        log << " Atom" << std::setw(6) << atom << "(C ):  " << std::fixed << std::setprecision(6)
+            << std::sin(static_cast<double>(atom)) * 0.5 << "\n";
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    log << " Calculation took up wall clock time " << std::setprecision(3) << elapsed << " s\n";
+    std::cout << log.str() << std::flush;
+    return 0;
+}
@@ -0,0 +1,285 @@
+// Microbenchmarks of the parsing and placeholder routines that run per line, per file and per
+// block. Large .inp/.conf corpora are generated into a temporary directory first.
+//   banewfn_microbench [--filter <text>] [--blocks <num>] [--time <sec>]
+// For each routine: time per call, heap allocations and allocated bytes per call (counted by
+// the operator new below), and input bytes processed per call with the resulting throughput.
+#include "config.h"
+#include "input.h"
+#include "plan.h"
+#include "utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Allocation counters: every operator new of the process goes through here
+namespace {
+std::atomic<unsigned long long> allocCount(0);
+std::atomic<unsigned long long> allocBytes(0);
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+// GCC flags free() of a pointer from "new" once these are inlined, not knowing new is replaced too
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+struct BenchOptions {
+    std::string filter;
+    int blocks = 2000;  // Blocks of the generated .inp
+    double minSeconds = 0.3;  // Measuring time per routine
+};
+
+// Keeps results alive so the compiler cannot drop the measured calls
+volatile size_t sink = 0;
+
+// Run `op` in growing batches until a batch takes at least minSeconds
+void measure(const BenchOptions& options, const std::string& name, size_t bytesPerOp,
+             const std::function<void()>& op) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+        return;
+    }
+    op();  // Warm-up: page cache, lazily built tables
+    size_t iterations = 1;
+    while (true) {
+        unsigned long long count0 = allocCount.load();
+        unsigned long long bytes0 = allocBytes.load();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            op();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= options.minSeconds || iterations >= (1u << 30)) {
+            double n = static_cast<double>(iterations);
+            double nsPerOp = seconds * 1e9 / n;
+            std::cout << std::left << std::setw(50) << name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << nsPerOp << std::setw(12) << (allocCount.load() - count0) / n
+                      << std::setw(14) << (allocBytes.load() - bytes0) / n << std::setw(12) << bytesPerOp;
+            if (bytesPerOp > 0) {
+                std::cout << std::setw(10) << bytesPerOp / nsPerOp * 1e3 << " MB/s";
+            }
+            std::cout << std::defaultfloat << std::endl;
+            return;
+        }
+        // Aim a little past the target so the next batch usually is the last one
+        double scale = seconds > 0 ? options.minSeconds / seconds * 1.2 : 100;
+        iterations = static_cast<size_t>(iterations * std::min(100.0, std::max(2.0, scale)));
+    }
+}
+
+bool writeFile(const std::string& path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << text;
+    return out.good();
+}
+
+// .inp with many blocks, long %command sections and heavy ${var:-default} use
+std::string generateInp(int blocks) {
+    std::ostringstream out;
+    out << "# generated by banewfn_microbench\n";
+    out << "wfn=*.fchk\n";
+    out << "core=8\n";
+    out << "prefix=bench\n";
+    out << "grid=fine\n";
+    for (int b = 0; b < blocks; b++) {
+        out << "[" << (b % 2 ? "charge" : "grid") << "]\n";
+        out << "name=b" << b << "\n";
+        if (b > 0 && b % 10 == 0) {
+            out << "after=b" << b - 1 << "\n";
+        }
+        out << "pop ${pop:-" << b % 4 << "}  # population method\n";
+        out << "out ${prefix:-run}_${input}_" << b << ".txt\n";
+        out << "%process\n";
+        out << "  hirshfeld pop ${pop:-1} grid ${grid:-coarse}\n";
+        out << "  adch grid ${grid:-coarse}\n";
+        out << "%command\n";
+        for (int line = 0; line < 24; line++) {
+            out << "cp ${input}_" << b << ".txt results/${prefix:-run}/${input}_" << line
+                << "_${suffix:-out}.txt  # keep a copy\n";
+        }
+        out << "end\n";
+    }
+    return out.str();
+}
+
+// .conf with many sections, -default- blocks and placeholders on most lines
+std::string generateConf(int sections) {
+    std::ostringstream out;
+    out << "# generated by banewfn_microbench\n[main]\n7\n${pop:-1}\n-default-\npop=2\n";
+    for (int s = 0; s < sections; s++) {
+        out << "\n[step" << s << "]  # section " << s << "\n";
+        for (int line = 0; line < 8; line++) {
+            out << (line % 2 ? "${grid:-" + std::to_string(line) + "}" : std::to_string(line)) << "\n";
+        }
+        out << "${out:-step" << s << ".txt}  # output name\n";
+        out << "-default-\ngrid=\"2 3\"\n-output-\n${out:-step" << s << ".txt}\n";
+    }
+    out << "\n[extract]\ncharge[] = Atom\\s+\\d+\\([A-Za-z ]+\\):\\s*(-?\\d+\\.\\d+)\n";
+    out << "\n[return]\n0\n\n[quit]\n0\nq\n";
+    return out.str();
+}
+
+void removeTree(const std::string& dir) {
+    std::string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()) != 0) {
+        std::cerr << "Warning: Cannot remove " << dir << std::endl;
+    }
+}
+
+// Swallows the "Loading module configuration" lines while loading confs in a loop
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " [--filter <text>] [--blocks <num>] [--time <sec>]\n";
+            return 0;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--blocks" && i + 1 < argc) {
+            options.blocks = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--time" && i + 1 < argc) {
+            options.minSeconds = std::max(0.01, std::atof(argv[++i]));
+        } else {
+            std::cerr << "Error: Unknown option or missing argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/banewfn_microbench_" + std::to_string(getpid());
+    std::string inpText = generateInp(options.blocks);
+    std::string confText = generateConf(options.blocks / 10 + 1);
+    if (mkdir(dir.c_str(), 0755) != 0 || mkdir((dir + "/conf").c_str(), 0755) != 0 ||
+        !writeFile(dir + "/bench.inp", inpText) || !writeFile(dir + "/conf/bench.conf", confText) ||
+        !writeFile(dir + "/banewfn.rc", "Multiwfn_exec=Multiwfn\nconfpath=" + dir + "/conf\ncores=1\n")) {
+        std::cerr << "Error: Cannot write the corpora in " << dir << std::endl;
+        removeTree(dir);
+        return 1;
+    }
+    std::string inpFile = dir + "/bench.inp";
+    std::string wfnFile = dir + "/molecule.fchk";  // Not a file: no header lookups
+    std::map<std::string, std::string> vars = {{"prefix", "bench"}, {"suffix", "final"}, {"pop", "3"}};
+
+    std::cout << "Corpora: " << inpFile << " (" << options.blocks << " blocks, " << inpText.size() / 1024
+              << " KB), bench.conf (" << confText.size() / 1024 << " KB)\n\n";
+    std::cout << std::left << std::setw(50) << "Routine" << std::right << std::setw(14) << "ns/op" << std::setw(12)
+              << "allocs/op" << std::setw(14) << "bytes alloc" << std::setw(12) << "bytes in" << std::setw(15)
+              << "throughput" << std::endl;
+
+    // Per line: the shapes that occur in .inp and .conf files
+    std::string commandLine = "cp ${input}_12.txt results/${prefix:-run}/${input}_3_${suffix:-out}.txt  # keep a copy";
+    std::string paramLine = "pop ${pop:-1} grid ${grid:-coarse} out ${prefix:-run}_${input}.txt";
+    std::string quotedLine = "title=\"a # b\" # comment";
+    measure(options, "Utils::removeInlineComment", commandLine.size(), [&] {
+        sink = sink + Utils::removeInlineComment(commandLine).size();
+    });
+    measure(options, "Utils::removeInlineComment (quoted #)", quotedLine.size(), [&] {
+        sink = sink + Utils::removeInlineComment(quotedLine).size();
+    });
+    measure(options, "Utils::split (space)", paramLine.size(), [&] {
+        sink = sink + Utils::split(paramLine, ' ').size();
+    });
+    measure(options, "InputParser::replaceInputPlaceholders", commandLine.size(), [&] {
+        sink = sink + InputParser::replaceInputPlaceholders(commandLine, wfnFile, vars).size();
+    });
+    std::map<std::string, std::string> params = {{"pop", "3"}, {"out", "x.txt"}};
+    measure(options, "replacePlaceholders", paramLine.size(), [&] {
+        sink = sink + replacePlaceholders(paramLine, params).size();
+    });
+    CommandTemplate compiled = CommandTemplate::compile(paramLine, {{"grid", "fine"}});
+    std::string rendered;
+    measure(options, "CommandTemplate::render", paramLine.size(), [&] {
+        rendered.clear();
+        compiled.render(params, rendered);
+        sink = sink + rendered.size();
+    });
+
+    // Per file: the whole corpus
+    measure(options, "InputParser::parseInpFileWithWfnAndCoresAndVars", inpText.size(), [&] {
+        auto parsed = InputParser::parseInpFileWithWfnAndCoresAndVars(inpFile);
+        sink = sink + std::get<0>(parsed).size();
+    });
+    auto parsed = InputParser::parseInpFileWithWfnAndCoresAndVars(inpFile);
+    std::vector<ModuleTask> tasks = std::get<0>(parsed);
+    measure(options, "InputParser::applyPlaceholderReplacement", inpText.size(), [&] {
+        std::vector<ModuleTask> copy = tasks;
+        InputParser::applyPlaceholderReplacement(copy, wfnFile, vars);
+        sink = sink + copy.size();
+    });
+    ExecutionPlan plan;
+    if (plan.load(inpFile)) {
+        measure(options, "ExecutionPlan::instantiate", inpText.size(), [&] {
+            PlanInstance instance = plan.instantiate(wfnFile, vars);
+            sink = sink + instance.getTasks().size();
+        });
+    }
+
+    // Per module: loaded confs are kept, so each call needs a fresh manager (and its banewfn.rc);
+    // the first line measures that setup alone
+    std::string rcFile = dir + "/banewfn.rc";
+    std::streambuf* saved = std::cout.rdbuf();
+    NullBuffer quiet;
+    measure(options, "ConfigManager::loadBaneWfnConfig", 0, [&] {
+        ConfigManager manager;
+        std::cout.rdbuf(&quiet);
+        manager.loadBaneWfnConfig(rcFile);
+        std::cout.rdbuf(saved);
+        sink = sink + manager.getCores();
+    });
+    measure(options, "  + ConfigManager::loadModuleConfig", confText.size(), [&] {
+        ConfigManager manager;
+        std::cout.rdbuf(&quiet);
+        manager.loadBaneWfnConfig(rcFile);
+        manager.loadModuleConfig("bench");
+        std::cout.rdbuf(saved);
+        sink = sink + manager.getModuleConfig("bench").sections.size();
+    });
+
+    removeTree(dir);
+    return 0;
+}